@@ -19,6 +19,7 @@
 #include <benchmark/benchmark.h>
 #include <stdint.h>
 #include <algorithm>
+#include <list>
 
 /**
  * Generates a list of `len` random numbers in range [start; end]
@@ -56,10 +57,7 @@ static void Cache_RandomAccess(benchmark::State& state) {
       cache.put(*begin, Page());
     }
 
-    if (begin == end)
-      begin = sequence.begin();
-    else
-      ++begin;
+    if (++begin == end) begin = sequence.begin();
 
     items++;
   }
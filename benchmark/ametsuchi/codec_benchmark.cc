@@ -0,0 +1,126 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/ametsuchi.h>
+#include <ametsuchi/codec.h>
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../../test/generator/tx_generator.h"
+
+using ametsuchi::Codec;
+
+// state.range(0): 0 - raw, 1 - zstd, 2 - zstd with trained dictionary
+static const size_t TXS = 1000;
+
+static std::vector<std::vector<uint8_t>> transactions() {
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < TXS; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, "creator"));
+  }
+  return blobs;
+}
+
+static MDB_val make_val(const std::vector<uint8_t> &blob) {
+  MDB_val val;
+  val.mv_data = (void *)blob.data();
+  val.mv_size = blob.size();
+  return val;
+}
+
+/**
+ * Decode latency of a single transaction, label shows encoded size of all
+ * transactions.
+ */
+static void Codec_Decode(benchmark::State &state) {
+  auto blobs = transactions();
+  Codec codec(state.range(0) == 0 ? Codec::NONE : Codec::ZSTD);
+  if (state.range(0) == 2) {
+    std::vector<MDB_val> samples;
+    for (auto &&blob : blobs) samples.push_back(make_val(blob));
+    auto dictionary = Codec::train(samples, 16 * 1024);
+    codec.set_dictionary(dictionary.data(), dictionary.size());
+  }
+
+  size_t raw = 0, encoded = 0;
+  std::vector<std::vector<uint8_t>> values;
+  for (auto &&blob : blobs) {
+    auto val = codec.encode(make_val(blob));
+    auto p = static_cast<uint8_t *>(val.mv_data);
+    values.emplace_back(p, p + val.mv_size);
+    raw += blob.size();
+    encoded += val.mv_size;
+  }
+
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    auto val = make_val(values[i++ % values.size()]);
+    benchmark::DoNotOptimize(codec.decode(val).data);
+  }
+
+  state.SetBytesProcessed(state.iterations() * raw / values.size());
+  state.SetLabel(std::to_string(encoded) + "/" + std::to_string(raw) +
+                 " bytes");
+}
+
+/**
+ * getAssetCreateByKey over TXS committed transactions, label shows size of
+ * the database file.
+ */
+static void Ametsuchi_ReadByKey(benchmark::State &state) {
+  std::string folder = "/tmp/ametsuchi_benchmark/";
+  auto blobs = transactions();
+
+  ametsuchi::Ametsuchi::Options options;
+  if (state.range(0) > 0) {
+    // no dictionary unless trained on at least TXS / 2 values
+    options.codecs.push_back(
+        {ametsuchi::TxStore::TX_STORE, Codec::ZSTD, 3,
+         state.range(0) == 2 ? TXS / 2 : TXS * 1000, 16 * 1024});
+  }
+
+  flatbuffers::FlatBufferBuilder fbb(256);
+  fbb.Finish(fbb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+
+  {
+    ametsuchi::Ametsuchi ametsuchi(folder, options);
+    for (size_t i = 0; i < blobs.size(); i++) {
+      ametsuchi.append(&blobs[i]);
+      if (i == TXS / 2) ametsuchi.commit();
+    }
+    ametsuchi.commit();
+
+    while (state.KeepRunning()) {
+      benchmark::DoNotOptimize(ametsuchi.getAssetCreateByKey(key).size());
+    }
+  }
+
+  std::ifstream file(folder + "data.mdb", std::ios::binary | std::ios::ate);
+  state.SetLabel(std::to_string(file.tellg()) + " bytes on disk");
+  system(("rm -rf " + folder).c_str());
+
+  state.SetItemsProcessed(state.iterations() * TXS);
+}
+
+BENCHMARK(Codec_Decode)->Arg(0)->Arg(1)->Arg(2);
+BENCHMARK(Ametsuchi_ReadByKey)->Arg(0)->Arg(1)->Arg(2);
+
+BENCHMARK_MAIN()
@@ -0,0 +1,101 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2016 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/ametsuchi.h>
+#include <benchmark/benchmark.h>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include "../../test/generator/tx_generator.h"
+
+using ametsuchi::TxStore;
+using ametsuchi::tree_handle_t;
+
+/**
+ * Tree lookups done by TxStore::append() for a single AssetTransfer, when
+ * trees are stored in a map by name.
+ */
+static void TreeLookup_StringMap(benchmark::State& state) {
+  std::unordered_map<std::string, tree_handle_t> trees;
+  for (auto name : {"tx_store", "merkle_tree", "index_asset_transfer",
+                    "index_transfer_sender", "index_transfer_receiver"}) {
+    trees[name] = tree_handle_t(trees.size(), nullptr);
+  }
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(trees.at("tx_store").second);
+    benchmark::DoNotOptimize(trees.at("index_asset_transfer").second);
+    benchmark::DoNotOptimize(trees.at("index_transfer_sender").second);
+    benchmark::DoNotOptimize(trees.at("index_transfer_receiver").second);
+  }
+}
+
+/**
+ * The same lookups in the enum-indexed handle table.
+ */
+static void TreeLookup_EnumArray(benchmark::State& state) {
+  std::array<tree_handle_t, TxStore::TREES_TOTAL> trees;
+  for (size_t i = 0; i < trees.size(); i++) {
+    trees[i] = tree_handle_t(i, nullptr);
+  }
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(trees[TxStore::TX_STORE].second);
+    benchmark::DoNotOptimize(trees[TxStore::INDEX_ASSET_TRANSFER].second);
+    benchmark::DoNotOptimize(trees[TxStore::INDEX_TRANSFER_SENDER].second);
+    benchmark::DoNotOptimize(trees[TxStore::INDEX_TRANSFER_RECEIVER].second);
+  }
+}
+
+/**
+ * Whole append of AssetCreate transactions, the block is rolled back every
+ * 1000 transactions.
+ */
+static void Ametsuchi_Append(benchmark::State& state) {
+  std::string folder = "/tmp/ametsuchi_benchmark/";
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < 1000; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union()));
+  }
+
+  {
+    ametsuchi::Ametsuchi ametsuchi(folder);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+      ametsuchi.append(&blobs[i++]);
+      if (i == blobs.size()) {
+        // the same assets can not be created twice
+        state.PauseTiming();
+        ametsuchi.rollback();
+        state.ResumeTiming();
+        i = 0;
+      }
+    }
+    ametsuchi.commit();
+  }
+  system(("rm -rf " + folder).c_str());
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(TreeLookup_StringMap);
+BENCHMARK(TreeLookup_EnumArray);
+BENCHMARK(Ametsuchi_Append);
+
+BENCHMARK_MAIN()
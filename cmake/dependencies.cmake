@@ -55,6 +55,7 @@ endfunction()
 
 compile_fbs_to_cpp(account.fbs)
 compile_fbs_to_cpp(asset.fbs)
+compile_fbs_to_cpp(block.fbs)
 compile_fbs_to_cpp(commands.fbs)
 compile_fbs_to_cpp(main.fbs)
 compile_fbs_to_cpp(primitives.fbs)
@@ -172,6 +173,40 @@ endif()
 
 
 
+###########################
+#         zstd            #
+###########################
+#find_package(zstd)
+
+if(NOT zstd_FOUND)
+  ExternalProject_Add(facebook_zstd
+    GIT_REPOSITORY    "https://github.com/facebook/zstd.git"
+    GIT_TAG           "v1.3.0"
+    CONFIGURE_COMMAND ""
+    BUILD_IN_SOURCE   1
+    BUILD_COMMAND     cd lib && $(MAKE) libzstd.a CC="${CMAKE_C_COMPILER}" "CFLAGS=-fPIC -O3"
+    INSTALL_COMMAND   "" # remove install step
+    TEST_COMMAND      "" # remove test step
+    UPDATE_COMMAND    "" # remove update step
+    )
+  ExternalProject_Get_Property(facebook_zstd source_dir)
+  set(zstd_INCLUDE_DIRS ${source_dir}/lib ${source_dir}/lib/dictBuilder)
+  set(zstd_LIBRARIES ${source_dir}/lib/libzstd.a)
+  file(MAKE_DIRECTORY ${source_dir}/lib ${source_dir}/lib/dictBuilder)
+endif()
+
+add_library(zstd STATIC IMPORTED)
+set_target_properties(zstd PROPERTIES
+  INTERFACE_INCLUDE_DIRECTORIES "${zstd_INCLUDE_DIRS}"
+  IMPORTED_LOCATION ${zstd_LIBRARIES}
+  IMPORTED_LINK_INTERFACE_LANGUAGES "C"
+  )
+
+if(NOT zstd_FOUND)
+  add_dependencies(zstd facebook_zstd)
+endif()
+
+
 if(TESTING)
   ##########################
   #         gtest          #
@@ -18,15 +18,28 @@
 #ifndef AMETSUCHI_DB_H
 #define AMETSUCHI_DB_H
 
+#include <ametsuchi/cache.h>
 #include <ametsuchi/currency.h>
+#include <ametsuchi/decoder.h>
+#include <ametsuchi/group_sync.h>
 #include <commands_generated.h>
+#include <main_generated.h>
 #include <ametsuchi/merkle_tree/merkle_tree.h>
+#include <ametsuchi/read_tx_pool.h>
+#include <ametsuchi/snapshot.h>
+#include <ametsuchi/tx_cursor.h>
 #include <ametsuchi/tx_store.h>
+#include <ametsuchi/worker_pool.h>
 #include <ametsuchi/wsv.h>
 #include <flatbuffers/flatbuffers.h>
 #include <lmdb.h>
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <future>
+#include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -44,55 +57,256 @@ extern "C" {
 #define AMETSUCHI_BLOCK_SIZE (1024)  // the number of leafs in merkle tree
 #endif
 
+#ifndef AMETSUCHI_MAX_READERS
+#define AMETSUCHI_MAX_READERS (126)  // reader threads, LMDB default
+#endif
+
+#ifndef AMETSUCHI_SYNC_INTERVAL_MS
+#define AMETSUCHI_SYNC_INTERVAL_MS (100)  // max loss window in async modes
+#endif
+
+#ifndef AMETSUCHI_SYNC_BYTES
+#define AMETSUCHI_SYNC_BYTES (64L * 1024 * 1024)  // 64 MB
+#endif
+
+#ifndef AMETSUCHI_PIPELINE_CHUNK
+#define AMETSUCHI_PIPELINE_CHUNK (256)  // txs decoded by a worker at once
+#endif
+
+#ifndef AMETSUCHI_SEGMENT_BLOCKS
+#define AMETSUCHI_SEGMENT_BLOCKS (1000)  // blocks in a sealed segment file
+#endif
+
+#ifndef AMETSUCHI_BULK_RUN_SIZE
+#define AMETSUCHI_BULK_RUN_SIZE (256L * 1024 * 1024)  // 256 MB
+#endif
+
+#ifndef AMETSUCHI_ATTACHMENT_THRESHOLD
+#define AMETSUCHI_ATTACHMENT_THRESHOLD (64 * 1024)  // 64 KB
+#endif
+
+#ifndef AMETSUCHI_ASSETS_CACHE_SIZE
+#define AMETSUCHI_ASSETS_CACHE_SIZE (8192)  // accounts with cached assets
+#endif
+
 namespace ametsuchi {
 
+/**
+ * How commit() makes data durable.
+ */
+enum class Durability {
+  FULL,          // fsync data and meta page on every commit
+  NO_META_SYNC,  // fsync data on commit, meta page is synced by GroupSync
+  ASYNC          // no fsync on commit (MDB_NOSYNC), everything by GroupSync
+};
+
 
 /**
  * Main class for the database.
  *  - single Ametsuchi instance for the single database
  *  - single writer thread
- *  - multiple readers threads, new read-only transaction for each thread
+ *  - multiple readers threads, pooled read-only transaction for each thread
  *  - all data is stored as root flatbuffers
  */
 class Ametsuchi {
  public:
+  /**
+   * Runtime configuration, validated when database is opened.
+   * Defaults are taken from AMETSUCHI_* macros.
+   */
+  struct Options {
+    // max size of the database, multiple of OS page size
+    size_t map_size = AMETSUCHI_MAX_DB_SIZE;
+    // max number of threads reading at the same time
+    unsigned int max_readers = AMETSUCHI_MAX_READERS;
+    // the number of leafs in merkle tree, same for the same database
+    size_t block_size = AMETSUCHI_BLOCK_SIZE;
+    // txs decoded by a worker at once in batch append
+    size_t pipeline_chunk = AMETSUCHI_PIPELINE_CHUNK;
+    // threads decoding batches, started once. 0 - one per hardware thread
+    size_t pipeline_threads = 0;
+
+    bool fixed_map = true;      // MDB_FIXEDMAP
+    bool no_readahead = false;  // MDB_NORDAHEAD, for databases larger than RAM
+    bool write_map = false;     // MDB_WRITEMAP, requires savepoints = false
+
+    // TxStore::INDEX_* trees, which are not maintained. Queries of disabled
+    // index throw exception::Exception
+    std::vector<TxStore::Tree> disabled_indexes;
+
+    // append() throws exception::InvalidTransaction::TX_EXISTS for
+    // transaction with already stored hash
+    bool reject_duplicates = false;
+
+    // compressed TxStore::TX_STORE and TxStore::BLOCKS trees. Values are
+    // decompressed transparently, so the setting may change between runs
+    std::vector<TxStore::CodecDef> codecs;
+
+    // transactions of blocks older than the latest hot_blocks are moved from
+    // LMDB into sealed segment files in <db_folder>/segments, segment_blocks
+    // blocks per file. 0 - keep all transactions in LMDB
+    size_t hot_blocks = 0;
+    size_t segment_blocks = AMETSUCHI_SEGMENT_BLOCKS;
+
+    // memory for index records in bulk load and rebuild_indexes(), sorted
+    // runs of this size are spilled into <db_folder>/bulk or /rebuild
+    size_t bulk_run_size = AMETSUCHI_BULK_RUN_SIZE;
+
+    // attachment data of this size and more is stored once per content hash
+    // apart from its transaction, see getAttachment(). Queries still return
+    // transactions as appended. 0 - always inline
+    size_t attachment_threshold = AMETSUCHI_ATTACHMENT_THRESHOLD;
+
+    // committed assets of this many recently queried accounts are kept in
+    // memory, every commit invalidates accounts it changed. 0 - no cache
+    size_t assets_cache_size = AMETSUCHI_ASSETS_CACHE_SIZE;
+
+    // per-transaction savepoints (nested transactions). If disabled, an
+    // invalid transaction rolls back the whole uncommitted block
+    bool savepoints = true;
+
+    // see set_durability(), NO_META_SYNC corresponds to MDB_NOMETASYNC
+    Durability durability = Durability::FULL;
+    std::chrono::milliseconds sync_interval =
+        std::chrono::milliseconds(AMETSUCHI_SYNC_INTERVAL_MS);
+    size_t sync_bytes = AMETSUCHI_SYNC_BYTES;
+  };
+
   explicit Ametsuchi(const std::string &db_folder);
+
+  /**
+   * Open database with custom configuration.
+   * @throw exception::Exception if \p options are invalid
+   */
+  Ametsuchi(const std::string &db_folder, const Options &options);
   ~Ametsuchi();
 
   /**
    * Append root flatbuffer Transaction to the Ametsuchi database.
    * @throw exception::InvalidTransaction with the reason (one of enum values)
    * @throw exception::InternalError with the reason (one of enum values)
+   * @throw exception::Exception if indexes are stale, see begin_bulk_load()
    * @param tx root type Transaction (contents of TransactionWrapper->tx array)
    * @return new merkle root
    */
   // TODO make Flatbuffer vector
   merkle::hash_t append(const std::vector<uint8_t> *tx);
+
+  /**
+   * Append batch of transactions. Decoding and validation of transactions is
+   * done by Options::pipeline_threads worker threads, which are reused by
+   * all batches (Options::pipeline_chunk txs per worker), while
+   * the caller thread writes decoded transactions strictly in batch order.
+   * If a transaction is invalid, all transactions before it are appended.
+   * @throw exception::InvalidTransaction with the reason (one of enum values)
+   * @throw exception::InternalError with the reason (one of enum values)
+   * @param batch - root type Transactions
+   * @return new merkle root
+   */
   merkle::hash_t append(const std::vector<std::vector<uint8_t> *> &batch);
 
+  /**
+   * Append all transactions of ConsensusEvent. Nested transactions are read
+   * in place, without copying them out of \p event.
+   * @throw exception::InvalidTransaction with the reason (one of enum values)
+   * @throw exception::InternalError with the reason (one of enum values)
+   * @param event - root type ConsensusEvent
+   * @return new merkle root
+   */
+  merkle::hash_t append(const iroha::ConsensusEvent *event);
+  merkle::hash_t append(
+      const flatbuffers::Vector<flatbuffers::Offset<iroha::TransactionWrapper>>
+          *batch);
+
   /**
    * Commit appended data to database. Commit creates the latest 'checkpoint',
    * when you can not rollback.
+   * @throw exception::InternalError::FATAL if LMDB fails to write or
+   * commit, e.g. the map is full, then appended data is rolled back
    */
   void commit();
 
+  /**
+   * Commit appended data to database without waiting for fsync in
+   * NO_META_SYNC and ASYNC modes.
+   * @return future, which is ready when committed data is durable
+   */
+  std::future<void> commit_async();
+
+  /**
+   * Start bulk load, e.g. initial sync of a new peer. Transactions are
+   * appended and committed as usual, but index records are sorted
+   * externally and written by end_bulk_load() in key order. Key filters are
+   * persisted once at the end too.
+   * Until end_bulk_load() queries of indexes throw exception::Exception.
+   * If the load is interrupted, they throw after restart as well, and so
+   * does append() until the load is resumed by begin_bulk_load() or indexes
+   * are rebuilt by rebuild_indexes(). Appended transactions are committed.
+   */
+  void begin_bulk_load();
+
+  /**
+   * Write indexes and commit.
+   */
+  void end_bulk_load();
+
+  /**
+   * Drop and rebuild all indexes and time trees of getTxByTime() from
+   * committed transactions in parallel, e.g. after an index was enabled or
+   * an interrupted bulk load, or to upgrade them after the format of
+   * indexes changed. Until then queries of indexes and append() throw.
+   * Appended transactions are committed first.
+   * @param threads - threads decoding transactions
+   */
+  void rebuild_indexes(
+      size_t threads = std::max(1u, std::thread::hardware_concurrency()));
+
+  /**
+   * Change durability of commits. Durability::FULL by default.
+   * @param mode - one of Durability
+   * @param sync_interval - max time between background syncs
+   * @param sync_bytes - sync earlier, if this many bytes were committed
+   */
+  void set_durability(Durability mode,
+                      std::chrono::milliseconds sync_interval =
+                          std::chrono::milliseconds(AMETSUCHI_SYNC_INTERVAL_MS),
+                      size_t sync_bytes = AMETSUCHI_SYNC_BYTES);
+
   /**
    * You can rollback appended transaction(s) to previous commit.
+   * A single transaction, which failed in append(), is rolled back
+   * automatically, transactions appended before it are kept.
    */
   void rollback();
 
+  /**
+   * Pin the latest committed state. Queries made through the snapshot see
+   * the same state and their results stay valid while the snapshot lives.
+   * Committed queries of this object in the same thread share the state
+   * too, they bypass the assets cache meanwhile.
+   * @return snapshot, which must be used in the calling thread only, and
+   * destroyed before this object
+   */
+  Snapshot snapshot();
+
   // ********************
   // Ametsuchi queries:
   /**
  * Returns all assets, which belong to user with \p pubKey.
  * @param pubKey - account's public key
  * @param uncommitted - if true, include uncommitted changes to search.
- * Otherwise create new read-only TX
+ * Otherwise use pooled read-only TX of the calling thread
  * @return 0 or * pairs <pointer, size>, which are mmaped into memory.
  */
   std::vector<AM_val> accountGetAllAssets(const flatbuffers::String *pubKey,
                                           bool uncommitted = false);
 
+  /**
+   * accountGetAllAssets(pubKey).size() in O(log N), without reading assets.
+   */
+  size_t accountCountAssets(const flatbuffers::String *pubKey,
+                            bool uncommitted = false);
+
   /**
    * Returns specific asset, which belong to user with \p pubKey.
    * @param pubKey - account's public key
@@ -100,7 +314,7 @@ class Ametsuchi {
    * @param domain_name - domain name
    * @param asset_name - asset (currency) name
    * @param uncommitted - if true, include uncommitted changes to search.
- * Otherwise create new read-only TX
+ * Otherwise use pooled read-only TX of the calling thread
    * @return pair <pointer, size>, which are mmaped from disk
    */
   AM_val accountGetAsset(const flatbuffers::String *pubKey,
@@ -145,24 +359,194 @@ class Ametsuchi {
   std::vector<AM_val> getPeerSetTrustByKey(const flatbuffers::String *pubKey,
                                            bool uncommitted = false);
 
+  /**
+   * Find transaction by hash, O(log N).
+   * @param hash - Transaction.hash
+   * @param uncommitted - if true, include uncommitted changes to search.
+   * @return transaction, or AM_val with data == nullptr if not found
+   */
+  AM_val getTxByHash(const merkle::hash_t &hash, bool uncommitted = false);
+
+  /**
+   * Status of appended transaction, O(log N). Rejected transactions have
+   * FAIL receipt with the reason append() threw.
+   * @param hash - Transaction.hash
+   * @return false if there is no such transaction
+   */
+  bool getReceipt(const merkle::hash_t &hash, TxStore::Receipt &receipt,
+                  bool uncommitted = false);
+
+  /**
+   * Attachment data stored apart from its transaction, O(log N), without
+   * reading the transaction.
+   * @param hash - merkle::MerkleTree::hash() of the data
+   * @return data, or AM_val with data == nullptr if not found
+   */
+  AM_val getAttachment(const merkle::hash_t &hash, bool uncommitted = false);
+
+  /**
+   * Transactions signed in [from, to], by timestamp of the first signature.
+   * O(log N + result), in the order of timestamps. Like index queries, it
+   * throws exception::Exception while indexes are stale.
+   */
+  std::vector<AM_val> getTxByTime(uint64_t from, uint64_t to,
+                                  bool uncommitted = false);
+
+  /**
+   * Transactions of creator \p key signed in [from, to], O(log N + result).
+   * Time is indexed for creators only, not for keys of other indexes.
+   */
+  std::vector<AM_val> getTxByKeyTime(const flatbuffers::String *key,
+                                     uint64_t from, uint64_t to,
+                                     bool uncommitted = false);
+
+  /**
+   * getXByKey for many keys at once, in one read transaction and in key
+   * order, so neighbouring keys share B-tree pages.
+   * @param index - one of TxStore::INDEX_* trees
+   * @param keys - public keys
+   * @return transactions of keys[i] in result[i]
+   */
+  std::vector<std::vector<AM_val>> getTxByKeys(
+      TxStore::Tree index, const std::vector<const flatbuffers::String *> &keys,
+      bool uncommitted = false);
+
+  /**
+   * Size of getXByKey result in O(log N), without reading transactions.
+   * @param index - one of TxStore::INDEX_* trees
+   * @param key - public key
+   */
+  size_t countTxByKey(TxStore::Tree index, const flatbuffers::String *key,
+                      bool uncommitted = false);
+
+  /**
+   * @return true if getXByKey result is not empty, O(log N)
+   */
+  bool hasTxByKey(TxStore::Tree index, const flatbuffers::String *key,
+                  bool uncommitted = false);
+
+  /**
+   * Blocks are numbered from 1, one block per commit() with transactions.
+   * @param height - block height
+   * @return BlockHeader flatbuffer, or AM_val with data == nullptr
+   */
+  AM_val getBlockHeader(uint64_t height);
+
+  /**
+   * @param height - block height
+   * @return transactions of the block in append order
+   */
+  std::vector<AM_val> getBlockTxs(uint64_t height);
+
+  /**
+   * Lazy version of getXByKey queries: transactions are read one by one
+   * while iterating, in constant memory. Committed state only.
+   * @param index - one of TxStore::INDEX_* trees
+   * @param key - public key
+   * @param limit - return at most this many transactions, 0 - no limit
+   * @param offset - skip this many transactions
+   * @param token - TxCursor::token() of the previous page, 0 - first page
+   * @param newest_first - iterate from the latest transaction
+   * @return cursor, which pins read-only TX of the calling thread
+   */
+  TxCursor streamTxByKey(TxStore::Tree index, const flatbuffers::String *key,
+                         size_t limit = 0, size_t offset = 0,
+                         uint64_t token = 0, bool newest_first = false);
+
+  /**
+   * Latest \p n transactions with \p key in \p index, newest first.
+   * O(log N + n), where N is the number of all transactions in \p index.
+   */
+  TxCursor latestTxByKey(TxStore::Tree index, const flatbuffers::String *key,
+                         size_t n);
+
+  /**
+   * Number of sealed segment files, see Options::hot_blocks
+   */
+  size_t segments_total() const { return tx_store.segments_total(); }
+
+  /**
+   * Wait until committed blocks older than Options::hot_blocks are copied
+   * into segments. Copies run in background after commit().
+   */
+  void wait_sealing();
+
  private:
   /* for internal use only */
 
   std::string path_;
+  Options options_;
   MDB_env *env;
   MDB_stat mst;
   MDB_txn *append_tx_;  // pointer to db transaction
+  // nested in append_tx_, all writes of a single transaction go here
+  MDB_txn *savepoint_tx_;
 
   TxStore tx_store;
   WSV wsv;
 
+  // read-only transactions for committed state queries
+  std::unique_ptr<ReadTxPool> read_pool_;
+  // decode batches of append()
+  std::unique_ptr<WorkerPool> workers_;
+
+  // committed assets of account by its public key, nullptr if disabled
+  using Assets = std::vector<std::shared_ptr<const std::vector<uint8_t>>>;
+  std::unique_ptr<Cache<std::string, Assets>> assets_cache_;
+
+  std::shared_ptr<const Assets> cached_assets(
+      const flatbuffers::String *pubKey);
+
+  // syncs commits in NO_META_SYNC and ASYNC modes, nullptr in FULL mode
+  std::unique_ptr<GroupSync> group_sync_;
+  // size of appended, but not committed transactions
+  size_t uncommitted_bytes_;
+  // snapshots, which are not destroyed yet
+  std::atomic<size_t> snapshots_;
+
   uint32_t AMETSUCHI_TREES_TOTAL;
 
 
+  static const Options &validate(const Options &options);
+
   void init();
 
+  /**
+   * Release what init() acquired, if the constructor throws.
+   */
+  void close_env();
+
+  merkle::hash_t apply(const DecodedTx &tx);
+
   void init_append_tx();
   void abort_append_tx();
+
+  /**
+   * Write key filters in a separate transaction at close, errors are logged.
+   */
+  void flush_filters();
+
+  /**
+   * Begin nested transaction and move cursors of tx_store and wsv to it.
+   */
+  void begin_savepoint();
+
+  /**
+   * Finish nested transaction, cursors are closed.
+   * @param keep - if true, merge changes into append_tx_, otherwise undo them
+   */
+  void end_savepoint(bool keep);
+
+  /**
+   * Run \p query on append transaction (rtx == nullptr) if \p uncommitted,
+   * otherwise on pooled read-only transaction.
+   */
+  template <typename Query>
+  auto read(bool uncommitted, Query query) -> decltype(query(nullptr)) {
+    if (uncommitted) return query(nullptr);
+    auto rtx = read_pool_->acquire();
+    return query(&rtx);
+  }
 };
 
 }  // namespace ametsuchi
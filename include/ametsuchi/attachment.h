@@ -0,0 +1,65 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AMETSUCHI_ATTACHMENT_H
+#define AMETSUCHI_ATTACHMENT_H
+
+#include <ametsuchi/common.h>
+#include <ametsuchi/merkle_tree/merkle_tree.h>
+#include <lmdb.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ametsuchi {
+
+/**
+ * Transaction stored without its large attachment data.
+ *  - the stored value is [magic][offset][hash of data] and the original
+ *    transaction with data bytes cut out at offset, the length prefix of the
+ *    vector is kept
+ *  - the data is stored once by its hash in the attachments tree
+ *  - join_attachment() puts the data back, so readers get exactly the bytes
+ *    which were appended, and signatures and hashes still match
+ *  - the magic is greater than any root offset of a flatbuffer and differs
+ *    from the zstd frame magic
+ */
+
+/**
+ * Cut \p data out of transaction \p blob.
+ * @param data - attachment data inside \p blob
+ * @param hash - hash of \p data
+ * @return value to store
+ */
+std::vector<uint8_t> cut_attachment(const uint8_t *blob, size_t size,
+                                    const uint8_t *data, size_t data_size,
+                                    const merkle::hash_t &hash);
+
+/**
+ * @return true if \p val was made by cut_attachment()
+ */
+bool is_cut(const MDB_val &val);
+
+/**
+ * @param val - transaction read from tx_store, decompressed
+ * @param attachments - cursor of the attachments tree
+ * @return val itself if it is not cut, otherwise the original transaction
+ */
+AM_val join_attachment(AM_val val, MDB_cursor *attachments);
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_ATTACHMENT_H
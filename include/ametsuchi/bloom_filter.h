@@ -0,0 +1,80 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AMETSUCHI_BLOOM_FILTER_H
+#define AMETSUCHI_BLOOM_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ametsuchi {
+
+/**
+ * In-memory Bloom filter over byte strings.
+ *  - no false negatives: maybe_contains() is true for every inserted key
+ *  - ~1% false positives for 10 bits per key, until size() > capacity()
+ *  - keys can not be removed
+ *  - maybe_contains() may run in other threads during insert() of the
+ *    writer, it sees all keys inserted before it started
+ */
+class BloomFilter {
+ public:
+  /**
+   * @param capacity - expected number of keys
+   * @param bits_per_key - memory per key, more bits - less false positives
+   */
+  explicit BloomFilter(size_t capacity = 0, size_t bits_per_key = 10);
+
+  void insert(const void *data, size_t size);
+
+  /**
+   * @return false if key was never inserted, true if it probably was
+   */
+  bool maybe_contains(const void *data, size_t size) const;
+
+  /**
+   * Number of inserted keys
+   */
+  size_t size() const { return inserted_; }
+
+  size_t capacity() const { return capacity_; }
+
+  void clear();
+
+  /**
+   * Filter as bytes, to be persisted
+   */
+  std::vector<uint8_t> serialize() const;
+
+  /**
+   * Restore filter from the result of serialize().
+   * @return false if \p data is not a serialized filter
+   */
+  bool deserialize(const void *data, size_t size);
+
+ private:
+  std::vector<std::atomic<uint64_t>> bits_;
+  size_t nbits_;
+  size_t probes_;
+  size_t capacity_;
+  size_t inserted_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_BLOOM_FILTER_H
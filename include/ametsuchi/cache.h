@@ -0,0 +1,181 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AMETSUCHI_CACHE_H
+#define AMETSUCHI_CACHE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef AMETSUCHI_CACHE_SHARDS
+#define AMETSUCHI_CACHE_SHARDS (16)  // independently locked parts of a cache
+#endif
+
+namespace ametsuchi {
+
+/**
+ * Concurrent LRU cache. Keys are spread over shards, each with its own lock
+ * and LRU list, so readers of different keys rarely wait for each other.
+ * Values are immutable and shared, a value returned by get() stays valid
+ * after it is evicted or erased.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class Cache {
+ public:
+  /**
+   * @param capacity - max number of values, split evenly between shards
+   * @param shards - number of shards, at most \p capacity
+   */
+  explicit Cache(size_t capacity, size_t shards = AMETSUCHI_CACHE_SHARDS)
+      : shards_(std::max<size_t>(1, std::min(shards, capacity))) {
+    for (auto &&shard : shards_) {
+      shard.capacity = (capacity + shards_.size() - 1) / shards_.size();
+    }
+  }
+
+  /**
+   * @return cached value, nullptr if there is none
+   */
+  std::shared_ptr<const V> get(const K &key) {
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) return nullptr;
+
+    // the most recently used value is in front
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->second;
+  }
+
+  /**
+   * Put \p value, least recently used value of the shard is evicted.
+   * @return cached value
+   */
+  std::shared_ptr<const V> put(const K &key, V value) {
+    auto shared = std::make_shared<const V>(std::move(value));
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    insert(shard, key, shared);
+    return shared;
+  }
+
+  /**
+   * Put \p value read from the source after version(key) returned
+   * \p version. The value is not cached if erase() could have run since
+   * then, so a value read before its invalidation does not stay cached.
+   * @return \p value, cached or not
+   */
+  std::shared_ptr<const V> put(const K &key, V value, uint64_t version) {
+    auto shared = std::make_shared<const V>(std::move(value));
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.version == version) insert(shard, key, shared);
+    return shared;
+  }
+
+  /**
+   * @return version of \p key, changed by every erase() in its shard
+   */
+  uint64_t version(const K &key) {
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.version;
+  }
+
+  /**
+   * Invalidate \p key, call it after the source is changed.
+   */
+  void erase(const K &key) {
+    auto &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.version++;
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) return;
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+  }
+
+  void clear() {
+    for (auto &&shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.version++;
+      shard.index.clear();
+      shard.lru.clear();
+    }
+  }
+
+  /**
+   * @return number of cached values
+   */
+  size_t size() {
+    size_t total = 0;
+    for (auto &&shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      total += shard.index.size();
+    }
+    return total;
+  }
+
+ private:
+  using Lru = std::list<std::pair<K, std::shared_ptr<const V>>>;
+
+  struct Shard {
+    std::mutex mutex;
+    size_t capacity = 0;
+    uint64_t version = 0;
+    Lru lru;
+    std::unordered_map<K, typename Lru::iterator, Hash> index;
+  };
+
+  std::vector<Shard> shards_;
+  Hash hash_;
+
+  Shard &shard_of(const K &key) { return shards_[hash_(key) % shards_.size()]; }
+
+  static void insert(Shard &shard, const K &key,
+                     std::shared_ptr<const V> value) {
+    if (shard.capacity == 0) return;
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      it->second->second = std::move(value);
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      return;
+    }
+
+    if (shard.index.size() >= shard.capacity) {
+      shard.index.erase(shard.lru.back().first);
+      shard.lru.pop_back();
+    }
+    shard.lru.emplace_front(key, std::move(value));
+    shard.index.emplace(key, shard.lru.begin());
+  }
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_CACHE_H
@@ -0,0 +1,114 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AMETSUCHI_CODEC_H
+#define AMETSUCHI_CODEC_H
+
+#include <ametsuchi/common.h>
+#include <lmdb.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace ametsuchi {
+
+/**
+ * Compression of values of a tree.
+ *  - compressed values are zstd frames, recognized by the frame magic, so
+ *    raw and compressed values can be mixed in one tree
+ *  - a raw value is decoded without copying
+ *  - with a dictionary, trained on the values of the tree, small values
+ *    compress several times better
+ *  - encode() and set_dictionary() are for the writer thread only, decode()
+ *    is thread-safe and keeps reading values of replaced dictionaries
+ */
+class Codec {
+ public:
+  enum Type { NONE, ZSTD };
+
+  /**
+   * @param type - NONE stores values as is
+   * @param level - zstd compression level
+   */
+  explicit Codec(Type type = NONE, int level = 3);
+  Codec(const Codec &) = delete;
+  Codec &operator=(const Codec &) = delete;
+  ~Codec();
+
+  Type type() const { return type_; }
+
+  bool has_dictionary() const { return !dictionary_.empty(); }
+
+  /**
+   * Use \p size bytes of \p data, made by train(), as the dictionary of
+   * further values. Previous dictionaries are kept by their id to decode
+   * values compressed with them.
+   */
+  void set_dictionary(const void *data, size_t size);
+
+  /**
+   * Train a dictionary on sample values.
+   * @param samples - values of the tree, uncompressed
+   * @param max_size - maximum dictionary size
+   * @return dictionary, empty if samples are not enough to train it
+   */
+  static std::vector<uint8_t> train(const std::vector<MDB_val> &samples,
+                                    size_t max_size);
+
+  /**
+   * @param val - value to be written
+   * @return val itself if it is not worth compressing, otherwise compressed
+   * value, valid until the next call of encode()
+   */
+  MDB_val encode(const MDB_val &val);
+
+  /**
+   * @param val - value read from the tree
+   * @return val itself if it is not compressed, otherwise decompressed copy
+   */
+  AM_val decode(const MDB_val &val) const;
+
+  /**
+   * Decode with \p codec, which may be nullptr for raw trees.
+   */
+  static AM_val decode(const Codec *codec, const MDB_val &val) {
+    return codec == nullptr ? AM_val(val) : codec->decode(val);
+  }
+
+  static bool is_compressed(const MDB_val &val);
+
+ private:
+  Type type_;
+  int level_;
+  ZSTD_CCtx_s *cctx_;
+  ZSTD_CDict_s *cdict_;
+  // decompression dictionaries by id, readers load the map atomically and
+  // the writer replaces it as a whole
+  using DDicts = std::map<unsigned, std::shared_ptr<ZSTD_DDict_s>>;
+  std::shared_ptr<const DDicts> ddicts_;
+  std::vector<uint8_t> dictionary_;
+  std::vector<uint8_t> buf_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_CODEC_H
@@ -22,6 +22,9 @@
 #include <ametsuchi/exception.h>
 #include <flatbuffers/flatbuffers.h>
 #include <lmdb.h>
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -55,6 +58,76 @@ inline std::pair<MDB_dbi, MDB_cursor *> init_btree(
   return std::make_pair(dbi, cursor);
 }
 
+/**
+ * Sequence numbers in index trees are stored big-endian, so that memcmp
+ * order of DUPFIXED values is the order of appends.
+ */
+const size_t SEQ_LEN = sizeof(uint64_t);
+
+inline void be64_encode(uint64_t v, uint8_t *out) {
+  for (size_t i = SEQ_LEN; i > 0; i--) {
+    out[i - 1] = static_cast<uint8_t>(v);
+    v >>= 8;
+  }
+}
+
+inline uint64_t be64_decode(const void *in) {
+  auto p = static_cast<const uint8_t *>(in);
+  uint64_t v = 0;
+  for (size_t i = 0; i < SEQ_LEN; i++) v = (v << 8) | p[i];
+  return v;
+}
+
+/**
+ * Handle of an opened btree: dbi and cursor of the append transaction.
+ */
+using tree_handle_t = std::pair<MDB_dbi, MDB_cursor *>;
+
+/**
+ * Declarative definition of a btree.
+ */
+struct TreeDef {
+  const char *name;
+  uint32_t flags;
+  MDB_cmp_func *dupsort;
+};
+
+/**
+ * Open all trees defined in \p defs, tree i is stored in \p trees[i].
+ */
+template <size_t N>
+inline void init_btrees(MDB_txn *append_tx, const TreeDef (&defs)[N],
+                        std::array<tree_handle_t, N> &trees) {
+  for (size_t i = 0; i < N; i++) {
+    trees[i] = init_btree(append_tx, defs[i].name, defs[i].flags,
+                          defs[i].dupsort);
+  }
+}
+
+/**
+ * Open a cursor in \p txn for every tree of \p trees.
+ */
+template <size_t N>
+inline void open_cursors(MDB_txn *txn, std::array<tree_handle_t, N> &trees) {
+  int res;
+  for (auto &&e : trees) {
+    if ((res = mdb_cursor_open(txn, e.first, &e.second)) != 0) {
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+  }
+}
+
+/**
+ * Close every opened cursor of \p trees.
+ */
+template <size_t N>
+inline void close_cursors(std::array<tree_handle_t, N> &trees) {
+  for (auto &&e : trees) {
+    if (e.second != nullptr) mdb_cursor_close(e.second);
+    e.second = nullptr;
+  }
+}
+
 /**
  * Represents a value read from a database.
  * Used to prohibit changes of mmaped data by pointer.
@@ -65,6 +138,12 @@ struct AM_val {
   // size of the pointer
   const size_t size;
   explicit AM_val(const MDB_val &a) : data(a.mv_data), size(a.mv_size) {}
+  // value decoded into memory, e.g. decompressed, which AM_val keeps alive
+  explicit AM_val(std::shared_ptr<const std::vector<uint8_t>> buf)
+      : data(buf->data()), size(buf->size()), buf_(std::move(buf)) {}
+
+ private:
+  std::shared_ptr<const std::vector<uint8_t>> buf_;
 };
 
 
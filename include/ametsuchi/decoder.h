@@ -0,0 +1,59 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AMETSUCHI_DECODER_H
+#define AMETSUCHI_DECODER_H
+
+#include <ametsuchi/merkle_tree/merkle_tree.h>
+#include <transaction_generated.h>
+#include <cstdint>
+
+namespace ametsuchi {
+
+/**
+ * Transaction which passed stateless checks and is ready to be applied by the
+ * writer thread.
+ *  - blob is not copied, it should outlive DecodedTx
+ *  - if valid == false, tx is nullptr and the transaction must be rejected
+ */
+struct DecodedTx {
+  const uint8_t *blob;
+  size_t size;
+  const iroha::Transaction *tx;
+  merkle::hash_t hash;
+  bool valid;
+  // hash of attachment data, which is stored apart from the transaction,
+  // computed by the decoding thread
+  bool attachment_hashed;
+  merkle::hash_t attachment_hash;
+};
+
+/**
+ * Decode and validate root flatbuffer Transaction. Does not touch the
+ * database, so it is safe to call from any thread.
+ * @param blob - pointer to root type Transaction
+ * @param size - size of the \p blob
+ * @param attachment_threshold - attachment data of this many bytes and more
+ * is hashed, 0 - never
+ * @return decoded transaction
+ */
+DecodedTx decode(const uint8_t *blob, size_t size,
+                 size_t attachment_threshold = 0);
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_DECODER_H
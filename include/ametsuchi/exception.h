@@ -74,7 +74,9 @@ enum class InvalidTransaction {
   ACCOUNT_EXISTS,
   ACCOUNT_NOT_FOUND,
   NOT_ENOUGH_ASSETS,
-  WRONG_COMMAND
+  WRONG_COMMAND,
+  WRONG_FORMAT,
+  TX_EXISTS
 };
 
 enum class InternalError { FATAL, NOT_IMPLEMENTED };
@@ -86,6 +88,15 @@ enum class InternalError { FATAL, NOT_IMPLEMENTED };
                       __LINE__, __FILE__);                                \
     throw exception::InternalError::FATAL;                                \
   }
+
+// for calls, whose every error is fatal
+#define AMETSUCHI_CHECK(res)                                              \
+  if (res != 0) {                                                         \
+    console->critical("{}", mdb_strerror(res));                           \
+    console->critical("err in {} at #{} in file {}", __PRETTY_FUNCTION__, \
+                      __LINE__, __FILE__);                                \
+    throw exception::InternalError::FATAL;                                \
+  }
 }
 }
 
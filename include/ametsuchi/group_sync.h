@@ -0,0 +1,72 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AMETSUCHI_GROUP_SYNC_H
+#define AMETSUCHI_GROUP_SYNC_H
+
+#include <lmdb.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ametsuchi {
+
+/**
+ * Background thread, which makes commits done without fsync durable.
+ *  - calls mdb_env_sync once per \p interval, or earlier if more than
+ *    \p bytes were committed since the last sync
+ *  - every commit waiting for the same sync is completed by it (group sync)
+ *  - pending commits are synced on destruction
+ */
+class GroupSync {
+ public:
+  GroupSync(MDB_env *env, std::chrono::milliseconds interval, size_t bytes);
+  ~GroupSync();
+
+  GroupSync(const GroupSync &) = delete;
+  GroupSync &operator=(const GroupSync &) = delete;
+
+  /**
+   * Register committed, but not yet synced transaction.
+   * @param bytes - approximate size of the transaction
+   * @return future, which is ready when transaction is on disk
+   */
+  std::future<void> enqueue(size_t bytes);
+
+ private:
+  void run();
+
+  MDB_env *env_;
+  std::chrono::milliseconds interval_;
+  size_t bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+  size_t pending_bytes_;
+  std::vector<std::promise<void>> pending_;
+
+  std::thread thread_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_GROUP_SYNC_H
@@ -0,0 +1,120 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AMETSUCHI_INDEX_BUILDER_H
+#define AMETSUCHI_INDEX_BUILDER_H
+
+#include <lmdb.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ametsuchi {
+
+/**
+ * External sort of index records [tree][key] => [seq] for bulk writes.
+ * Records are kept in memory until commit(), which spills them into a
+ * sorted run file when they take more than run_size bytes. merge() reads
+ * all runs in (tree, key, seq) order, so trees are written with append
+ * flags instead of random B-tree inserts.
+ * Run file layout, numbers are native: [u32 tree][u32 key size][u64 seq][key]
+ */
+class IndexBuilder {
+ public:
+  /**
+   * @param key - key of the index record
+   * @param seqs - big-endian seqs of \p key in ascending order,
+   * SEQ_LEN bytes each
+   */
+  using Writer = std::function<void(size_t tree, const MDB_val &key,
+                                    std::vector<uint8_t> &seqs)>;
+
+  /**
+   * @param dir - directory of run files, created if missing. Runs left in it
+   * by an interrupted build are removed
+   * @param run_size - bytes of records kept in memory
+   */
+  IndexBuilder(const std::string &dir, size_t run_size);
+  IndexBuilder(const IndexBuilder &) = delete;
+  IndexBuilder &operator=(const IndexBuilder &) = delete;
+  ~IndexBuilder();
+
+  /**
+   * Add record, seqs must not decrease.
+   */
+  void add(size_t tree, const void *key, size_t size, uint64_t seq);
+
+  /**
+   * Drop records with seq greater than \p seq, which were added after the
+   * last commit().
+   */
+  void truncate(uint64_t seq);
+
+  /**
+   * Records added so far are final. Spill them into a run if they take more
+   * than run_size bytes.
+   */
+  void commit();
+
+  /**
+   * Take all records of \p other, e.g. of another thread. Records of
+   * \p other are spilled, its runs are merged and removed by this builder.
+   */
+  void adopt(IndexBuilder &other);
+
+  /**
+   * Spill records kept in memory, then call \p write once per distinct
+   * (tree, key) in ascending order. Run files are removed.
+   */
+  void merge(const Writer &write);
+
+  /**
+   * Number of added records, which were not merged yet
+   */
+  size_t size() const { return total_; }
+
+  /**
+   * Number of spilled run files
+   */
+  size_t runs() const { return runs_.size(); }
+
+ private:
+  struct Record {
+    uint32_t tree;
+    uint32_t size;
+    uint64_t offset;  // of the key in keys_
+    uint64_t seq;
+  };
+
+  void spill();
+  void clear();
+
+  std::string dir_;
+  size_t run_size_;
+  std::vector<Record> records_;
+  std::vector<uint8_t> keys_;
+  // number of records_ at the last commit()
+  size_t committed_;
+  size_t total_;
+  std::vector<std::string> runs_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_INDEX_BUILDER_H
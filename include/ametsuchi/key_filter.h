@@ -0,0 +1,117 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AMETSUCHI_KEY_FILTER_H
+#define AMETSUCHI_KEY_FILTER_H
+
+#include <ametsuchi/bloom_filter.h>
+#include <lmdb.h>
+#include <memory>
+#include <string>
+
+namespace ametsuchi {
+
+/**
+ * Negative-lookup filter of the keys of a tree: a query of a key, which was
+ * never put into the tree, is answered without LMDB.
+ *  - insert() and uncommitted lookups in the writer thread
+ *  - committed lookups from any thread, they share the filter of the writer,
+ *    so uncommitted and rolled back keys are false positives for them
+ *  - persisted into a meta tree with a counter of commits, which inserted
+ *    keys. commit() rewrites it after 1/8 of its keys were inserted since
+ *    the last write, amortized O(1) per key, and flush() writes the rest
+ *    at close. The counter only grows, deletes do not hide inserts from it,
+ *    so after a crash it differs and init() rebuilds the filter
+ */
+class KeyFilter {
+ public:
+  /**
+   * @param name - key of the filter in meta tree
+   */
+  explicit KeyFilter(const std::string &name);
+
+  /**
+   * Load the filter from \p meta, or build it from keys of \p tree if it
+   * was not persisted. Only the first call has effect.
+   */
+  void init(MDB_cursor *tree, MDB_cursor *meta);
+
+  /**
+   * Build the filter from keys of \p tree again, e.g. after the tree was
+   * rewritten. It is persisted by the next commit().
+   */
+  void reload(MDB_cursor *tree);
+
+  void insert(const void *data, size_t size);
+
+  /**
+   * @param uncommitted - include keys of uncommitted writes
+   * @return false if key is surely not in the tree
+   */
+  bool maybe_contains(const void *data, size_t size, bool uncommitted) const;
+
+  /**
+   * Grow the filter if it is full, persist it if enough keys were inserted.
+   * Call it in the append transaction before it is committed.
+   * @param persist - if false, the filter is persisted by a later commit()
+   */
+  void commit(MDB_cursor *tree, MDB_cursor *meta, bool persist = true);
+
+  /**
+   * Forget keys persisted by commit(), call it after the transaction is
+   * committed. If the commit fails, the next commit() writes them again.
+   */
+  void committed();
+
+  /**
+   * Persist the filter if it changed since the last write, e.g. at close.
+   * Call it in a write transaction, which has no uncommitted writes.
+   */
+  void flush(MDB_cursor *meta);
+
+  /**
+   * Remove the persisted filter, so it is rebuilt from the tree by init()
+   * after restart, unless commit() persists it again.
+   */
+  void drop(MDB_cursor *meta);
+
+ private:
+  void rebuild(MDB_cursor *tree, size_t capacity);
+  void write(MDB_cursor *meta, uint64_t inserts);
+
+  std::string name_;
+  // key of inserts_ in meta tree
+  std::string counter_name_;
+  // includes uncommitted keys, replaced with std::atomic_store when it grows
+  std::shared_ptr<BloomFilter> filter_;
+  bool loaded_;
+  // keys inserted since the last write()
+  size_t unsaved_;
+  // the persisted filter is missing or was rebuilt, write it at next commit
+  bool rewrite_;
+  // commits, which inserted keys, the persisted filter is valid if it was
+  // written with the persisted counter
+  uint64_t inserts_;
+  // keys were inserted or the tree was rewritten since the last commit()
+  bool inserted_;
+  // commit() wrote the next counter and the filter, published by committed()
+  bool bumped_;
+  bool written_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_KEY_FILTER_H
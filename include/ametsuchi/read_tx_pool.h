@@ -0,0 +1,118 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AMETSUCHI_READ_TX_POOL_H
+#define AMETSUCHI_READ_TX_POOL_H
+
+#include <lmdb.h>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ametsuchi {
+
+class ReadTxPool;
+
+/**
+ * Handle of a pooled read-only transaction.
+ *  - transaction is reset (not aborted) and cursors are returned to the pool
+ *    when handle is destroyed
+ *  - handle must be used and destroyed in the thread which acquired it
+ */
+class ReadTx {
+ public:
+  ReadTx();
+  ReadTx(ReadTx &&other) noexcept;
+  ReadTx &operator=(ReadTx &&other) noexcept;
+  ReadTx(const ReadTx &) = delete;
+  ReadTx &operator=(const ReadTx &) = delete;
+  ~ReadTx();
+
+  MDB_txn *txn() const;
+
+  /**
+   * Another handle of the same transaction, it is reset only after both
+   * handles are released. Cursors are not shared.
+   */
+  ReadTx share() const;
+
+  /**
+   * Returns cursor for \p dbi, bound to this transaction. Cursor is owned by
+   * the handle, the same cursor is returned for the same \p dbi.
+   */
+  MDB_cursor *cursor(MDB_dbi dbi);
+
+ private:
+  friend class ReadTxPool;
+  struct Slot;
+  explicit ReadTx(Slot *slot);
+  void release();
+
+  Slot *slot_;
+  std::vector<std::pair<MDB_dbi, MDB_cursor *>> cursors_;
+};
+
+/**
+ * Per-thread pool of read-only transactions and cursors.
+ *  - single read-only transaction per thread, recycled with
+ *    mdb_txn_reset/mdb_txn_renew, so reader slot is kept while the thread
+ *    lives, and released when it exits
+ *  - cursors are recycled with mdb_cursor_renew
+ *  - nested acquire() in the same thread shares the same transaction
+ *  - environment must be opened with MDB_NOTLS: reader slots belong to
+ *    transactions, so the destructor aborts transactions of other threads
+ */
+class ReadTxPool {
+ public:
+  explicit ReadTxPool(MDB_env *env);
+  ~ReadTxPool();
+
+  ReadTxPool(const ReadTxPool &) = delete;
+  ReadTxPool &operator=(const ReadTxPool &) = delete;
+
+  /**
+   * Begin (or renew) read-only transaction of the calling thread.
+   * @return handle, which pins the latest committed state
+   */
+  ReadTx acquire();
+
+  /**
+   * @return true if the calling thread holds a handle, so acquire() shares
+   * its transaction, which may be older than the latest commit
+   */
+  bool pinned();
+
+ private:
+  struct Slots;
+  struct ThreadSlots;
+
+  ReadTx::Slot *thread_slot();
+  static void close_slot(ReadTx::Slot &slot);
+
+  MDB_env *env_;
+  uint64_t id_;
+
+  // shared with exit hooks of threads, which outlive the pool
+  std::shared_ptr<Slots> slots_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_READ_TX_POOL_H
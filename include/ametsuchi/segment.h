@@ -0,0 +1,152 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AMETSUCHI_SEGMENT_H
+#define AMETSUCHI_SEGMENT_H
+
+#include <lmdb.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ametsuchi {
+
+// every SEGMENT_INDEX_STEP-th record of a segment is in its sparse index
+static const size_t SEGMENT_INDEX_STEP = 64;
+
+/**
+ * Sealed range of tx_store: values of consecutive seqs [first(), last()]
+ * in a read-only memory mapped file.
+ * File layout, all numbers are native uint64:
+ *  - records: [size][value][padding to 8 bytes], in the order of seqs
+ *  - index: offset of every SEGMENT_INDEX_STEP-th record
+ *  - footer: [first][count][index offset][magic]
+ * A value is found in O(SEGMENT_INDEX_STEP), values are 8-byte aligned.
+ */
+class Segment {
+ public:
+  /**
+   * Map sealed segment file.
+   * @throw exception::Exception if the file is not a sealed segment
+   */
+  explicit Segment(const std::string &path);
+  Segment(const Segment &) = delete;
+  Segment &operator=(const Segment &) = delete;
+  ~Segment();
+
+  uint64_t first() const { return first_; }
+  uint64_t last() const { return first_ + count_ - 1; }
+  const std::string &path() const { return path_; }
+
+  /**
+   * @param seq - key in tx_store
+   * @param val - set to the value in the mapped file
+   * @return false if \p seq is not in the segment
+   */
+  bool get(uint64_t seq, MDB_val &val) const;
+
+ private:
+  std::string path_;
+  const uint8_t *data_;
+  size_t size_;
+  uint64_t first_;
+  uint64_t count_;
+  const uint8_t *index_;
+};
+
+/**
+ * Writes values of consecutive seqs into a temporary file, which is renamed
+ * to the segment path by seal(). So a segment file is complete or absent.
+ */
+class SegmentWriter {
+ public:
+  SegmentWriter(const std::string &path, uint64_t first);
+  SegmentWriter(const SegmentWriter &) = delete;
+  SegmentWriter &operator=(const SegmentWriter &) = delete;
+  ~SegmentWriter();
+
+  /**
+   * Append value of the seq first + number of appended values.
+   */
+  void append(const MDB_val &val);
+
+  /**
+   * Write index and footer, flush the file to disk and rename it. The
+   * directory is flushed too, so the sealed file survives a crash.
+   */
+  void seal();
+
+ private:
+  void write(const void *data, size_t size);
+
+  std::string path_;
+  FILE *file_;
+  uint64_t first_;
+  uint64_t count_;
+  uint64_t offset_;
+  std::vector<uint64_t> index_;
+};
+
+/**
+ * Sealed segments of tx_store in a directory, ordered by seq.
+ * get() is safe to call concurrently with add().
+ */
+class SegmentSet {
+ public:
+  SegmentSet();
+
+  /**
+   * Map segments of \p dir up to \p sealed_seq, remove newer and unsealed
+   * files, which are left by an interrupted commit.
+   */
+  void open(const std::string &dir, uint64_t sealed_seq);
+
+  /**
+   * Path of a new segment, which starts with \p first seq. Creates the
+   * directory of segments and flushes its parent.
+   */
+  std::string path(uint64_t first) const;
+
+  void add(std::shared_ptr<const Segment> segment);
+
+  /**
+   * @return false if \p seq is not in sealed segments
+   */
+  bool get(uint64_t seq, MDB_val &val) const;
+
+  /**
+   * @return the largest sealed seq, 0 if there are no segments
+   */
+  uint64_t last() const { return last_.load(); }
+
+  size_t size() const;
+
+ private:
+  using List = std::vector<std::shared_ptr<const Segment>>;
+
+  std::string dir_;
+  // replaced as a whole by add(), read with std::atomic_load
+  std::shared_ptr<const List> list_;
+  std::atomic<uint64_t> last_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_SEGMENT_H
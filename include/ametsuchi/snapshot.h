@@ -0,0 +1,122 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AMETSUCHI_SNAPSHOT_H
+#define AMETSUCHI_SNAPSHOT_H
+
+#include <ametsuchi/common.h>
+#include <ametsuchi/read_tx_pool.h>
+#include <ametsuchi/tx_cursor.h>
+#include <ametsuchi/tx_store.h>
+#include <ametsuchi/wsv.h>
+#include <flatbuffers/flatbuffers.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace ametsuchi {
+
+/**
+ * Consistent read-only view of committed state.
+ *  - all queries see the same committed state
+ *  - returned AM_val point to mmaped pages and stay valid while the snapshot
+ *    lives, no copies are needed
+ *  - snapshot must be used and destroyed in the thread which created it
+ *  - other committed queries of the same thread share the snapshot while it
+ *    lives
+ *  - snapshot refers to trees and the read pool of its Ametsuchi, so it must
+ *    be destroyed before the Ametsuchi; ~Ametsuchi checks it
+ */
+class Snapshot {
+ public:
+  Snapshot(Snapshot &&) = default;
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+  ~Snapshot() = default;
+
+  std::vector<AM_val> accountGetAllAssets(const flatbuffers::String *pubKey);
+  size_t accountCountAssets(const flatbuffers::String *pubKey);
+
+  AM_val accountGetAsset(const flatbuffers::String *pubKey,
+                         const flatbuffers::String *ledger_name,
+                         const flatbuffers::String *domain_name,
+                         const flatbuffers::String *asset_name);
+
+  std::vector<AM_val> getAssetTransferBySender(
+      const flatbuffers::String *senderKey);
+  std::vector<AM_val> getAssetTransferByReceiver(
+      const flatbuffers::String *receiverKey);
+  std::vector<AM_val> getAssetCreateByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAssetAddByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAssetRemoveByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAssetTransferByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAccountAddByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAccountAddSignByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAccountRemoveByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAccountRemoveSignByKey(
+      const flatbuffers::String *pubKey);
+  std::vector<AM_val> getAccountSetUseKeysByKey(
+      const flatbuffers::String *pubKey);
+  std::vector<AM_val> getPeerAddByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getPeerChangeTrustByKey(
+      const flatbuffers::String *pubKey);
+  std::vector<AM_val> getPeerRemoveByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getPeerSetActiveByKey(const flatbuffers::String *pubKey);
+  std::vector<AM_val> getPeerSetTrustByKey(const flatbuffers::String *pubKey);
+
+  AM_val getTxByHash(const merkle::hash_t &hash);
+  AM_val getAttachment(const merkle::hash_t &hash);
+  bool getReceipt(const merkle::hash_t &hash, TxStore::Receipt &receipt);
+  std::vector<AM_val> getTxByTime(uint64_t from, uint64_t to);
+  std::vector<AM_val> getTxByKeyTime(const flatbuffers::String *key,
+                                     uint64_t from, uint64_t to);
+  std::vector<std::vector<AM_val>> getTxByKeys(
+      TxStore::Tree index,
+      const std::vector<const flatbuffers::String *> &keys);
+  size_t countTxByKey(TxStore::Tree index, const flatbuffers::String *key);
+  bool hasTxByKey(TxStore::Tree index, const flatbuffers::String *key);
+  AM_val getBlockHeader(uint64_t height);
+  std::vector<AM_val> getBlockTxs(uint64_t height);
+
+  /**
+   * Lazy history query, see Ametsuchi::streamTxByKey. The result keeps the
+   * snapshot's transaction alive, and must be destroyed before the
+   * Ametsuchi as well.
+   */
+  TxCursor streamTxByKey(TxStore::Tree index, const flatbuffers::String *key,
+                         size_t limit = 0, size_t offset = 0,
+                         uint64_t token = 0, bool newest_first = false);
+
+ private:
+  friend class Ametsuchi;
+  Snapshot(ReadTx &&rtx, TxStore &tx_store, WSV &wsv,
+           std::atomic<size_t> &live);
+
+  // decrements the number of live snapshots of Ametsuchi
+  struct Release {
+    void operator()(std::atomic<size_t> *live) const { (*live)--; }
+  };
+
+  ReadTx rtx_;
+  TxStore &tx_store_;
+  WSV &wsv_;
+  std::unique_ptr<std::atomic<size_t>, Release> live_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_SNAPSHOT_H
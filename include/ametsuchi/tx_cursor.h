@@ -0,0 +1,129 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AMETSUCHI_TX_CURSOR_H
+#define AMETSUCHI_TX_CURSOR_H
+
+#include <ametsuchi/attachment.h>
+#include <ametsuchi/codec.h>
+#include <ametsuchi/common.h>
+#include <ametsuchi/read_tx_pool.h>
+#include <ametsuchi/segment.h>
+#include <flatbuffers/flatbuffers.h>
+#include <lmdb.h>
+#include <cstdint>
+#include <iterator>
+
+namespace ametsuchi {
+
+/**
+ * Lazy result of a history query: transactions of a single key of an index,
+ * read one by one with a dedicated LMDB cursor.
+ *  - in the order of appends, or newest first
+ *  - constant memory, the first transaction is read in O(log N)
+ *  - returned AM_val stay valid while the TxCursor lives
+ *  - compressed transactions are decompressed on every dereference, large
+ *    attachments are joined, see join_attachment()
+ *  - single pass: begin() continues where the previous iteration stopped
+ *  - must be used and destroyed in the thread which created it
+ */
+class TxCursor {
+ public:
+  /**
+   * Input iterator over transactions. Invalidated when TxCursor is moved.
+   */
+  class iterator : public std::iterator<std::input_iterator_tag, AM_val> {
+   public:
+    explicit iterator(TxCursor *cursor = nullptr) : cursor_(cursor) {}
+
+    AM_val operator*() const {
+      return join_attachment(Codec::decode(cursor_->codec_, cursor_->tx_),
+                             cursor_->rtx_.cursor(cursor_->attachments_));
+    }
+
+    iterator &operator++() {
+      cursor_->next();
+      if (!cursor_->valid_) cursor_ = nullptr;
+      return *this;
+    }
+
+    bool operator==(const iterator &other) const {
+      return cursor_ == other.cursor_;
+    }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+   private:
+    TxCursor *cursor_;
+  };
+
+  /**
+   * @param rtx - read-only transaction, which is pinned while cursor lives
+   * @param index - dbi of the index tree: [key] => [tx seq] (DUP)
+   * @param tx_store - dbi of the tx_store tree: [tx seq] => tx
+   * @param attachments - dbi of the attachments tree: [hash] => data
+   * @param key - key in the index
+   * @param limit - return at most this many transactions, 0 - no limit
+   * @param offset - skip this many transactions
+   * @param token - resume after transaction with this token(), 0 - from the
+   * first transaction
+   * @param newest_first - walk backward from the latest transaction
+   * @param codec - codec of tx_store, nullptr if values are stored as is
+   * @param cold - sealed segments of tx_store, nullptr if there are none
+   */
+  TxCursor(ReadTx &&rtx, MDB_dbi index, MDB_dbi tx_store,
+           MDB_dbi attachments, const flatbuffers::String *key, size_t limit = 0,
+           size_t offset = 0, uint64_t token = 0, bool newest_first = false,
+           const Codec *codec = nullptr, const SegmentSet *cold = nullptr);
+  TxCursor(TxCursor &&other) noexcept;
+  TxCursor(const TxCursor &) = delete;
+  TxCursor &operator=(const TxCursor &) = delete;
+  TxCursor &operator=(TxCursor &&) = delete;
+  ~TxCursor();
+
+  iterator begin() { return iterator(valid_ ? this : nullptr); }
+  iterator end() { return iterator(); }
+
+  /**
+   * Resume token of the last returned transaction. Pass it to the next
+   * query to read the following page.
+   */
+  uint64_t token() const { return token_; }
+
+ private:
+  void next();
+  void load(int res);
+  int seek(uint64_t token);
+
+  ReadTx rtx_;
+  MDB_cursor *index_;
+  MDB_cursor *txs_;
+  MDB_dbi attachments_;
+
+  MDB_val key_;
+  MDB_val seq_;
+  MDB_val tx_;
+  const Codec *codec_;
+  const SegmentSet *cold_;
+
+  MDB_cursor_op step_;  // MDB_NEXT_DUP or MDB_PREV_DUP
+  size_t left_;
+  uint64_t token_;
+  bool valid_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_TX_CURSOR_H
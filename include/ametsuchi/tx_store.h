@@ -20,31 +20,273 @@
 
 #include <flatbuffers/flatbuffers.h>
 #include <lmdb.h>
-#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ametsuchi/bloom_filter.h>
+#include <ametsuchi/codec.h>
+#include <ametsuchi/decoder.h>
+#include <ametsuchi/index_builder.h>
+#include <ametsuchi/key_filter.h>
 #include <ametsuchi/merkle_tree/merkle_tree.h>
+#include <ametsuchi/read_tx_pool.h>
+#include <ametsuchi/segment.h>
+#include <ametsuchi/tx_cursor.h>
+#include <main_generated.h>
+#include <primitives_generated.h>
+#include <transaction_generated.h>
 #include "common.h"
 
 namespace ametsuchi {
 
 class TxStore {
  public:
-  TxStore(size_t merkle_leaves);
+  /**
+   * Trees of tx_store, index in the handle table.
+   */
+  enum Tree : size_t {
+    TX_STORE,
+    MERKLE_TREE,
+    TX_HASH,
+    BLOCKS,
+    META,
+    TX_TIME,
+    CREATOR_TIME,
+    ATTACHMENTS,
+    RECEIPTS,
+    INDEX_ASSET_CREATE,
+    INDEX_ASSET_ADD,
+    INDEX_ASSET_REMOVE,
+    INDEX_ASSET_TRANSFER,
+    INDEX_TRANSFER_SENDER,
+    INDEX_TRANSFER_RECEIVER,
+    INDEX_ACCOUNT_ADD,
+    INDEX_ACCOUNT_ADD_SIGN,
+    INDEX_ACCOUNT_REMOVE,
+    INDEX_ACCOUNT_REMOVE_SIGN,
+    INDEX_ACCOUNT_SET_USE_KEYS,
+    INDEX_PEER_ADD,
+    INDEX_PEER_CHANGE_TRUST,
+    INDEX_PEER_REMOVE,
+    INDEX_PEER_SET_ACTIVE,
+    INDEX_PEER_SET_TRUST,
+    TREES_TOTAL
+  };
+
+  /**
+   * Outcome of append() of a transaction, by its hash.
+   */
+  struct Receipt {
+    iroha::Code code;
+    // why the transaction is rejected, 0 for COMMIT
+    exception::InvalidTransaction reason;
+    // height of the block the transaction was appended to
+    uint64_t height;
+    // position in tx_store, 0 for FAIL
+    uint64_t seq;
+  };
+
+  /**
+   * Secondary index definition: transactions with \p command are put into
+   * \p tree by key(tx). Transaction is not indexed, if key(tx) is nullptr.
+   */
+  struct IndexDef {
+    Tree tree;
+    iroha::Command command;
+    const flatbuffers::String *(*key)(const iroha::Transaction *tx);
+  };
+
+  /**
+   * Compression of values of \p tree, TX_STORE or BLOCKS. When the tree has
+   * \p dict_samples values, a dictionary of at most \p dict_size bytes is
+   * trained on them at commit, and used for all further values. If training
+   * fails, it is retried on twice more values, sampled over the whole tree.
+   * If \p dict_samples or \p dict_size is 0, no dictionary is trained.
+   */
+  struct CodecDef {
+    Tree tree;
+    Codec::Type type;
+    int level;
+    size_t dict_samples;
+    size_t dict_size;
+  };
+
+  /**
+   * @param merkle_leaves - number of leafs in merkle tree
+   * @param disabled - INDEX_* trees, which are not written and not queried
+   * @param reject_duplicates - append() throws TX_EXISTS for a transaction
+   * with already stored hash
+   * @param codecs - compressed trees, values of other trees are stored as is
+   * @param attachment_threshold - attachment data of this many bytes and
+   * more is stored in attachments tree by its hash, 0 - always inline
+   */
+  explicit TxStore(size_t merkle_leaves,
+                   const std::vector<Tree> &disabled = std::vector<Tree>(),
+                   bool reject_duplicates = false,
+                   const std::vector<CodecDef> &codecs =
+                       std::vector<CodecDef>(),
+                   size_t attachment_threshold = 0);
   ~TxStore();
 
+  /**
+   * @return true if \p tree is one of INDEX_* trees
+   */
+  static bool is_index(Tree tree);
+
+  /**
+   * @return name of LMDB database of \p tree, e.g. "index_asset_create"
+   */
+  static const char *name(Tree tree);
+
+  /**
+   * Check of the key filter, O(1) and without LMDB.
+   * @param uncommitted - include uncommitted transactions, writer thread only
+   * @return false if \p index surely has no transactions with \p key
+   */
+  bool maybe_has_key(Tree index, const flatbuffers::String *key,
+                     bool uncommitted) const;
+
+  /**
+   * Write the block header, the merkle tree and key filters. Call it before
+   * the append transaction is committed.
+   */
   void commit();
 
+  /**
+   * Publish in-memory state written by commit(), call it after the append
+   * transaction is committed. If the commit fails, rollback() is called
+   * instead and the state is kept.
+   */
+  void committed();
+
   void init_merkle_tree();
 
+  /**
+   * Fill in-memory filter of stored hashes, O(number of transactions).
+   */
+  void init_hash_filter();
+
   merkle::hash_t merkle_root();
 
-  merkle::hash_t append(const std::vector<uint8_t> *blob);
+  /**
+   * Append decoded transaction to tx_store and indexes.
+   * @param tx - transaction, which passed decode()
+   * @return new merkle root
+   */
+  merkle::hash_t append(const DecodedTx &tx);
   void init(MDB_txn *append_tx);
 
+  /**
+   * Keep transactions of old blocks in sealed segment files. Call it before
+   * the first init().
+   * @param dir - directory of segments
+   * @param hot_blocks - number of the latest blocks kept in tx_store tree,
+   * 0 - transactions are not moved to segments
+   * @param segment_blocks - number of blocks moved into one segment
+   */
+  void set_segments(const std::string &dir, size_t hot_blocks,
+                    size_t segment_blocks);
+
+  /**
+   * Number of sealed segment files
+   */
+  size_t segments_total() const { return cold_.size(); }
+
+  /**
+   * Copy whole segments of committed blocks older than hot ones into segment
+   * files in a background thread, if no copy is running. The next commit()
+   * drops copied ranges from tx_store. Call it after the append transaction
+   * is committed.
+   * @param env - environment, the thread reads in its own read-only
+   * transaction
+   */
+  void start_sealing(MDB_env *env);
+
+  /**
+   * Wait for the background copy started by start_sealing().
+   * @throw its error
+   */
+  void wait_sealing();
+
+  /**
+   * Start bulk load: index records of appended transactions are sorted in
+   * run files of \p dir and written by end_bulk_load(). Key filters are
+   * persisted once at the end as well. Until then indexes are stale, also
+   * after restart, if the load is interrupted. Then the call resumes the
+   * load: records of transactions loaded before are read again.
+   * @param env - environment of the append transaction, transactions of the
+   * interrupted load are read in a read-only transaction
+   * @param run_size - bytes of index records kept in memory
+   * @throw exception::Exception if bulk load is started, or indexes are of
+   * an old format and must be rebuilt
+   */
+  void begin_bulk_load(MDB_env *env, const std::string &dir, size_t run_size);
+
+  /**
+   * Write sorted index records with append flags, indexes are not stale.
+   * Call commit() after it.
+   */
+  void end_bulk_load();
+
+  bool bulk_loading() const { return bulk_ != nullptr; }
+
+  /**
+   * Drop all INDEX_* trees and fill enabled ones from committed transactions,
+   * TX_TIME and CREATOR_TIME too.
+   * Seqs are split between \p threads, which decode transactions and sort
+   * index records into run files of \p dir, then the runs are merged with
+   * append writes. Key filters are rebuilt, indexes of an old format are
+   * upgraded to the current one. Call commit() after it.
+   * @param env - environment of the append transaction, threads read
+   * transactions in their own read-only transactions
+   * @param run_size - bytes of index records kept in memory, all threads
+   * @throw exception::Exception if bulk load is started
+   */
+  void rebuild_indexes(MDB_env *env, const std::string &dir, size_t run_size,
+                       size_t threads);
+
+  /**
+   * @return true if indexes miss transactions, queries of indexes throw
+   */
+  bool stale_indexes() const { return stale_.load(); }
+
+  /**
+   * Persist keys of key filters, which commit() did not write yet. Call it
+   * at close in a write transaction without uncommitted writes.
+   */
+  void flush_filters();
+
   /**
    * Close every cursor used in tx_store
    */
   void close_cursors();
 
+  /**
+   * Open cursors of all trees in \p txn, all further writes go to \p txn.
+   * @param txn - append transaction or its nested (savepoint) transaction
+   */
+  void open_cursors(MDB_txn *txn);
+
+  /**
+   * Remember current state. Called when a savepoint transaction begins.
+   */
+  void savepoint();
+
+  /**
+   * Restore state remembered by savepoint(). O(1), merkle tree is rolled
+   * back on the number of leafs pushed since savepoint().
+   */
+  void rollback_savepoint();
+
+  /**
+   * Restore merkle tree of the latest commit. Call it after init() of the
+   * new append transaction.
+   */
+  void rollback();
+
   /**
  * Close every dbi used in tx_store
  */
@@ -56,80 +298,335 @@ class TxStore {
   uint32_t get_trees_total();
 
   // TxStore queries:
+  // if rtx == nullptr, query includes uncommitted changes (append transaction)
 
   std::vector<AM_val> getAssetTransferBySender(
-      const flatbuffers::String *senderKey, bool uncommitted = true,
-      MDB_env *env = nullptr);
+      const flatbuffers::String *senderKey, ReadTx *rtx = nullptr);
 
   std::vector<AM_val> getAssetTransferByReceiver(
-      const flatbuffers::String *receiverKey, bool uncommitted = true,
-      MDB_env *env = nullptr);
+      const flatbuffers::String *receiverKey, ReadTx *rtx = nullptr);
 
   std::vector<AM_val> getAssetCreateByKey(const flatbuffers::String *pubKey,
-                                          bool uncommitted = true,
-                                          MDB_env *env = nullptr);
+                                          ReadTx *rtx = nullptr);
 
   std::vector<AM_val> getAssetAddByKey(const flatbuffers::String *pubKey,
-                                       bool uncommitted = true,
-                                       MDB_env *env = nullptr);
+                                       ReadTx *rtx = nullptr);
   std::vector<AM_val> getAssetRemoveByKey(const flatbuffers::String *pubKey,
-                                          bool uncommitted = true,
-                                          MDB_env *env = nullptr);
+                                          ReadTx *rtx = nullptr);
   std::vector<AM_val> getAssetTransferByKey(const flatbuffers::String *pubKey,
-                                            bool uncommitted = true,
-                                            MDB_env *env = nullptr);
+                                            ReadTx *rtx = nullptr);
   std::vector<AM_val> getAccountAddByKey(const flatbuffers::String *pubKey,
-                                         bool uncommitted = true,
-                                         MDB_env *env = nullptr);
+                                         ReadTx *rtx = nullptr);
   std::vector<AM_val> getAccountAddSignByKey(const flatbuffers::String *pubKey,
-                                             bool uncommitted = true,
-                                             MDB_env *env = nullptr);
+                                             ReadTx *rtx = nullptr);
   std::vector<AM_val> getAccountRemoveByKey(const flatbuffers::String *pubKey,
-                                            bool uncommitted = true,
-                                            MDB_env *env = nullptr);
+                                            ReadTx *rtx = nullptr);
   std::vector<AM_val> getAccountRemoveSignByKey(
-      const flatbuffers::String *pubKey, bool uncommitted = true,
-      MDB_env *env = nullptr);
+      const flatbuffers::String *pubKey, ReadTx *rtx = nullptr);
   std::vector<AM_val> getAccountSetUseKeysByKey(
-      const flatbuffers::String *pubKey, bool uncommitted = true,
-      MDB_env *env = nullptr);
+      const flatbuffers::String *pubKey, ReadTx *rtx = nullptr);
   std::vector<AM_val> getPeerAddByKey(const flatbuffers::String *pubKey,
-                                      bool uncommitted = true,
-                                      MDB_env *env = nullptr);
+                                      ReadTx *rtx = nullptr);
   std::vector<AM_val> getPeerChangeTrustByKey(const flatbuffers::String *pubKey,
-                                              bool uncommitted = true,
-                                              MDB_env *env = nullptr);
+                                              ReadTx *rtx = nullptr);
   std::vector<AM_val> getPeerRemoveByKey(const flatbuffers::String *pubKey,
-                                         bool uncommitted = true,
-                                         MDB_env *env = nullptr);
+                                         ReadTx *rtx = nullptr);
   std::vector<AM_val> getPeerSetActiveByKey(const flatbuffers::String *pubKey,
-                                            bool uncommitted = true,
-                                            MDB_env *env = nullptr);
+                                            ReadTx *rtx = nullptr);
   std::vector<AM_val> getPeerSetTrustByKey(const flatbuffers::String *pubKey,
-                                           bool uncommitted = true,
-                                           MDB_env *env = nullptr);
+                                           ReadTx *rtx = nullptr);
+
+  /**
+   * Attach peer signatures to the uncommitted block. Signatures of all
+   * consensus events of the block are stored in its header at commit.
+   */
+  void add_block_signatures(
+      const flatbuffers::Vector<flatbuffers::Offset<iroha::Signature>>
+          *signatures);
+
+  /**
+   * @param height - height of committed block, starting from 1
+   * @return BlockHeader flatbuffer, or AM_val with data == nullptr
+   */
+  AM_val getBlockHeader(uint64_t height, ReadTx *rtx = nullptr);
+
+  /**
+   * @param height - height of committed block, starting from 1
+   * @return transactions of the block in order, empty if there is no block
+   */
+  std::vector<AM_val> getBlockTxs(uint64_t height, ReadTx *rtx = nullptr);
+
+  /**
+   * getXByKey for many keys in a single pass over \p index: keys are visited
+   * in tree order with the same cursor.
+   * @return transactions of keys[i] in result[i]
+   */
+  std::vector<std::vector<AM_val>> getTxByKeys(
+      Tree index, const std::vector<const flatbuffers::String *> &keys,
+      ReadTx *rtx = nullptr);
+
+  /**
+   * Number of transactions with \p key in \p index, O(log N), transactions
+   * are not read.
+   */
+  size_t countTxByKey(Tree index, const flatbuffers::String *key,
+                      ReadTx *rtx = nullptr);
+
+  /**
+   * @return true if \p index has a transaction with \p key, O(log N)
+   */
+  bool hasTxByKey(Tree index, const flatbuffers::String *key,
+                  ReadTx *rtx = nullptr);
+
+  /**
+   * Find transaction by its hash.
+   * @return transaction, or AM_val with data == nullptr if not found
+   */
+  AM_val getTxByHash(const merkle::hash_t &hash, ReadTx *rtx = nullptr);
+
+  /**
+   * Record FAIL receipt of a transaction, for which append() threw. COMMIT
+   * receipt of the same hash is kept.
+   */
+  void reject(const merkle::hash_t &hash,
+              exception::InvalidTransaction reason);
+
+  /**
+   * Status of transaction by its hash, O(log N).
+   * @return false if the transaction was neither stored nor rejected
+   */
+  bool getReceipt(const merkle::hash_t &hash, Receipt &receipt,
+                  ReadTx *rtx = nullptr);
+
+  /**
+   * Attachment data stored out of line.
+   * @param hash - merkle::MerkleTree::hash() of the data
+   * @return data, or AM_val with data == nullptr if not found
+   */
+  AM_val getAttachment(const merkle::hash_t &hash, ReadTx *rtx = nullptr);
+
+  /**
+   * Transactions with timestamp of the first signature in [from, to], in
+   * the order of timestamps. O(log N + result).
+   * @throw exception::Exception if indexes are stale
+   */
+  std::vector<AM_val> getTxByTime(uint64_t from, uint64_t to,
+                                  ReadTx *rtx = nullptr);
+
+  /**
+   * Transactions of creator \p key with timestamp in [from, to], in the
+   * order of timestamps. O(log N + result). Only creator is indexed by time,
+   * keys of INDEX_* trees are not.
+   * @throw exception::Exception if indexes are stale
+   */
+  std::vector<AM_val> getTxByKeyTime(const flatbuffers::String *key,
+                                     uint64_t from, uint64_t to,
+                                     ReadTx *rtx = nullptr);
+
+  /**
+   * Lazy version of getXByKey queries, committed state only.
+   * @param index - one of INDEX_* trees
+   * @param key - key in \p index
+   * @param rtx - read-only transaction, pinned by the result
+   * @param limit - return at most this many transactions, 0 - no limit
+   * @param offset - skip this many transactions
+   * @param token - TxCursor::token() of the previous page, 0 - first page
+   * @param newest_first - iterate from the latest transaction
+   */
+  TxCursor streamTxByKey(Tree index, const flatbuffers::String *key,
+                         ReadTx &&rtx, size_t limit = 0, size_t offset = 0,
+                         uint64_t token = 0, bool newest_first = false);
 
  private:
   size_t tx_store_total;
-  std::unordered_map<std::string, std::pair<MDB_dbi, MDB_cursor *>> trees_;
+  std::array<tree_handle_t, TREES_TOTAL> trees_;
+
+  static const size_t COMMANDS_TOTAL =
+      static_cast<size_t>(iroha::Command::MAX) + 1;
+  // command type => enabled indexes of the command
+  std::array<std::vector<const IndexDef *>, COMMANDS_TOTAL> indexes_;
+  // command type => command has at least one index definition
+  std::array<bool, COMMANDS_TOTAL> known_;
+  std::array<bool, TREES_TOTAL> enabled_;
+  // negative-lookup filters of enabled indexes, nullptr for other trees
+  std::array<std::unique_ptr<KeyFilter>, TREES_TOTAL> key_filters_;
 
   merkle::MerkleTree merkleTree_;
+  size_t merkle_leaves_;
+
+  // state at the beginning of the current savepoint
+  size_t savepoint_total_;
+  size_t savepoint_pushes_;
+
+  bool reject_duplicates_;
+  // hashes of stored transactions, checked before tx_hash tree
+  BloomFilter hash_filter_;
+
+  bool has_hash(const merkle::hash_t &hash);
+  void put_hash(const merkle::hash_t &hash);
+  void rebuild_hash_filter(size_t capacity);
+  void put_receipt(const merkle::hash_t &hash, const Receipt &receipt);
+
+  // uncommitted block: height, first seq and signatures of peers
+  struct PeerSignature {
+    std::string public_key;
+    std::vector<uint8_t> signature;
+    uint64_t timestamp;
+  };
+  size_t block_height_;
+  size_t block_begin_;
+  std::vector<PeerSignature> block_signatures_;
+
+  void set_block_height();
+  void write_block_header();
+
+  // transactions of blocks 1..cold_height_ are in sealed segments only,
+  // of blocks ..sealed_height_ also in tx_store until drop_sealed()
+  SegmentSet cold_;
+  std::string segments_dir_;
+  size_t hot_blocks_;
+  size_t segment_blocks_;
+  size_t cold_height_;
+  size_t sealed_height_;
+  // cold_height_ written by drop_sealed(), published by committed()
+  size_t dropped_height_;
+  bool cold_loaded_;
+  // copy of blocks (sealed_height_, result] into segments
+  std::future<size_t> sealing_;
+
+  void load_segments();
+  void poll_sealing(bool wait);
+  void drop_sealed();
+
+  /**
+   * Write segments of blocks (\p from, \p to] read in a read-only transaction
+   * of \p env, they are added to cold_.
+   * @return \p to
+   */
+  size_t seal(MDB_env *env, size_t from, size_t to);
+  void put_meta(const std::string &name, const MDB_val &val);
+  void del_meta(const std::string &name);
+
+  // not nullptr during bulk load
+  std::unique_ptr<IndexBuilder> bulk_;
+  // set by an unfinished bulk load, read by query threads
+  std::atomic<bool> stale_;
+  // filters miss keys of a resumed bulk load until end_bulk_load()
+  bool reload_filters_;
+
+  /**
+   * Version of the layout of keys and values, kept in meta. Bump it with
+   * any change of the layout: versions from MIN_FORMAT_VERSION differ only
+   * in trees written by rebuild_indexes(), so such a database is opened with
+   * stale indexes until they are rebuilt; others are refused.
+   */
+  static const uint32_t FORMAT_VERSION = 1;
+  static const uint32_t MIN_FORMAT_VERSION = 1;
+  uint32_t format_;
+
+  /**
+   * Read the format version or write it to a new database.
+   * @throw exception::Exception if the format is not supported
+   */
+  void load_format();
+  void load_stale();
+  void write_merkle_tree();
+
+  /**
+   * Merge records of \p builder into index trees. Keys greater than the
+   * last key of a tree are appended, seqs of a key are put at once.
+   */
+  void write_indexes(IndexBuilder &builder);
+
+  /**
+   * Add index and time records of committed transactions [begin, end] to
+   * \p builder.
+   */
+  void extract_keys(MDB_env *env, IndexBuilder &builder, size_t begin,
+                    size_t end) const;
+
+  /**
+   * Read transaction \p seq from a segment, or by \p cursor of tx_store.
+   */
+  int get_tx(MDB_cursor *cursor, size_t seq, MDB_val &val) const;
+
+  // compression of TX_STORE and BLOCKS, nullptr for other trees
+  std::array<std::unique_ptr<Codec>, TREES_TOTAL> codecs_;
+  std::vector<CodecDef> codec_defs_;
+  // number of values in the tree, when dictionary is (re)tried to train
+  std::array<size_t, TREES_TOTAL> train_at_;
+  // dictionaries written by train_dictionaries(), used after committed()
+  std::array<std::vector<uint8_t>, TREES_TOTAL> trained_;
+
+  MDB_val encode(Tree tree, const MDB_val &val);
+  AM_val decode(Tree tree, const MDB_val &val) const;
+  void load_dictionaries();
+  void train_dictionaries();
 
   MDB_txn *append_tx_;
   void set_tx_total();
-  uint32_t TX_STORE_TREES_TOTAL;
+
+  /**
+   * Put \p seq of \p tx into TX_TIME and CREATOR_TIME trees. They are
+   * written like indexes: by bulk load and rebuild_indexes() too.
+   */
+  void put_time(const iroha::Transaction *tx, size_t seq);
+
+  /**
+   * Put \p seq, the largest one of the key, into DUP tree of \p cursor.
+   */
+  void put_seq(MDB_cursor *cursor, const void *key, size_t size, size_t seq);
+
+  size_t attachment_threshold_;
+
+  /**
+   * Move attachment data of \p decoded into attachments tree, if it is
+   * large, see cut_attachment().
+   * @param cut - set to the value to store instead of the transaction
+   * @return false if the transaction is stored as is
+   */
+  bool split_attachment(const DecodedTx &decoded, std::vector<uint8_t> &cut);
+
+  /**
+   * Cursor of attachments tree in \p rtx, or of the append transaction.
+   */
+  MDB_cursor *attachments(ReadTx *rtx);
+
+  /**
+   * Transaction as appended from value \p val of tx_store or a segment.
+   */
+  AM_val read_tx(const MDB_val &val, MDB_cursor *attachments) const;
   void put_tx_into_tree_by_key(MDB_cursor *cursor,
                                const flatbuffers::String *acc_pub_key,
                                size_t &tx_store_total);
 
-  void create_new_tree(MDB_txn *append_tx, const std::string &name,
-                       uint32_t flags, MDB_cmp_func *dupsort = nullptr);
 
+  /**
+   * @throw exception::Exception if \p tree is not an enabled index, or
+   * indexes are stale
+   */
+  void check_index(Tree tree);
+
+  std::vector<AM_val> getTxByKey(Tree tree, const flatbuffers::String *pubKey,
+                                 ReadTx *rtx = nullptr);
+
+  /**
+   * Position cursor of \p tree at the first value of \p key.
+   * @return cursor, or nullptr if there is no \p key
+   */
+  MDB_cursor *seek_key(Tree tree, const flatbuffers::String *key,
+                       ReadTx *rtx);
 
-  std::vector<AM_val> getTxByKey(const std::string &tree_name,
-                                 const flatbuffers::String *pubKey,
-                                 bool uncommitted = true,
-                                 MDB_env *env = nullptr);
+  /**
+   * Append transactions of \p key to \p ret.
+   * @param cursor - cursor of an index tree
+   * @param tx_cursor - cursor of tx_store in the same transaction
+   * @param attachments - cursor of attachments in the same transaction
+   */
+  void read_key_txs(MDB_cursor *cursor, MDB_cursor *tx_cursor,
+                    MDB_cursor *attachments,
+                    const flatbuffers::String *key,
+                    std::vector<AM_val> &ret) const;
 };
 }
 
@@ -0,0 +1,79 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AMETSUCHI_WORKER_POOL_H
+#define AMETSUCHI_WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ametsuchi {
+
+/**
+ * Fixed set of threads, which run submitted tasks in FIFO order.
+ *  - threads are started once and reused by every submit()
+ *  - a task must not wait for another task of the same pool
+ *  - queued tasks are run before destruction completes
+ */
+class WorkerPool {
+ public:
+  /**
+   * @param threads - number of threads, at least 1
+   */
+  explicit WorkerPool(size_t threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  size_t size() const { return threads_.size(); }
+
+  /**
+   * Run \p task in a pool thread.
+   * @return future with the result or exception of the task
+   */
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(F task) {
+    using R = typename std::result_of<F()>::type;
+    // std::function needs a copyable callable
+    auto packaged = std::make_shared<std::packaged_task<R()>>(std::move(task));
+    auto ret = packaged->get_future();
+    push([packaged]() { (*packaged)(); });
+    return ret;
+  }
+
+ private:
+  void push(std::function<void()> task);
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_;
+  std::deque<std::function<void()>> tasks_;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace ametsuchi
+
+#endif  // AMETSUCHI_WORKER_POOL_H
@@ -19,9 +19,14 @@
 
 
 #include <ametsuchi/common.h>
+#include <ametsuchi/key_filter.h>
+#include <ametsuchi/read_tx_pool.h>
 #include <commands_generated.h>
+#include <transaction_generated.h>
 #include <flatbuffers/flatbuffers.h>
 #include <lmdb.h>
+#include <array>
+#include <map>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -31,51 +36,160 @@ namespace ametsuchi {
 
 class WSV {
  public:
+  /**
+   * Trees of wsv, index in the handle table.
+   */
+  enum Tree : size_t {
+    PUBKEY_ASSETS,
+    PUBKEY_ACCOUNT,
+    ASSETID_ASSET,
+    IP_PEER,
+    META,
+    TREES_TOTAL
+  };
+
   WSV();
   ~WSV();
 
-  void update(const std::vector<uint8_t> *blob);
+  void update(const iroha::Transaction *tx);
 
   void init(MDB_txn *append_tx);
 
+  /**
+   * Write balances changed in the block and persist the key filter of
+   * accounts with assets. Call it before the append transaction is committed.
+   * @param persist - if false, the filter is persisted by a later commit()
+   */
+  void commit(bool persist = true);
+
+  /**
+   * Publish in-memory state written by commit(), call it after the append
+   * transaction is committed.
+   */
+  void committed();
+
+  /**
+   * Public keys of accounts, whose assets are changed by the block. Valid
+   * after commit() until the next append transaction begins.
+   */
+  const std::vector<std::string> &touched_accounts() const {
+    return touched_accounts_;
+  }
+
+  /**
+   * Remove the persisted key filter, it is rebuilt from the tree after
+   * restart unless commit() persists it again.
+   */
+  void drop_filter();
+
+  /**
+   * Persist the key filter, if commit() did not write all its keys. Call it
+   * at close in a write transaction without uncommitted writes.
+   */
+  void flush_filter();
+
   /**
    * Close every cursor used in wsv
    */
   void close_cursors();
 
+  /**
+   * Open cursors of all trees in \p txn, all further writes go to \p txn.
+   * @param txn - append transaction or its nested (savepoint) transaction
+   */
+  void open_cursors(MDB_txn *txn);
+
+  /**
+   * Remember current state. Called when a savepoint transaction begins,
+   * or after each transaction if savepoints are disabled.
+   */
+  void savepoint();
+
+  /**
+   * Forget assets created and balances changed since savepoint().
+   */
+  void rollback_savepoint();
+
   /**
   * Close every dbi used in wsv
   */
   void close_dbi(MDB_env *env);
 
 
+  /**
+   * Check of the key filter, O(1) and without LMDB.
+   * @param uncommitted - include uncommitted changes, writer thread only
+   * @return false if account \p pubKey surely has no assets
+   */
+  bool maybe_has_assets(const flatbuffers::String *pubKey,
+                        bool uncommitted) const;
+
   // WSV queries:
+  // if rtx == nullptr, query includes uncommitted changes (append transaction)
   AM_val accountGetAsset(const flatbuffers::String *pubKey,
                          const flatbuffers::String *ledger_name,
                          const flatbuffers::String *domain_name,
                          const flatbuffers::String *asset_name,
-                         bool uncommitted = false, MDB_env *env = nullptr);
+                         ReadTx *rtx = nullptr);
 
 
   std::vector<AM_val> accountGetAllAssets(const flatbuffers::String *pubKey,
-                                          bool uncommitted = true,
-                                          MDB_env *env = nullptr);
+                                          ReadTx *rtx = nullptr);
+
+  /**
+   * Number of assets of account \p pubKey, O(log N), assets are not read.
+   */
+  size_t accountCountAssets(const flatbuffers::String *pubKey,
+                            ReadTx *rtx = nullptr);
   /*
    * Get total number of trees
    */
   uint32_t get_trees_total();
 
  private:
-  std::unordered_map<std::string, std::pair<MDB_dbi, MDB_cursor *>> trees_;
+  std::array<tree_handle_t, TREES_TOTAL> trees_;
   MDB_txn *append_tx_;
 
-  uint32_t wsv_trees_total;
+  // public keys of accounts with assets, negative lookups skip LMDB
+  KeyFilter assets_filter_;
 
   // [ledger+domain+asset] => ComplexAsset/Currency flatbuffer (without amount)
   std::unordered_map<std::string, std::vector<uint8_t>> created_assets_;
+  // keys of created_assets_ inserted since savepoint()
+  std::vector<std::string> savepoint_assets_;
 
   void read_created_assets();
 
+  // [pubkey, ledger+domain+asset], the order of pubkey_assets tree
+  using BalanceKey = std::pair<std::string, std::string>;
+
+  // balance of account in the uncommitted block
+  struct Balance {
+    // Asset flatbuffer with the current amount
+    std::vector<uint8_t> asset;
+    // the asset is in pubkey_assets tree, flush() replaces it
+    bool stored;
+  };
+
+  // state of a balance before a change since savepoint()
+  struct BalanceUndo {
+    BalanceKey key;
+    bool existed;
+    Balance balance;
+  };
+
+  // every transfer changes memory only, each balance is written once by
+  // flush() at commit. Uncommitted reads see these balances
+  std::map<BalanceKey, Balance> balances_;
+  std::vector<BalanceUndo> balances_undo_;
+
+  std::vector<std::string> touched_accounts_;
+
+  void log_balance(const BalanceKey &key);
+  // balance of the block, or the stored one, may throw ASSET_NOT_FOUND
+  Balance &load_balance(const BalanceKey &key);
+  void flush_balances();
+
   // WSV commands:
   void asset_create(const iroha::AssetCreate *command);
   void asset_add(const iroha::AssetAdd *command);
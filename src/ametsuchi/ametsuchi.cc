@@ -17,24 +17,158 @@
 
 #include <ametsuchi/ametsuchi.h>
 #include <transaction_generated.h>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <thread>
+
+#include <unistd.h>
 
 // static auto console = spdlog::stdout_color_mt("ametsuchi");
 
 
 namespace ametsuchi {
 
+/**
+ * Two-stage pipeline: threads of \p pool decode chunks of \p n transactions
+ * ahead of the caller thread, which applies them strictly in order.
+ * @param pool - decoding threads, shared by all batches
+ * @param n - number of transactions
+ * @param chunk - number of transactions decoded by a worker at once
+ * @param decode_at - DecodedTx(size_t i), called from worker threads
+ * @param apply - void(const DecodedTx &), called from the caller thread
+ */
+template <typename Decode, typename Apply>
+static void pipeline(WorkerPool &pool, size_t n, size_t chunk,
+                     Decode decode_at, Apply apply) {
+  // not worth to hand over to other threads
+  if (n <= chunk) {
+    for (size_t i = 0; i < n; i++) apply(decode_at(i));
+    return;
+  }
+
+  std::deque<std::future<std::vector<DecodedTx>>> stages;
+  size_t next = 0;
+
+  auto launch = [&pool, &stages, &next, &decode_at, n, chunk]() {
+    size_t begin = next;
+    size_t end = std::min(n, begin + chunk);
+    next = end;
+    stages.push_back(pool.submit([begin, end, &decode_at]() {
+      std::vector<DecodedTx> decoded;
+      decoded.reserve(end - begin);
+      for (size_t i = begin; i < end; i++) decoded.push_back(decode_at(i));
+      return decoded;
+    }));
+  };
+
+  try {
+    while (next < n && stages.size() < pool.size()) launch();
+
+    while (!stages.empty()) {
+      auto decoded = stages.front().get();
+      stages.pop_front();
+
+      // keep workers busy while this chunk is written
+      if (next < n) launch();
+
+      for (auto &tx : decoded) apply(tx);
+    }
+  } catch (...) {
+    // queued stages refer to decode_at and the batch of the caller
+    for (auto &&stage : stages) stage.wait();
+    throw;
+  }
+}
+
 
 Ametsuchi::Ametsuchi(const std::string &db_folder)
-    : path_(db_folder), tx_store(AMETSUCHI_BLOCK_SIZE), wsv() {
+    : Ametsuchi(db_folder, Options()) {}
+
+
+Ametsuchi::Ametsuchi(const std::string &db_folder, const Options &options)
+    : path_(db_folder),
+      options_(validate(options)),
+      env(nullptr),
+      append_tx_(nullptr),
+      savepoint_tx_(nullptr),
+      tx_store(options_.block_size, options_.disabled_indexes,
+               options_.reject_duplicates, options_.codecs,
+               options_.attachment_threshold),
+      wsv(),
+      uncommitted_bytes_(0),
+      snapshots_(0) {
   // initialize database:
   // create folder, create all handles and btrees
   // in case of any errors print error to stdout and exit
-  init();
+  try {
+    init();
+
+    if (options_.durability != Durability::FULL) {
+      set_durability(options_.durability, options_.sync_interval,
+                     options_.sync_bytes);
+    }
+  } catch (...) {
+    // the destructor is not called, if the constructor throws
+    close_env();
+    throw;
+  }
+}
+
+
+const Ametsuchi::Options &Ametsuchi::validate(const Options &options) {
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  if (options.map_size == 0 || options.map_size % page != 0) {
+    throw exception::Exception("map_size must be a multiple of page size");
+  }
+  if (options.max_readers == 0) {
+    throw exception::Exception("max_readers must be positive");
+  }
+  if (options.block_size == 0) {
+    throw exception::Exception("block_size must be positive");
+  }
+  if (options.pipeline_chunk == 0) {
+    throw exception::Exception("pipeline_chunk must be positive");
+  }
+  if (options.segment_blocks == 0) {
+    throw exception::Exception("segment_blocks must be positive");
+  }
+  if (options.bulk_run_size == 0) {
+    throw exception::Exception("bulk_run_size must be positive");
+  }
+  // LMDB does not support nested transactions with MDB_WRITEMAP
+  if (options.write_map && options.savepoints) {
+    throw exception::Exception("write_map requires savepoints to be disabled");
+  }
+  if (options.durability != Durability::FULL &&
+      options.sync_interval.count() <= 0) {
+    throw exception::Exception("sync_interval must be positive");
+  }
+  return options;
 }
 
 
 Ametsuchi::~Ametsuchi() {
+  // their transactions and trees are freed below
+  if (snapshots_.load() != 0) {
+    console->critical("{} snapshots outlive the database", snapshots_.load());
+    assert(snapshots_.load() == 0);
+  }
+  try {
+    tx_store.wait_sealing();
+  } catch (const std::exception &e) {
+    console->error("sealing of segments failed: {}", e.what());
+  } catch (...) {
+    console->error("sealing of segments failed");
+  }
   abort_append_tx();
+  flush_filters();
+  read_pool_.reset();
+  // sync pending commits
+  group_sync_.reset();
 
   tx_store.close_dbi(env);
   wsv.close_dbi(env);
@@ -43,52 +177,318 @@ Ametsuchi::~Ametsuchi() {
 
 
 merkle::hash_t Ametsuchi::append(const std::vector<uint8_t> *blob) {
+  return apply(
+      decode(blob->data(), blob->size(), options_.attachment_threshold));
+}
 
-  // 1. Append to TX_store
-  auto mt_root = tx_store.append(blob);
-  // 2. Update WSV
-  wsv.update(blob);
+merkle::hash_t Ametsuchi::append(
+    const std::vector<std::vector<uint8_t> *> &batch) {
+  auto threshold = options_.attachment_threshold;
+  pipeline(*workers_, batch.size(), options_.pipeline_chunk,
+           [&batch, threshold](size_t i) {
+             return decode(batch[i]->data(), batch[i]->size(), threshold);
+           },
+           [this](const DecodedTx &tx) { apply(tx); });
 
-  return mt_root;
+  return tx_store.merkle_root();
+}
+
+
+merkle::hash_t Ametsuchi::append(const iroha::ConsensusEvent *event) {
+  auto root = append(event->transactions());
+  tx_store.add_block_signatures(event->peerSignatures());
+  return root;
 }
 
+
 merkle::hash_t Ametsuchi::append(
-    const std::vector<std::vector<uint8_t> *> &batch) {
-  for (auto t : batch) {
-    append(t);
-  }
+    const flatbuffers::Vector<flatbuffers::Offset<iroha::TransactionWrapper>>
+        *batch) {
+  if (batch == nullptr) return tx_store.merkle_root();
+
+  auto threshold = options_.attachment_threshold;
+  pipeline(*workers_, batch->size(), options_.pipeline_chunk,
+           [batch, threshold](size_t i) {
+             auto tx = batch->Get(i)->tx();
+             return tx == nullptr
+                        ? decode(nullptr, 0)
+                        : decode(tx->Data(), tx->size(), threshold);
+           },
+           [this](const DecodedTx &tx) { apply(tx); });
 
   return tx_store.merkle_root();
 }
 
 
+merkle::hash_t Ametsuchi::apply(const DecodedTx &tx) {
+  if (!tx.valid) throw exception::InvalidTransaction::WRONG_FORMAT;
+  // indexes would miss the transaction
+  if (tx_store.stale_indexes() && !tx_store.bulk_loading()) {
+    throw exception::Exception("indexes are stale");
+  }
+
+  auto undo = [this]() {
+    if (savepoint_tx_) {
+      // undo this transaction only, O(tx size)
+      end_savepoint(false);
+      begin_savepoint();
+    } else {
+      // no savepoints, the whole block is undone
+      rollback();
+    }
+  };
+
+  merkle::hash_t mt_root;
+  try {
+    // 1. Append to TX_store
+    mt_root = tx_store.append(tx);
+    // 2. Update WSV
+    wsv.update(tx.tx);
+  } catch (exception::InvalidTransaction reason) {
+    undo();
+    // committed with the block, like receipts of stored transactions
+    tx_store.reject(tx.hash, reason);
+    if (savepoint_tx_) {
+      end_savepoint(true);
+      begin_savepoint();
+    }
+    throw;
+  } catch (...) {
+    undo();
+    throw;
+  }
+
+  if (savepoint_tx_) {
+    end_savepoint(true);
+    begin_savepoint();
+  } else {
+    // the whole block is undone by rollback(), drop the undo log of the tx
+    wsv.savepoint();
+  }
+
+  uncommitted_bytes_ += tx.size;
+
+  return mt_root;
+}
+
+
 void Ametsuchi::commit() {
-  // commit merkle tree
-  tx_store.commit();
-  // commit old transaction
+  try {
+    // commit merkle tree
+    tx_store.commit();
+    wsv.commit(!tx_store.bulk_loading());
+    // commit old transaction
+    if (savepoint_tx_) end_savepoint(true);
+  } catch (...) {
+    // e.g. MDB_MAP_FULL, appended data is lost
+    rollback();
+    throw;
+  }
   tx_store.close_cursors();
   wsv.close_cursors();
-  mdb_txn_commit(append_tx_);
+  // the transaction is freed even if commit fails
+  int res = mdb_txn_commit(append_tx_);
+  append_tx_ = nullptr;
+  if (res) {
+    // appended data is lost, continue from the last commit
+    rollback();
+    AMETSUCHI_CHECK(res);
+  }
+  // in-memory state, which is valid only if the commit succeeds
+  tx_store.committed();
+  wsv.committed();
   mdb_env_stat(env, &mst);
+  uncommitted_bytes_ = 0;
+  // old blocks are copied into segments without blocking appends
+  tx_store.start_sealing(env);
+
+  // readers see the commit, cached assets of changed accounts are stale
+  if (assets_cache_ != nullptr) {
+    for (auto &&pk : wsv.touched_accounts()) assets_cache_->erase(pk);
+  }
 
   // create new append transaction
   init_append_tx();
 }
 
 
+void Ametsuchi::wait_sealing() {
+  tx_store.wait_sealing();
+  // blocks committed during the copy
+  tx_store.start_sealing(env);
+  tx_store.wait_sealing();
+}
+
+
+void Ametsuchi::begin_bulk_load() {
+  tx_store.begin_bulk_load(env, path_ + "/bulk/", options_.bulk_run_size);
+  // the filter is rebuilt from wsv, if the load is interrupted
+  wsv.drop_filter();
+  // interrupted load is detected after restart
+  commit();
+}
+
+
+void Ametsuchi::end_bulk_load() {
+  tx_store.end_bulk_load();
+  commit();
+}
+
+
+void Ametsuchi::rebuild_indexes(size_t threads) {
+  // threads read committed transactions
+  commit();
+  tx_store.rebuild_indexes(env, path_ + "/rebuild/", options_.bulk_run_size,
+                           threads);
+  commit();
+}
+
+
+std::future<void> Ametsuchi::commit_async() {
+  auto bytes = uncommitted_bytes_;
+  commit();
+
+  if (group_sync_) return group_sync_->enqueue(bytes);
+
+  // FULL mode: commit is durable already
+  std::promise<void> done;
+  done.set_value();
+  return done.get_future();
+}
+
+
+void Ametsuchi::set_durability(Durability mode,
+                               std::chrono::milliseconds sync_interval,
+                               size_t sync_bytes) {
+  int res;
+
+  // sync commits done in the previous mode
+  group_sync_.reset();
+
+  res = mdb_env_set_flags(env, MDB_NOSYNC | MDB_NOMETASYNC, 0);
+  AMETSUCHI_CHECK(res);
+
+  switch (mode) {
+    case Durability::FULL:
+      return;
+    case Durability::NO_META_SYNC:
+      res = mdb_env_set_flags(env, MDB_NOMETASYNC, 1);
+      break;
+    case Durability::ASYNC:
+      res = mdb_env_set_flags(env, MDB_NOSYNC, 1);
+      break;
+  }
+  AMETSUCHI_CHECK(res);
+
+  group_sync_.reset(new GroupSync(env, sync_interval, sync_bytes));
+}
+
+
 void Ametsuchi::rollback() {
   abort_append_tx();
+  uncommitted_bytes_ = 0;
   init_append_tx();
+  tx_store.rollback();
 }
 
 
 void Ametsuchi::abort_append_tx() {
   tx_store.close_cursors();
   wsv.close_cursors();
+  if (savepoint_tx_) mdb_txn_abort(savepoint_tx_);
   if (append_tx_) mdb_txn_abort(append_tx_);
+  savepoint_tx_ = nullptr;
+  append_tx_ = nullptr;
+}
+
+
+void Ametsuchi::flush_filters() {
+  int res;
+
+  // key filters are persisted lazily by commits, the rest is written once
+  if (tx_store.bulk_loading()) return;
+  try {
+    if ((res = mdb_txn_begin(env, nullptr, 0, &append_tx_))) {
+      AMETSUCHI_CRITICAL(res, MDB_PANIC);
+      AMETSUCHI_CRITICAL(res, MDB_MAP_RESIZED);
+      AMETSUCHI_CRITICAL(res, MDB_READERS_FULL);
+      AMETSUCHI_CRITICAL(res, ENOMEM);
+    }
+    tx_store.open_cursors(append_tx_);
+    wsv.open_cursors(append_tx_);
+    tx_store.flush_filters();
+    wsv.flush_filter();
+    tx_store.close_cursors();
+    wsv.close_cursors();
+    // the transaction is freed even if commit fails
+    res = mdb_txn_commit(append_tx_);
+    append_tx_ = nullptr;
+    if (res) console->error("key filters are not persisted: {}",
+                            mdb_strerror(res));
+  } catch (...) {
+    // filters are rebuilt from trees after restart
+    console->error("key filters are not persisted");
+    abort_append_tx();
+  }
+}
+
+
+void Ametsuchi::begin_savepoint() {
+  int res;
+
+  // parent transaction can not be used while nested one is active
+  tx_store.close_cursors();
+  wsv.close_cursors();
+
+  if ((res = mdb_txn_begin(env, append_tx_, 0, &savepoint_tx_))) {
+    AMETSUCHI_CRITICAL(res, MDB_PANIC);
+    AMETSUCHI_CRITICAL(res, MDB_BAD_TXN);
+    AMETSUCHI_CRITICAL(res, ENOMEM);
+  }
+
+  tx_store.open_cursors(savepoint_tx_);
+  wsv.open_cursors(savepoint_tx_);
+  tx_store.savepoint();
+  wsv.savepoint();
 }
 
 
+void Ametsuchi::end_savepoint(bool keep) {
+  int res;
+
+  tx_store.close_cursors();
+  wsv.close_cursors();
+
+  MDB_txn *txn = savepoint_tx_;
+  savepoint_tx_ = nullptr;
+
+  if (!keep) {
+    mdb_txn_abort(txn);
+    tx_store.rollback_savepoint();
+    wsv.rollback_savepoint();
+    return;
+  }
+
+  // nested commit just merges dirty pages into append_tx_
+  if ((res = mdb_txn_commit(txn))) {
+    AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+    AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+    AMETSUCHI_CRITICAL(res, ENOMEM);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+}
+
+
+void Ametsuchi::close_env() {
+  abort_append_tx();
+  workers_.reset();
+  read_pool_.reset();
+  group_sync_.reset();
+  // handles of trees are freed with the environment
+  if (env != nullptr) mdb_env_close(env);
+  env = nullptr;
+}
+
 void Ametsuchi::init() {
   int res;
 
@@ -119,7 +519,11 @@ void Ametsuchi::init() {
 
   // set maximum mmap size. Must be multiple of OS page size (4 KB).
   // max size of the database (!!!)
-  if ((res = mdb_env_set_mapsize(env, AMETSUCHI_MAX_DB_SIZE))) {
+  if ((res = mdb_env_set_mapsize(env, options_.map_size))) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  if ((res = mdb_env_set_maxreaders(env, options_.max_readers))) {
     AMETSUCHI_CRITICAL(res, EINVAL);
   }
 
@@ -129,8 +533,14 @@ void Ametsuchi::init() {
     AMETSUCHI_CRITICAL(res, EINVAL);
   }
 
+  // reader slots belong to transactions, so ReadTxPool can release them
+  unsigned int flags = MDB_NOTLS;
+  if (options_.fixed_map) flags |= MDB_FIXEDMAP;
+  if (options_.no_readahead) flags |= MDB_NORDAHEAD;
+  if (options_.write_map) flags |= MDB_WRITEMAP;
+
   // create database environment
-  if ((res = mdb_env_open(env, path_.c_str(), MDB_FIXEDMAP, 0700))) {
+  if ((res = mdb_env_open(env, path_.c_str(), flags, 0700))) {
     AMETSUCHI_CRITICAL(res, MDB_VERSION_MISMATCH);
     AMETSUCHI_CRITICAL(res, MDB_INVALID);
     AMETSUCHI_CRITICAL(res, ENOENT);
@@ -141,10 +551,25 @@ void Ametsuchi::init() {
   // stats about db
   mdb_env_stat(env, &mst);
 
+  read_pool_.reset(new ReadTxPool(env));
+  workers_.reset(new WorkerPool(
+      options_.pipeline_threads != 0
+          ? options_.pipeline_threads
+          : std::max(1u, std::thread::hardware_concurrency())));
+  if (options_.assets_cache_size > 0) {
+    assets_cache_.reset(
+        new Cache<std::string, Assets>(options_.assets_cache_size));
+  }
+
+  // segments are read even if new ones are not sealed
+  tx_store.set_segments(path_ + "/segments/", options_.hot_blocks,
+                        options_.segment_blocks);
+
   // initialize
   init_append_tx();
 
   tx_store.init_merkle_tree();
+  tx_store.init_hash_filter();
 }
 
 
@@ -162,14 +587,76 @@ void Ametsuchi::init_append_tx() {
   // them in map for tx_store and wsv
   tx_store.init(append_tx_);
   wsv.init(append_tx_);
+  // writes of the first transaction
+  if (options_.savepoints) begin_savepoint();
   // stats about db
   mdb_env_stat(env, &mst);
 }
 
 
+Snapshot Ametsuchi::snapshot() {
+  return Snapshot(read_pool_->acquire(), tx_store, wsv, snapshots_);
+}
+
+
+std::shared_ptr<const Ametsuchi::Assets> Ametsuchi::cached_assets(
+    const flatbuffers::String *pubKey) {
+  auto load = [&]() {
+    return read(false, [&](ReadTx *rtx) {
+      Assets copy;
+      for (auto &&asset : wsv.accountGetAllAssets(pubKey, rtx)) {
+        auto data = static_cast<const uint8_t *>(asset.data);
+        copy.push_back(std::make_shared<const std::vector<uint8_t>>(
+            data, data + asset.size));
+      }
+      return copy;
+    });
+  };
+
+  // a live snapshot of this thread pins an older state, which is neither
+  // cached nor replaced with a newer one
+  if (read_pool_->pinned()) return std::make_shared<const Assets>(load());
+
+  std::string pk{pubKey->data(), pubKey->data() + pubKey->size()};
+  auto assets = assets_cache_->get(pk);
+  if (assets != nullptr) return assets;
+
+  // taken before the read transaction begins, so a commit in between
+  // keeps the result out of the cache
+  auto version = assets_cache_->version(pk);
+  return assets_cache_->put(pk, load(), version);
+}
+
+
+static bool same_name(const flatbuffers::String *a,
+                      const flatbuffers::String *b) {
+  return a->size() == b->size() &&
+         std::memcmp(a->data(), b->data(), a->size()) == 0;
+}
+
+
 std::vector<AM_val> Ametsuchi::accountGetAllAssets(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return wsv.accountGetAllAssets(pubKey, uncommitted, env);
+  if (!wsv.maybe_has_assets(pubKey, uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  if (!uncommitted && assets_cache_ != nullptr) {
+    std::vector<AM_val> ret;
+    for (auto &&asset : *cached_assets(pubKey)) ret.emplace_back(asset);
+    return ret;
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return wsv.accountGetAllAssets(pubKey, rtx);
+  });
+}
+
+
+size_t Ametsuchi::accountCountAssets(const flatbuffers::String *pubKey,
+                                     bool uncommitted) {
+  if (!wsv.maybe_has_assets(pubKey, uncommitted)) return 0;
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return wsv.accountCountAssets(pubKey, rtx);
+  });
 }
 
 
@@ -178,103 +665,315 @@ AM_val Ametsuchi::accountGetAsset(const flatbuffers::String *pubKey,
                                   const flatbuffers::String *domain_name,
                                   const flatbuffers::String *asset_name,
                                   bool uncommitted) {
-  return wsv.accountGetAsset(pubKey, ledger_name, domain_name, asset_name,
-                             uncommitted, env);
+  if (!uncommitted && assets_cache_ != nullptr) {
+    if (!wsv.maybe_has_assets(pubKey, false)) {
+      throw exception::InvalidTransaction::ASSET_NOT_FOUND;
+    }
+    for (auto &&asset : *cached_assets(pubKey)) {
+      auto currency = flatbuffers::GetRoot<iroha::Asset>(asset->data())
+                          ->asset_as_Currency();
+      if (currency != nullptr &&
+          same_name(currency->ledger_name(), ledger_name) &&
+          same_name(currency->domain_name(), domain_name) &&
+          same_name(currency->currency_name(), asset_name)) {
+        return AM_val(asset);
+      }
+    }
+    throw exception::InvalidTransaction::ASSET_NOT_FOUND;
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return wsv.accountGetAsset(pubKey, ledger_name, domain_name, asset_name,
+                               rtx);
+  });
 }
 
 std::vector<AM_val> Ametsuchi::getAssetTransferBySender(
     const flatbuffers::String *senderKey, bool uncommitted) {
-  return tx_store.getAssetTransferBySender(senderKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_TRANSFER_SENDER, senderKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAssetTransferBySender(senderKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAssetTransferByReceiver(
     const flatbuffers::String *receiverKey, bool uncommitted) {
-  return tx_store.getAssetTransferByReceiver(receiverKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_TRANSFER_RECEIVER, receiverKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAssetTransferByReceiver(receiverKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAssetCreateByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAssetCreateByKey(pubKey, uncommitted);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ASSET_CREATE, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAssetCreateByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAssetAddByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAssetAddByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ASSET_ADD, pubKey, uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAssetAddByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAssetRemoveByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAssetRemoveByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ASSET_REMOVE, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAssetRemoveByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAssetTransferByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAssetTransferByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ASSET_TRANSFER, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAssetTransferByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAccountAddByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAccountAddByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ACCOUNT_ADD, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAccountAddByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAccountAddSignByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAccountAddSignByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ACCOUNT_ADD_SIGN, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAccountAddSignByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAccountRemoveByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAccountRemoveByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ACCOUNT_REMOVE, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAccountRemoveByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAccountRemoveSignByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAccountRemoveSignByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ACCOUNT_REMOVE_SIGN, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAccountRemoveSignByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getAccountSetUseKeysByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getAccountSetUseKeysByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_ACCOUNT_SET_USE_KEYS, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAccountSetUseKeysByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getPeerAddByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getPeerAddByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_PEER_ADD, pubKey, uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getPeerAddByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getPeerChangeTrustByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getPeerChangeTrustByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_PEER_CHANGE_TRUST, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getPeerChangeTrustByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getPeerRemoveByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getPeerRemoveByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_PEER_REMOVE, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getPeerRemoveByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getPeerSetActiveByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getPeerSetActiveByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_PEER_SET_ACTIVE, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getPeerSetActiveByKey(pubKey, rtx);
+  });
 }
 
 
 std::vector<AM_val> Ametsuchi::getPeerSetTrustByKey(
     const flatbuffers::String *pubKey, bool uncommitted) {
-  return tx_store.getPeerSetTrustByKey(pubKey, uncommitted, env);
+  if (!tx_store.maybe_has_key(TxStore::INDEX_PEER_SET_TRUST, pubKey,
+                              uncommitted)) {
+    return std::vector<AM_val>{};
+  }
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getPeerSetTrustByKey(pubKey, rtx);
+  });
+}
+
+
+AM_val Ametsuchi::getTxByHash(const merkle::hash_t &hash, bool uncommitted) {
+  return read(uncommitted,
+              [&](ReadTx *rtx) { return tx_store.getTxByHash(hash, rtx); });
+}
+
+
+bool Ametsuchi::getReceipt(const merkle::hash_t &hash,
+                           TxStore::Receipt &receipt, bool uncommitted) {
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getReceipt(hash, receipt, rtx);
+  });
+}
+
+
+AM_val Ametsuchi::getAttachment(const merkle::hash_t &hash, bool uncommitted) {
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getAttachment(hash, rtx);
+  });
+}
+
+
+std::vector<AM_val> Ametsuchi::getTxByTime(uint64_t from, uint64_t to,
+                                           bool uncommitted) {
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getTxByTime(from, to, rtx);
+  });
+}
+
+
+std::vector<AM_val> Ametsuchi::getTxByKeyTime(const flatbuffers::String *key,
+                                              uint64_t from, uint64_t to,
+                                              bool uncommitted) {
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getTxByKeyTime(key, from, to, rtx);
+  });
+}
+
+
+std::vector<std::vector<AM_val>> Ametsuchi::getTxByKeys(
+    TxStore::Tree index, const std::vector<const flatbuffers::String *> &keys,
+    bool uncommitted) {
+  auto any = std::any_of(keys.begin(), keys.end(),
+                         [&](const flatbuffers::String *key) {
+                           return tx_store.maybe_has_key(index, key,
+                                                         uncommitted);
+                         });
+  if (!any) return std::vector<std::vector<AM_val>>(keys.size());
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.getTxByKeys(index, keys, rtx);
+  });
+}
+
+
+size_t Ametsuchi::countTxByKey(TxStore::Tree index,
+                               const flatbuffers::String *key,
+                               bool uncommitted) {
+  if (!tx_store.maybe_has_key(index, key, uncommitted)) return 0;
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.countTxByKey(index, key, rtx);
+  });
+}
+
+
+bool Ametsuchi::hasTxByKey(TxStore::Tree index, const flatbuffers::String *key,
+                           bool uncommitted) {
+  if (!tx_store.maybe_has_key(index, key, uncommitted)) return false;
+  return read(uncommitted, [&](ReadTx *rtx) {
+    return tx_store.hasTxByKey(index, key, rtx);
+  });
+}
+
+
+AM_val Ametsuchi::getBlockHeader(uint64_t height) {
+  return read(false, [&](ReadTx *rtx) {
+    return tx_store.getBlockHeader(height, rtx);
+  });
+}
+
+
+std::vector<AM_val> Ametsuchi::getBlockTxs(uint64_t height) {
+  return read(false,
+              [&](ReadTx *rtx) { return tx_store.getBlockTxs(height, rtx); });
+}
+
+
+TxCursor Ametsuchi::streamTxByKey(TxStore::Tree index,
+                                  const flatbuffers::String *key, size_t limit,
+                                  size_t offset, uint64_t token,
+                                  bool newest_first) {
+  return tx_store.streamTxByKey(index, key, read_pool_->acquire(), limit,
+                                offset, token, newest_first);
+}
+
+
+TxCursor Ametsuchi::latestTxByKey(TxStore::Tree index,
+                                  const flatbuffers::String *key, size_t n) {
+  return streamTxByKey(index, key, n, 0, 0, true);
 }
 
 }  // namespace ametsuchi
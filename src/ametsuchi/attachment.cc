@@ -0,0 +1,96 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/attachment.h>
+#include <ametsuchi/exception.h>
+#include <cstring>
+#include <memory>
+
+namespace ametsuchi {
+
+namespace {
+
+const uint32_t CUT_MAGIC = 0xA77AC4ED;
+const size_t CUT_HEADER = sizeof(uint32_t) * 2 + merkle::HASH_LEN;
+
+}  // namespace
+
+std::vector<uint8_t> cut_attachment(const uint8_t *blob, size_t size,
+                                    const uint8_t *data, size_t data_size,
+                                    const merkle::hash_t &hash) {
+  uint32_t offset = static_cast<uint32_t>(data - blob);
+
+  std::vector<uint8_t> value(CUT_HEADER + size - data_size);
+  auto out = value.data();
+  std::memcpy(out, &CUT_MAGIC, sizeof(CUT_MAGIC));
+  std::memcpy(out + sizeof(CUT_MAGIC), &offset, sizeof(offset));
+  std::memcpy(out + sizeof(uint32_t) * 2, hash.data(), hash.size());
+  out += CUT_HEADER;
+  std::memcpy(out, blob, offset);
+  std::memcpy(out + offset, data + data_size, size - offset - data_size);
+  return value;
+}
+
+bool is_cut(const MDB_val &val) {
+  uint32_t magic;
+  if (val.mv_size < CUT_HEADER) return false;
+  std::memcpy(&magic, val.mv_data, sizeof(magic));
+  return magic == CUT_MAGIC;
+}
+
+AM_val join_attachment(AM_val val, MDB_cursor *attachments) {
+  MDB_val c_key, c_val;
+  int res;
+
+  MDB_val stored;
+  stored.mv_data = (void *)val.data;
+  stored.mv_size = val.size;
+  if (!is_cut(stored)) return val;
+
+  auto in = static_cast<const uint8_t *>(val.data);
+  uint32_t offset, data_size;
+  std::memcpy(&offset, in + sizeof(CUT_MAGIC), sizeof(offset));
+  auto body = in + CUT_HEADER;
+  auto body_size = val.size - CUT_HEADER;
+  // the length prefix of the vector is kept before the cut
+  if (offset < sizeof(data_size) || offset > body_size) {
+    console->critical("corrupted attachment offset in {}",
+                      __PRETTY_FUNCTION__);
+    throw exception::InternalError::FATAL;
+  }
+  std::memcpy(&data_size, body + offset - sizeof(data_size),
+              sizeof(data_size));
+
+  c_key.mv_data = (void *)(in + sizeof(uint32_t) * 2);
+  c_key.mv_size = merkle::HASH_LEN;
+  if ((res = mdb_cursor_get(attachments, &c_key, &c_val, MDB_SET))) {
+    AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  if (c_val.mv_size != data_size) {
+    console->critical("attachment size mismatch in {}", __PRETTY_FUNCTION__);
+    throw exception::InternalError::FATAL;
+  }
+
+  auto buf = std::make_shared<std::vector<uint8_t>>(body_size + data_size);
+  auto out = buf->data();
+  std::memcpy(out, body, offset);
+  std::memcpy(out + offset, c_val.mv_data, data_size);
+  std::memcpy(out + offset + data_size, body + offset, body_size - offset);
+  return AM_val(std::shared_ptr<const std::vector<uint8_t>>(std::move(buf)));
+}
+
+}  // namespace ametsuchi
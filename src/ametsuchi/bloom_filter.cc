@@ -0,0 +1,122 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/bloom_filter.h>
+#include <algorithm>
+#include <cstring>
+
+namespace ametsuchi {
+
+/**
+ * FNV-1a, finalized with mixer of splitmix64
+ */
+static inline uint64_t hash64(const void *data, size_t size) {
+  auto p = static_cast<const uint8_t *>(data);
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 1099511628211ull;
+  }
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebull;
+  h ^= h >> 31;
+  return h;
+}
+
+BloomFilter::BloomFilter(size_t capacity, size_t bits_per_key)
+    : capacity_(capacity), inserted_(0) {
+  // k = ln(2) * bits per key is optimal
+  probes_ = std::max<size_t>(1, bits_per_key * 69 / 100);
+  nbits_ = std::max<size_t>(64, capacity * bits_per_key);
+  // value-initialized words are zero
+  bits_ = std::vector<std::atomic<uint64_t>>((nbits_ + 63) / 64);
+  nbits_ = bits_.size() * 64;
+}
+
+void BloomFilter::insert(const void *data, size_t size) {
+  // double hashing: probe i is h1 + i * h2
+  uint64_t h = hash64(data, size);
+  uint64_t delta = (h >> 33) | (h << 31);
+  for (size_t i = 0; i < probes_; i++) {
+    size_t bit = h % nbits_;
+    bits_[bit / 64].fetch_or(1ull << (bit % 64), std::memory_order_relaxed);
+    h += delta;
+  }
+  inserted_++;
+}
+
+bool BloomFilter::maybe_contains(const void *data, size_t size) const {
+  uint64_t h = hash64(data, size);
+  uint64_t delta = (h >> 33) | (h << 31);
+  for (size_t i = 0; i < probes_; i++) {
+    size_t bit = h % nbits_;
+    auto word = bits_[bit / 64].load(std::memory_order_relaxed);
+    if ((word & (1ull << (bit % 64))) == 0) return false;
+    h += delta;
+  }
+  return true;
+}
+
+void BloomFilter::clear() {
+  for (auto &&word : bits_) word.store(0, std::memory_order_relaxed);
+  inserted_ = 0;
+}
+
+// [nbits][probes][capacity][inserted][bits...], native uint64
+static const size_t HEADER_WORDS = 4;
+
+std::vector<uint8_t> BloomFilter::serialize() const {
+  uint64_t header[HEADER_WORDS] = {nbits_, probes_, capacity_, inserted_};
+  std::vector<uint8_t> ret(sizeof(header) + bits_.size() * sizeof(uint64_t));
+  std::memcpy(ret.data(), header, sizeof(header));
+  auto out = ret.data() + sizeof(header);
+  for (auto &&word : bits_) {
+    auto value = word.load(std::memory_order_relaxed);
+    std::memcpy(out, &value, sizeof(value));
+    out += sizeof(value);
+  }
+  return ret;
+}
+
+bool BloomFilter::deserialize(const void *data, size_t size) {
+  uint64_t header[HEADER_WORDS];
+  if (size < sizeof(header)) return false;
+  std::memcpy(header, data, sizeof(header));
+
+  auto words = header[0] / 64;
+  if (header[0] == 0 || header[0] % 64 != 0 || header[1] == 0 ||
+      size != sizeof(header) + words * sizeof(uint64_t)) {
+    return false;
+  }
+
+  nbits_ = header[0];
+  probes_ = header[1];
+  capacity_ = header[2];
+  inserted_ = header[3];
+  bits_ = std::vector<std::atomic<uint64_t>>(words);
+  auto in = static_cast<const uint8_t *>(data) + sizeof(header);
+  for (auto &&word : bits_) {
+    uint64_t value;
+    std::memcpy(&value, in, sizeof(value));
+    word.store(value, std::memory_order_relaxed);
+    in += sizeof(value);
+  }
+  return true;
+}
+
+}  // namespace ametsuchi
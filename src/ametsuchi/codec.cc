@@ -0,0 +1,163 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/codec.h>
+#include <zdict.h>
+#include <zstd.h>
+#include <cstring>
+
+namespace ametsuchi {
+
+#define CODEC_CHECK(res)                                                  \
+  if (ZSTD_isError(res)) {                                                \
+    console->critical("{} in {}", ZSTD_getErrorName(res),                 \
+                      __PRETTY_FUNCTION__);                               \
+    throw exception::InternalError::FATAL;                                \
+  }
+
+namespace {
+
+struct DCtxDeleter {
+  void operator()(ZSTD_DCtx *dctx) const { ZSTD_freeDCtx(dctx); }
+};
+
+/**
+ * Decompression context of the calling thread
+ */
+ZSTD_DCtx *thread_dctx() {
+  thread_local std::unique_ptr<ZSTD_DCtx, DCtxDeleter> dctx(
+      ZSTD_createDCtx());
+  return dctx.get();
+}
+
+}  // namespace
+
+Codec::Codec(Type type, int level)
+    : type_(type),
+      level_(level),
+      cctx_(nullptr),
+      cdict_(nullptr),
+      ddicts_(std::make_shared<DDicts>()) {
+  if (type_ == ZSTD) cctx_ = ZSTD_createCCtx();
+}
+
+Codec::~Codec() {
+  ZSTD_freeCCtx(cctx_);
+  ZSTD_freeCDict(cdict_);
+}
+
+void Codec::set_dictionary(const void *data, size_t size) {
+  // only the writer compresses, so the old dictionary can be freed now
+  ZSTD_freeCDict(cdict_);
+  auto p = static_cast<const uint8_t *>(data);
+  dictionary_.assign(p, p + size);
+  cdict_ = ZSTD_createCDict(dictionary_.data(), size, level_);
+
+  // readers may be decoding with the current map, so publish a new one
+  auto ddicts = std::make_shared<DDicts>(*std::atomic_load(&ddicts_));
+  (*ddicts)[ZDICT_getDictID(dictionary_.data(), size)] =
+      std::shared_ptr<ZSTD_DDict_s>(
+          ZSTD_createDDict(dictionary_.data(), size), ZSTD_freeDDict);
+  std::atomic_store(&ddicts_, std::shared_ptr<const DDicts>(ddicts));
+}
+
+std::vector<uint8_t> Codec::train(const std::vector<MDB_val> &samples,
+                                  size_t max_size) {
+  std::vector<uint8_t> data;
+  std::vector<size_t> sizes;
+  sizes.reserve(samples.size());
+  for (auto &&s : samples) {
+    auto p = static_cast<const uint8_t *>(s.mv_data);
+    data.insert(data.end(), p, p + s.mv_size);
+    sizes.push_back(s.mv_size);
+  }
+
+  std::vector<uint8_t> dict(max_size);
+  auto res = ZDICT_trainFromBuffer(dict.data(), dict.size(), data.data(),
+                                   sizes.data(), sizes.size());
+  // too few or too small samples
+  if (ZDICT_isError(res)) return std::vector<uint8_t>{};
+
+  dict.resize(res);
+  return dict;
+}
+
+MDB_val Codec::encode(const MDB_val &val) {
+  if (type_ == NONE) return val;
+
+  buf_.resize(ZSTD_compressBound(val.mv_size));
+  auto res =
+      cdict_ == nullptr
+          ? ZSTD_compressCCtx(cctx_, buf_.data(), buf_.size(), val.mv_data,
+                              val.mv_size, level_)
+          : ZSTD_compress_usingCDict(cctx_, buf_.data(), buf_.size(),
+                                     val.mv_data, val.mv_size, cdict_);
+  CODEC_CHECK(res);
+
+  // raw value is read without a copy, so keep it if gain is small
+  if (res + res / 8 >= val.mv_size) return val;
+
+  MDB_val ret;
+  ret.mv_data = buf_.data();
+  ret.mv_size = res;
+  return ret;
+}
+
+AM_val Codec::decode(const MDB_val &val) const {
+  if (!is_compressed(val)) return AM_val(val);
+
+  auto size = ZSTD_getFrameContentSize(val.mv_data, val.mv_size);
+  if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+    console->critical("corrupted zstd frame in {}", __PRETTY_FUNCTION__);
+    throw exception::InternalError::FATAL;
+  }
+
+  auto buf = std::make_shared<std::vector<uint8_t>>(size);
+  // values written before the dictionary was trained have no dictionary id,
+  // others are decoded with the dictionary they were compressed with
+  auto id = ZSTD_getDictID_fromFrame(val.mv_data, val.mv_size);
+  std::shared_ptr<ZSTD_DDict_s> ddict;
+  if (id != 0) {
+    auto ddicts = std::atomic_load(&ddicts_);
+    auto it = ddicts->find(id);
+    if (it == ddicts->end()) {
+      console->critical("unknown zstd dictionary {} in {}", id,
+                        __PRETTY_FUNCTION__);
+      throw exception::InternalError::FATAL;
+    }
+    ddict = it->second;
+  }
+  auto res = ddict == nullptr
+                 ? ZSTD_decompressDCtx(thread_dctx(), buf->data(),
+                                       buf->size(), val.mv_data, val.mv_size)
+                 : ZSTD_decompress_usingDDict(thread_dctx(), buf->data(),
+                                              buf->size(), val.mv_data,
+                                              val.mv_size, ddict.get());
+  CODEC_CHECK(res);
+
+  return AM_val(std::shared_ptr<const std::vector<uint8_t>>(std::move(buf)));
+}
+
+bool Codec::is_compressed(const MDB_val &val) {
+  // flatbuffers start with the root offset, which is always less than
+  // the magic number
+  uint32_t magic;
+  if (val.mv_size < sizeof(magic)) return false;
+  std::memcpy(&magic, val.mv_data, sizeof(magic));
+  return magic == ZSTD_MAGICNUMBER;
+}
+
+}  // namespace ametsuchi
@@ -0,0 +1,61 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/decoder.h>
+#include <flatbuffers/flatbuffers.h>
+#include <algorithm>
+
+namespace ametsuchi {
+
+DecodedTx decode(const uint8_t *blob, size_t size,
+                 size_t attachment_threshold) {
+  DecodedTx ret;
+  ret.blob = blob;
+  ret.size = size;
+  ret.tx = nullptr;
+  ret.valid = false;
+  ret.attachment_hashed = false;
+
+  if (blob == nullptr) return ret;
+
+  // 1. structural check of the flatbuffer, O(size)
+  flatbuffers::Verifier verifier(blob, size);
+  if (!verifier.VerifyBuffer<iroha::Transaction>(nullptr)) return ret;
+
+  auto tx = flatbuffers::GetRoot<iroha::Transaction>(blob);
+
+  // 2. transaction hash is a leaf of merkle tree
+  auto hash = tx->hash();
+  if (hash == nullptr || hash->size() != merkle::HASH_LEN) return ret;
+  std::copy(hash->begin(), hash->end(), ret.hash.begin());
+
+  // 3. content hash of large attachment data, O(size)
+  auto attachment = tx->attachment();
+  if (attachment_threshold != 0 && attachment != nullptr &&
+      attachment->data() != nullptr &&
+      attachment->data()->size() >= attachment_threshold) {
+    ret.attachment_hash = merkle::MerkleTree::hash(attachment->data()->data(),
+                                                   attachment->data()->size());
+    ret.attachment_hashed = true;
+  }
+
+  ret.tx = tx;
+  ret.valid = true;
+  return ret;
+}
+
+}  // namespace ametsuchi
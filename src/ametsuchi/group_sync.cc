@@ -0,0 +1,86 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/common.h>
+#include <ametsuchi/group_sync.h>
+
+namespace ametsuchi {
+
+GroupSync::GroupSync(MDB_env *env, std::chrono::milliseconds interval,
+                     size_t bytes)
+    : env_(env),
+      interval_(interval),
+      bytes_(bytes),
+      stop_(false),
+      pending_bytes_(0),
+      thread_(&GroupSync::run, this) {}
+
+GroupSync::~GroupSync() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+std::future<void> GroupSync::enqueue(size_t bytes) {
+  std::future<void> ret;
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace_back();
+    ret = pending_.back().get_future();
+    pending_bytes_ += bytes;
+    full = pending_bytes_ >= bytes_;
+  }
+  if (full) cv_.notify_one();
+  return ret;
+}
+
+void GroupSync::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait_for(lock, interval_,
+                 [this] { return stop_ || pending_bytes_ >= bytes_; });
+
+    if (pending_.empty()) {
+      if (stop_) return;
+      continue;
+    }
+
+    auto synced = std::move(pending_);
+    pending_.clear();
+    pending_bytes_ = 0;
+
+    // do not block committer while syncing
+    lock.unlock();
+    int res = mdb_env_sync(env_, 1);
+    if (res) console->critical("mdb_env_sync: {}", mdb_strerror(res));
+    for (auto &&done : synced) {
+      if (res) {
+        done.set_exception(
+            std::make_exception_ptr(exception::Exception(mdb_strerror(res))));
+      } else {
+        done.set_value();
+      }
+    }
+    lock.lock();
+  }
+}
+
+}  // namespace ametsuchi
@@ -0,0 +1,236 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/common.h>
+#include <ametsuchi/exception.h>
+#include <ametsuchi/index_builder.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <queue>
+
+namespace ametsuchi {
+
+#define RUN_CRITICAL(what, path)                                      \
+  {                                                                   \
+    console->critical("{} {}: {}", what, path, std::strerror(errno)); \
+    throw exception::InternalError::FATAL;                            \
+  }
+
+namespace {
+
+/**
+ * Sequential reader of a run file, holds the current record.
+ */
+class RunReader {
+ public:
+  explicit RunReader(const std::string &path) : path_(path) {
+    file_ = std::fopen(path.c_str(), "rb");
+    if (file_ == nullptr) RUN_CRITICAL("can not open run", path);
+  }
+  RunReader(const RunReader &) = delete;
+  RunReader &operator=(const RunReader &) = delete;
+  ~RunReader() { std::fclose(file_); }
+
+  /**
+   * @return false at the end of the run
+   */
+  bool next() {
+    uint32_t head[2];
+    auto n = std::fread(head, sizeof(head), 1, file_);
+    if (n == 0 && std::feof(file_)) return false;
+
+    tree = head[0];
+    key.resize(head[1]);
+    if (n != 1 || std::fread(&seq, sizeof(seq), 1, file_) != 1 ||
+        std::fread(&key[0], 1, key.size(), file_) != key.size()) {
+      RUN_CRITICAL("can not read run", path_);
+    }
+    return true;
+  }
+
+  bool operator>(const RunReader &r) const {
+    if (tree != r.tree) return tree > r.tree;
+    // the same order as LMDB default comparator
+    auto cmp = key.compare(r.key);
+    if (cmp != 0) return cmp > 0;
+    return seq > r.seq;
+  }
+
+  uint32_t tree;
+  std::string key;
+  uint64_t seq;
+
+ private:
+  std::string path_;
+  FILE *file_;
+};
+
+}  // namespace
+
+
+IndexBuilder::IndexBuilder(const std::string &dir, size_t run_size)
+    : dir_(dir), run_size_(run_size), committed_(0), total_(0) {
+  if (mkdir(dir_.c_str(), 0700) && errno != EEXIST) {
+    RUN_CRITICAL("can not create directory", dir_);
+  }
+
+  auto d = opendir(dir_.c_str());
+  if (d == nullptr) RUN_CRITICAL("can not open directory", dir_);
+  while (auto entry = readdir(d)) {
+    std::string name = entry->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".run") == 0) {
+      std::remove((dir_ + name).c_str());
+    }
+  }
+  closedir(d);
+}
+
+IndexBuilder::~IndexBuilder() {
+  clear();
+  rmdir(dir_.c_str());
+}
+
+void IndexBuilder::add(size_t tree, const void *key, size_t size,
+                       uint64_t seq) {
+  auto p = static_cast<const uint8_t *>(key);
+  records_.push_back(Record{static_cast<uint32_t>(tree),
+                            static_cast<uint32_t>(size), keys_.size(), seq});
+  keys_.insert(keys_.end(), p, p + size);
+  total_++;
+}
+
+void IndexBuilder::truncate(uint64_t seq) {
+  while (records_.size() > committed_ && records_.back().seq > seq) {
+    keys_.resize(records_.back().offset);
+    records_.pop_back();
+    total_--;
+  }
+}
+
+void IndexBuilder::commit() {
+  if (keys_.size() + records_.size() * sizeof(Record) > run_size_) spill();
+  committed_ = records_.size();
+}
+
+void IndexBuilder::spill() {
+  if (records_.empty()) return;
+
+  std::sort(records_.begin(), records_.end(),
+            [this](const Record &a, const Record &b) {
+              if (a.tree != b.tree) return a.tree < b.tree;
+              auto cmp = std::memcmp(&keys_[a.offset], &keys_[b.offset],
+                                     std::min(a.size, b.size));
+              if (cmp != 0) return cmp < 0;
+              if (a.size != b.size) return a.size < b.size;
+              return a.seq < b.seq;
+            });
+
+  char name[32];
+  std::snprintf(name, sizeof(name), "%06zu.run", runs_.size());
+  auto path = dir_ + name;
+  auto file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) RUN_CRITICAL("can not create run", path);
+  runs_.push_back(path);
+
+  for (auto &&r : records_) {
+    uint32_t head[] = {r.tree, r.size};
+    if (std::fwrite(head, sizeof(head), 1, file) != 1 ||
+        std::fwrite(&r.seq, sizeof(r.seq), 1, file) != 1 ||
+        std::fwrite(&keys_[r.offset], 1, r.size, file) != r.size) {
+      std::fclose(file);
+      RUN_CRITICAL("can not write run", path);
+    }
+  }
+  if (std::fclose(file)) RUN_CRITICAL("can not write run", path);
+
+  records_.clear();
+  records_.shrink_to_fit();
+  keys_.clear();
+  keys_.shrink_to_fit();
+  committed_ = 0;
+}
+
+void IndexBuilder::adopt(IndexBuilder &other) {
+  other.spill();
+  runs_.insert(runs_.end(), other.runs_.begin(), other.runs_.end());
+  total_ += other.total_;
+  other.runs_.clear();
+  other.total_ = 0;
+}
+
+void IndexBuilder::merge(const Writer &write) {
+  spill();
+
+  using Reader = std::shared_ptr<RunReader>;
+  auto greater = [](const Reader &a, const Reader &b) { return *a > *b; };
+  std::priority_queue<Reader, std::vector<Reader>, decltype(greater)> heap(
+      greater);
+
+  for (auto &&path : runs_) {
+    auto reader = std::make_shared<RunReader>(path);
+    if (reader->next()) heap.push(reader);
+  }
+
+  uint32_t tree = 0;
+  std::string key;
+  std::vector<uint8_t> seqs;
+  uint8_t seq[SEQ_LEN];
+
+  auto flush = [&]() {
+    if (seqs.empty()) return;
+    MDB_val c_key;
+    c_key.mv_data = (void *)key.data();
+    c_key.mv_size = key.size();
+    write(tree, c_key, seqs);
+    seqs.clear();
+  };
+
+  while (!heap.empty()) {
+    auto reader = heap.top();
+    heap.pop();
+
+    if (reader->tree != tree || reader->key != key) {
+      flush();
+      tree = reader->tree;
+      key = reader->key;
+    }
+    be64_encode(reader->seq, seq);
+    seqs.insert(seqs.end(), seq, seq + SEQ_LEN);
+
+    if (reader->next()) heap.push(reader);
+  }
+  flush();
+
+  clear();
+}
+
+void IndexBuilder::clear() {
+  for (auto &&path : runs_) std::remove(path.c_str());
+  runs_.clear();
+  records_.clear();
+  keys_.clear();
+  committed_ = 0;
+  total_ = 0;
+}
+
+}  // namespace ametsuchi
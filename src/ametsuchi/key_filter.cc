@@ -0,0 +1,217 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/common.h>
+#include <ametsuchi/exception.h>
+#include <ametsuchi/key_filter.h>
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace ametsuchi {
+
+static const size_t MIN_CAPACITY = 1u << 10;
+
+KeyFilter::KeyFilter(const std::string &name)
+    : name_(name),
+      counter_name_(name + "/inserts"),
+      filter_(std::make_shared<BloomFilter>()),
+      loaded_(false),
+      unsaved_(0),
+      rewrite_(false),
+      inserts_(0),
+      inserted_(false),
+      bumped_(false),
+      written_(false) {}
+
+void KeyFilter::init(MDB_cursor *tree, MDB_cursor *meta) {
+  MDB_val c_key, c_val;
+  int res;
+
+  if (loaded_) return;
+  loaded_ = true;
+
+  c_key.mv_data = (void *)counter_name_.data();
+  c_key.mv_size = counter_name_.size();
+  if ((res = mdb_cursor_get(meta, &c_key, &c_val, MDB_SET))) {
+    if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+  } else if (c_val.mv_size == sizeof(inserts_)) {
+    std::memcpy(&inserts_, c_val.mv_data, sizeof(inserts_));
+  }
+
+  // [inserts_ at the write][filter]
+  c_key.mv_data = (void *)name_.data();
+  c_key.mv_size = name_.size();
+  if ((res = mdb_cursor_get(meta, &c_key, &c_val, MDB_SET))) {
+    if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+  } else if (c_val.mv_size >= sizeof(uint64_t)) {
+    uint64_t count;
+    std::memcpy(&count, c_val.mv_data, sizeof(count));
+    auto filter = std::make_shared<BloomFilter>();
+    if (count == inserts_ &&
+        filter->deserialize(
+            static_cast<uint8_t *>(c_val.mv_data) + sizeof(count),
+            c_val.mv_size - sizeof(count))) {
+      std::atomic_store(&filter_, filter);
+      return;
+    }
+  }
+
+  // keys committed after the last write, database of the older version,
+  // or the filter is corrupted
+  rebuild(tree, MIN_CAPACITY);
+}
+
+void KeyFilter::reload(MDB_cursor *tree) {
+  loaded_ = true;
+  rebuild(tree, MIN_CAPACITY);
+  // the persisted filter misses keys of the rewritten tree
+  inserted_ = true;
+}
+
+void KeyFilter::insert(const void *data, size_t size) {
+  // size() counts distinct keys, modulo false positives
+  if (filter_->maybe_contains(data, size)) return;
+  filter_->insert(data, size);
+  unsaved_++;
+  inserted_ = true;
+}
+
+bool KeyFilter::maybe_contains(const void *data, size_t size,
+                               bool uncommitted) const {
+  // the writer thread owns the pointer
+  if (uncommitted) return filter_->maybe_contains(data, size);
+  return std::atomic_load(&filter_)->maybe_contains(data, size);
+}
+
+void KeyFilter::commit(MDB_cursor *tree, MDB_cursor *meta, bool persist) {
+  MDB_val c_key, c_val;
+  int res;
+
+  // left by a commit, which failed
+  bumped_ = false;
+  written_ = false;
+
+  // keep false positive rate, amortized O(1) per key
+  if (filter_->size() > filter_->capacity()) {
+    rebuild(tree, 2 * filter_->capacity());
+  }
+
+  // the persisted filter is stale, unless it is written below
+  uint64_t inserts = inserts_;
+  if (inserted_) {
+    inserts++;
+    c_key.mv_data = (void *)counter_name_.data();
+    c_key.mv_size = counter_name_.size();
+    c_val.mv_data = &inserts;
+    c_val.mv_size = sizeof(inserts);
+    if ((res = mdb_cursor_put(meta, &c_key, &c_val, 0))) {
+      AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+      AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+      AMETSUCHI_CRITICAL(res, EACCES);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    bumped_ = true;
+  }
+
+  // the whole filter is written, so not on every commit
+  if (!persist) return;
+  if (!rewrite_ && (unsaved_ == 0 || unsaved_ * 8 < filter_->size())) return;
+  write(meta, inserts);
+  written_ = true;
+}
+
+void KeyFilter::committed() {
+  if (bumped_) {
+    inserts_++;
+    inserted_ = false;
+  }
+  if (written_) {
+    unsaved_ = 0;
+    rewrite_ = false;
+  }
+  bumped_ = false;
+  written_ = false;
+}
+
+void KeyFilter::flush(MDB_cursor *meta) {
+  if (unsaved_ == 0 && !rewrite_) return;
+  write(meta, inserts_);
+  unsaved_ = 0;
+  rewrite_ = false;
+}
+
+void KeyFilter::drop(MDB_cursor *meta) {
+  MDB_val c_key, c_val;
+  int res;
+
+  // persisted again by the next commit()
+  rewrite_ = true;
+
+  c_key.mv_data = (void *)name_.data();
+  c_key.mv_size = name_.size();
+  if ((res = mdb_cursor_get(meta, &c_key, &c_val, MDB_SET))) {
+    if (res == MDB_NOTFOUND) return;
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  if ((res = mdb_cursor_del(meta, 0))) {
+    AMETSUCHI_CRITICAL(res, EACCES);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+}
+
+void KeyFilter::rebuild(MDB_cursor *tree, size_t capacity) {
+  MDB_val c_key, c_val;
+  int res;
+  std::vector<std::pair<const void *, size_t>> keys;
+
+  res = mdb_cursor_get(tree, &c_key, &c_val, MDB_FIRST);
+  while (res == 0) {
+    keys.emplace_back(c_key.mv_data, c_key.mv_size);
+    res = mdb_cursor_get(tree, &c_key, &c_val, MDB_NEXT_NODUP);
+  }
+  if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+
+  // readers keep the old filter until the new one is complete
+  auto filter =
+      std::make_shared<BloomFilter>(std::max(capacity, 2 * keys.size()));
+  for (auto &&key : keys) filter->insert(key.first, key.second);
+  std::atomic_store(&filter_, filter);
+  rewrite_ = true;
+}
+
+void KeyFilter::write(MDB_cursor *meta, uint64_t inserts) {
+  MDB_val c_key, c_val;
+  int res;
+
+  auto bytes = filter_->serialize();
+  bytes.insert(bytes.begin(), reinterpret_cast<uint8_t *>(&inserts),
+               reinterpret_cast<uint8_t *>(&inserts) + sizeof(inserts));
+
+  c_key.mv_data = (void *)name_.data();
+  c_key.mv_size = name_.size();
+  c_val.mv_data = bytes.data();
+  c_val.mv_size = bytes.size();
+  if ((res = mdb_cursor_put(meta, &c_key, &c_val, 0))) {
+    AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+    AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+    AMETSUCHI_CRITICAL(res, EACCES);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+}
+
+}  // namespace ametsuchi
@@ -0,0 +1,219 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/common.h>
+#include <ametsuchi/read_tx_pool.h>
+#include <atomic>
+#include <thread>
+
+namespace ametsuchi {
+
+struct ReadTx::Slot {
+  MDB_txn *txn = nullptr;
+
+  // number of live handles, transaction is reset when it drops to 0
+  size_t refs = 0;
+
+  // incremented on every renew; cursors of older generations need renew
+  uint64_t generation = 0;
+
+  // free cursors: dbi => [cursor, generation]
+  std::unordered_map<MDB_dbi, std::vector<std::pair<MDB_cursor *, uint64_t>>>
+      cursors;
+};
+
+
+ReadTx::ReadTx() : slot_(nullptr) {}
+
+ReadTx::ReadTx(Slot *slot) : slot_(slot) {}
+
+ReadTx::ReadTx(ReadTx &&other) noexcept
+    : slot_(other.slot_), cursors_(std::move(other.cursors_)) {
+  other.slot_ = nullptr;
+  other.cursors_.clear();
+}
+
+ReadTx &ReadTx::operator=(ReadTx &&other) noexcept {
+  if (this != &other) {
+    release();
+    slot_ = other.slot_;
+    cursors_ = std::move(other.cursors_);
+    other.slot_ = nullptr;
+    other.cursors_.clear();
+  }
+  return *this;
+}
+
+ReadTx::~ReadTx() { release(); }
+
+MDB_txn *ReadTx::txn() const { return slot_ ? slot_->txn : nullptr; }
+
+ReadTx ReadTx::share() const {
+  if (slot_) slot_->refs++;
+  return ReadTx(slot_);
+}
+
+MDB_cursor *ReadTx::cursor(MDB_dbi dbi) {
+  for (auto &&c : cursors_) {
+    if (c.first == dbi) return c.second;
+  }
+
+  int res;
+  MDB_cursor *cursor;
+  auto &free = slot_->cursors[dbi];
+  if (!free.empty()) {
+    // reuse cursor, renew it if it belongs to the previous transaction
+    auto c = free.back();
+    free.pop_back();
+    cursor = c.first;
+    if (c.second != slot_->generation) {
+      if ((res = mdb_cursor_renew(slot_->txn, cursor))) {
+        AMETSUCHI_CRITICAL(res, EINVAL);
+      }
+    }
+  } else if ((res = mdb_cursor_open(slot_->txn, dbi, &cursor))) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  cursors_.emplace_back(dbi, cursor);
+  return cursor;
+}
+
+void ReadTx::release() {
+  if (slot_ == nullptr) return;
+
+  for (auto &&c : cursors_) {
+    slot_->cursors[c.first].emplace_back(c.second, slot_->generation);
+  }
+  cursors_.clear();
+
+  // keep reader slot, just release the snapshot
+  if (--slot_->refs == 0) mdb_txn_reset(slot_->txn);
+  slot_ = nullptr;
+}
+
+
+struct ReadTxPool::Slots {
+  std::mutex mutex;
+  // set by the pool destructor, which closes all slots
+  bool closed = false;
+  std::unordered_map<std::thread::id, std::unique_ptr<ReadTx::Slot>> map;
+};
+
+/**
+ * Slots of the calling thread in the pools it used. They are closed when
+ * the thread exits, unless the pool is destroyed first.
+ */
+struct ReadTxPool::ThreadSlots {
+  // pool id => [slots of the pool, slot of the thread]
+  std::unordered_map<uint64_t,
+                     std::pair<std::weak_ptr<Slots>, ReadTx::Slot *>>
+      pools;
+  // the last used pool
+  uint64_t cached_id = 0;
+  ReadTx::Slot *cached = nullptr;
+
+  ~ThreadSlots() {
+    for (auto &&p : pools) {
+      auto slots = p.second.first.lock();
+      if (slots == nullptr) continue;
+
+      std::lock_guard<std::mutex> lock(slots->mutex);
+      // a handle is still alive, e.g. in thread_local storage
+      if (slots->closed || p.second.second->refs != 0) continue;
+      close_slot(*p.second.second);
+      slots->map.erase(std::this_thread::get_id());
+    }
+  }
+};
+
+static std::atomic<uint64_t> next_pool_id{1};
+
+ReadTxPool::ReadTxPool(MDB_env *env)
+    : env_(env), id_(next_pool_id++), slots_(std::make_shared<Slots>()) {}
+
+ReadTxPool::~ReadTxPool() {
+  std::lock_guard<std::mutex> lock(slots_->mutex);
+  slots_->closed = true;
+  for (auto &&s : slots_->map) close_slot(*s.second);
+  slots_->map.clear();
+}
+
+void ReadTxPool::close_slot(ReadTx::Slot &slot) {
+  for (auto &&dbi : slot.cursors) {
+    for (auto &&c : dbi.second) mdb_cursor_close(c.first);
+  }
+  if (slot.txn) mdb_txn_abort(slot.txn);
+  slot.cursors.clear();
+  slot.txn = nullptr;
+}
+
+ReadTx::Slot *ReadTxPool::thread_slot() {
+  static thread_local ThreadSlots thread_slots;
+  // pool ids are never reused, so stale entry never matches
+  if (thread_slots.cached_id == id_) return thread_slots.cached;
+
+  auto &entry = thread_slots.pools[id_];
+  if (entry.second == nullptr) {
+    // forget destroyed pools
+    for (auto it = thread_slots.pools.begin();
+         it != thread_slots.pools.end();) {
+      if (it->first != id_ && it->second.first.expired()) {
+        it = thread_slots.pools.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(slots_->mutex);
+    auto &slot = slots_->map[std::this_thread::get_id()];
+    if (!slot) slot.reset(new ReadTx::Slot());
+    entry = {slots_, slot.get()};
+  }
+
+  thread_slots.cached_id = id_;
+  thread_slots.cached = entry.second;
+  return entry.second;
+}
+
+ReadTx ReadTxPool::acquire() {
+  int res;
+  auto slot = thread_slot();
+
+  if (slot->refs == 0) {
+    if (slot->txn == nullptr) {
+      if ((res = mdb_txn_begin(env_, nullptr, MDB_RDONLY, &slot->txn))) {
+        AMETSUCHI_CRITICAL(res, MDB_PANIC);
+        AMETSUCHI_CRITICAL(res, MDB_MAP_RESIZED);
+        AMETSUCHI_CRITICAL(res, MDB_READERS_FULL);
+        AMETSUCHI_CRITICAL(res, ENOMEM);
+      }
+    } else if ((res = mdb_txn_renew(slot->txn))) {
+      AMETSUCHI_CRITICAL(res, MDB_PANIC);
+      AMETSUCHI_CRITICAL(res, MDB_BAD_RSLOT);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    slot->generation++;
+  }
+
+  slot->refs++;
+  return ReadTx(slot);
+}
+
+bool ReadTxPool::pinned() { return thread_slot()->refs != 0; }
+
+}  // namespace ametsuchi
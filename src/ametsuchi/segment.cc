@@ -0,0 +1,247 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/common.h>
+#include <ametsuchi/exception.h>
+#include <ametsuchi/segment.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace ametsuchi {
+
+static const uint64_t SEGMENT_MAGIC = 0x31304745534d41ull;  // "AMSEG01"
+static const size_t FOOTER_SIZE = 4 * sizeof(uint64_t);
+static const char SEGMENT_SUFFIX[] = ".seg";
+static const char TMP_SUFFIX[] = ".tmp";
+
+#define SEGMENT_CRITICAL(what, path)                                      \
+  {                                                                       \
+    console->critical("{} {}: {}", what, path, std::strerror(errno));     \
+    throw exception::InternalError::FATAL;                                \
+  }
+
+static inline uint64_t load64(const uint8_t *p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline size_t padded(size_t size) { return (size + 7) & ~size_t(7); }
+
+static bool ends_with(const std::string &s, const char *suffix) {
+  auto n = std::strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// directory of \p path, which may end with '/'
+static std::string parent(std::string path) {
+  while (path.size() > 1 && path.back() == '/') path.pop_back();
+  auto slash = path.rfind('/');
+  if (slash == std::string::npos) return ".";
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// a created or renamed entry survives a crash only after this
+static void sync_dir(const std::string &dir) {
+  int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) SEGMENT_CRITICAL("can not open directory", dir);
+  if (fsync(fd)) {
+    ::close(fd);
+    SEGMENT_CRITICAL("can not sync directory", dir);
+  }
+  ::close(fd);
+}
+
+
+Segment::Segment(const std::string &path)
+    : path_(path), data_(nullptr), size_(0), first_(0), count_(0) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) SEGMENT_CRITICAL("can not open segment", path);
+
+  struct stat st;
+  if (fstat(fd, &st)) {
+    ::close(fd);
+    SEGMENT_CRITICAL("can not stat segment", path);
+  }
+  size_ = st.st_size;
+  if (size_ < FOOTER_SIZE) {
+    ::close(fd);
+    throw exception::Exception(("not a sealed segment: " + path).c_str());
+  }
+
+  auto data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) SEGMENT_CRITICAL("can not map segment", path);
+  data_ = static_cast<const uint8_t *>(data);
+
+  auto footer = data_ + size_ - FOOTER_SIZE;
+  first_ = load64(footer);
+  count_ = load64(footer + 8);
+  auto index_offset = load64(footer + 16);
+  auto entries = (count_ + SEGMENT_INDEX_STEP - 1) / SEGMENT_INDEX_STEP;
+  if (load64(footer + 24) != SEGMENT_MAGIC || count_ == 0 ||
+      index_offset + entries * sizeof(uint64_t) != size_ - FOOTER_SIZE) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+    throw exception::Exception(("not a sealed segment: " + path).c_str());
+  }
+  index_ = data_ + index_offset;
+}
+
+Segment::~Segment() { munmap(const_cast<uint8_t *>(data_), size_); }
+
+bool Segment::get(uint64_t seq, MDB_val &val) const {
+  if (seq < first_ || seq > last()) return false;
+
+  auto n = seq - first_;
+  auto p = data_ + load64(index_ + n / SEGMENT_INDEX_STEP * sizeof(uint64_t));
+  for (n %= SEGMENT_INDEX_STEP; n > 0; n--) {
+    p += sizeof(uint64_t) + padded(load64(p));
+  }
+
+  val.mv_size = load64(p);
+  val.mv_data = const_cast<uint8_t *>(p + sizeof(uint64_t));
+  return true;
+}
+
+
+SegmentWriter::SegmentWriter(const std::string &path, uint64_t first)
+    : path_(path), file_(nullptr), first_(first), count_(0), offset_(0) {
+  file_ = std::fopen((path_ + TMP_SUFFIX).c_str(), "wb");
+  if (file_ == nullptr) SEGMENT_CRITICAL("can not create segment", path_);
+}
+
+SegmentWriter::~SegmentWriter() {
+  if (file_ == nullptr) return;
+  // not sealed
+  std::fclose(file_);
+  std::remove((path_ + TMP_SUFFIX).c_str());
+}
+
+void SegmentWriter::write(const void *data, size_t size) {
+  if (std::fwrite(data, 1, size, file_) != size) {
+    SEGMENT_CRITICAL("can not write segment", path_);
+  }
+  offset_ += size;
+}
+
+void SegmentWriter::append(const MDB_val &val) {
+  static const uint8_t zeros[8] = {};
+
+  if (count_ % SEGMENT_INDEX_STEP == 0) index_.push_back(offset_);
+  uint64_t size = val.mv_size;
+  write(&size, sizeof(size));
+  write(val.mv_data, val.mv_size);
+  write(zeros, padded(val.mv_size) - val.mv_size);
+  count_++;
+}
+
+void SegmentWriter::seal() {
+  uint64_t footer[] = {first_, count_, offset_, SEGMENT_MAGIC};
+  write(index_.data(), index_.size() * sizeof(uint64_t));
+  write(footer, sizeof(footer));
+
+  if (std::fflush(file_) || fsync(fileno(file_))) {
+    SEGMENT_CRITICAL("can not flush segment", path_);
+  }
+  std::fclose(file_);
+  file_ = nullptr;
+
+  if (std::rename((path_ + TMP_SUFFIX).c_str(), path_.c_str())) {
+    SEGMENT_CRITICAL("can not seal segment", path_);
+  }
+  sync_dir(parent(path_));
+}
+
+
+SegmentSet::SegmentSet() : list_(std::make_shared<List>()), last_(0) {}
+
+void SegmentSet::open(const std::string &dir, uint64_t sealed_seq) {
+  dir_ = dir;
+
+  auto list = std::make_shared<List>();
+  auto d = opendir(dir_.c_str());
+  if (d != nullptr) {
+    while (auto entry = readdir(d)) {
+      std::string name = entry->d_name;
+      auto path = dir_ + name;
+      if (ends_with(name, TMP_SUFFIX)) {
+        std::remove(path.c_str());
+      } else if (ends_with(name, SEGMENT_SUFFIX)) {
+        auto segment = std::make_shared<const Segment>(path);
+        if (segment->last() <= sealed_seq) {
+          list->push_back(segment);
+        } else {
+          // sealed, but the commit which moved the range was not durable
+          std::remove(path.c_str());
+        }
+      }
+    }
+    closedir(d);
+  }
+
+  std::sort(list->begin(), list->end(),
+            [](const std::shared_ptr<const Segment> &a,
+               const std::shared_ptr<const Segment> &b) {
+              return a->first() < b->first();
+            });
+  last_ = list->empty() ? 0 : list->back()->last();
+  std::atomic_store(&list_, std::shared_ptr<const List>(list));
+}
+
+std::string SegmentSet::path(uint64_t first) const {
+  if (mkdir(dir_.c_str(), 0700) == 0) {
+    sync_dir(parent(dir_));
+  } else if (errno != EEXIST) {
+    SEGMENT_CRITICAL("can not create directory", dir_);
+  }
+  char name[32];
+  std::snprintf(name, sizeof(name), "%020llu%s",
+                static_cast<unsigned long long>(first), SEGMENT_SUFFIX);
+  return dir_ + name;
+}
+
+void SegmentSet::add(std::shared_ptr<const Segment> segment) {
+  auto list = std::make_shared<List>(*std::atomic_load(&list_));
+  auto last = segment->last();
+  list->push_back(std::move(segment));
+  std::atomic_store(&list_, std::shared_ptr<const List>(list));
+  // seqs up to last_ are routed to the list, so it is published first
+  last_ = last;
+}
+
+bool SegmentSet::get(uint64_t seq, MDB_val &val) const {
+  // hot transactions do not touch the list
+  if (seq > last_.load()) return false;
+
+  auto list = std::atomic_load(&list_);
+  auto it = std::upper_bound(
+      list->begin(), list->end(), seq,
+      [](uint64_t seq, const std::shared_ptr<const Segment> &segment) {
+        return seq < segment->first();
+      });
+  if (it == list->begin()) return false;
+  return (*--it)->get(seq, val);
+}
+
+size_t SegmentSet::size() const { return std::atomic_load(&list_)->size(); }
+
+}  // namespace ametsuchi
@@ -0,0 +1,179 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/snapshot.h>
+
+namespace ametsuchi {
+
+Snapshot::Snapshot(ReadTx &&rtx, TxStore &tx_store, WSV &wsv,
+                   std::atomic<size_t> &live)
+    : rtx_(std::move(rtx)), tx_store_(tx_store), wsv_(wsv), live_(&live) {
+  live++;
+}
+
+
+std::vector<AM_val> Snapshot::accountGetAllAssets(
+    const flatbuffers::String *pubKey) {
+  return wsv_.accountGetAllAssets(pubKey, &rtx_);
+}
+
+size_t Snapshot::accountCountAssets(const flatbuffers::String *pubKey) {
+  return wsv_.accountCountAssets(pubKey, &rtx_);
+}
+
+
+AM_val Snapshot::accountGetAsset(const flatbuffers::String *pubKey,
+                                 const flatbuffers::String *ledger_name,
+                                 const flatbuffers::String *domain_name,
+                                 const flatbuffers::String *asset_name) {
+  return wsv_.accountGetAsset(pubKey, ledger_name, domain_name, asset_name,
+                              &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAssetTransferBySender(
+    const flatbuffers::String *senderKey) {
+  return tx_store_.getAssetTransferBySender(senderKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAssetTransferByReceiver(
+    const flatbuffers::String *receiverKey) {
+  return tx_store_.getAssetTransferByReceiver(receiverKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAssetCreateByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAssetCreateByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAssetAddByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAssetAddByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAssetRemoveByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAssetRemoveByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAssetTransferByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAssetTransferByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAccountAddByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAccountAddByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAccountAddSignByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAccountAddSignByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAccountRemoveByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAccountRemoveByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAccountRemoveSignByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAccountRemoveSignByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getAccountSetUseKeysByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getAccountSetUseKeysByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getPeerAddByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getPeerAddByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getPeerChangeTrustByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getPeerChangeTrustByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getPeerRemoveByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getPeerRemoveByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getPeerSetActiveByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getPeerSetActiveByKey(pubKey, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getPeerSetTrustByKey(
+    const flatbuffers::String *pubKey) {
+  return tx_store_.getPeerSetTrustByKey(pubKey, &rtx_);
+}
+
+AM_val Snapshot::getTxByHash(const merkle::hash_t &hash) {
+  return tx_store_.getTxByHash(hash, &rtx_);
+}
+
+bool Snapshot::getReceipt(const merkle::hash_t &hash,
+                          TxStore::Receipt &receipt) {
+  return tx_store_.getReceipt(hash, receipt, &rtx_);
+}
+
+AM_val Snapshot::getAttachment(const merkle::hash_t &hash) {
+  return tx_store_.getAttachment(hash, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getTxByTime(uint64_t from, uint64_t to) {
+  return tx_store_.getTxByTime(from, to, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getTxByKeyTime(const flatbuffers::String *key,
+                                             uint64_t from, uint64_t to) {
+  return tx_store_.getTxByKeyTime(key, from, to, &rtx_);
+}
+
+std::vector<std::vector<AM_val>> Snapshot::getTxByKeys(
+    TxStore::Tree index, const std::vector<const flatbuffers::String *> &keys) {
+  return tx_store_.getTxByKeys(index, keys, &rtx_);
+}
+
+size_t Snapshot::countTxByKey(TxStore::Tree index,
+                              const flatbuffers::String *key) {
+  return tx_store_.countTxByKey(index, key, &rtx_);
+}
+
+bool Snapshot::hasTxByKey(TxStore::Tree index, const flatbuffers::String *key) {
+  return tx_store_.hasTxByKey(index, key, &rtx_);
+}
+
+AM_val Snapshot::getBlockHeader(uint64_t height) {
+  return tx_store_.getBlockHeader(height, &rtx_);
+}
+
+std::vector<AM_val> Snapshot::getBlockTxs(uint64_t height) {
+  return tx_store_.getBlockTxs(height, &rtx_);
+}
+
+TxCursor Snapshot::streamTxByKey(TxStore::Tree index,
+                                 const flatbuffers::String *key, size_t limit,
+                                 size_t offset, uint64_t token,
+                                 bool newest_first) {
+  return tx_store_.streamTxByKey(index, key, rtx_.share(), limit, offset,
+                                 token, newest_first);
+}
+
+}  // namespace ametsuchi
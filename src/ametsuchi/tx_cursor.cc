@@ -0,0 +1,153 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/tx_cursor.h>
+#include <limits>
+
+namespace ametsuchi {
+
+TxCursor::TxCursor(ReadTx &&rtx, MDB_dbi index, MDB_dbi tx_store,
+                   MDB_dbi attachments, const flatbuffers::String *key,
+                   size_t limit, size_t offset, uint64_t token,
+                   bool newest_first, const Codec *codec,
+                   const SegmentSet *cold)
+    : rtx_(std::move(rtx)),
+      index_(nullptr),
+      txs_(nullptr),
+      attachments_(attachments),
+      codec_(codec),
+      cold_(cold),
+      step_(newest_first ? MDB_PREV_DUP : MDB_NEXT_DUP),
+      left_(limit ? limit : std::numeric_limits<size_t>::max()),
+      token_(token),
+      valid_(false) {
+  int res;
+
+  if ((res = mdb_cursor_open(rtx_.txn(), index, &index_))) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  if ((res = mdb_cursor_open(rtx_.txn(), tx_store, &txs_))) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  key_.mv_data = (void *)key->data();
+  key_.mv_size = key->size();
+
+  res = seek(token);
+
+  // skipped transactions are not read from tx_store
+  for (; res == 0 && offset > 0; offset--) {
+    res = mdb_cursor_get(index_, &key_, &seq_, step_);
+  }
+
+  load(res);
+}
+
+int TxCursor::seek(uint64_t token) {
+  int res;
+  uint8_t seq[SEQ_LEN];
+
+  if (token == 0) {
+    res = mdb_cursor_get(index_, &key_, &seq_, MDB_SET);
+    if (res == 0 && step_ == MDB_PREV_DUP) {
+      res = mdb_cursor_get(index_, &key_, &seq_, MDB_LAST_DUP);
+    }
+    return res;
+  }
+
+  // position at the first transaction not older than the token
+  be64_encode(token, seq);
+  seq_.mv_data = seq;
+  seq_.mv_size = SEQ_LEN;
+  res = mdb_cursor_get(index_, &key_, &seq_, MDB_GET_BOTH_RANGE);
+
+  if (step_ == MDB_NEXT_DUP) {
+    // step over the token itself
+    if (res == 0 && be64_decode(seq_.mv_data) == token) {
+      res = mdb_cursor_get(index_, &key_, &seq_, MDB_NEXT_DUP);
+    }
+    return res;
+  }
+
+  if (res == 0) {
+    return mdb_cursor_get(index_, &key_, &seq_, MDB_PREV_DUP);
+  }
+  if (res == MDB_NOTFOUND) {
+    // all transactions of the key are older than the token
+    res = mdb_cursor_get(index_, &key_, &seq_, MDB_SET);
+    if (res == 0) res = mdb_cursor_get(index_, &key_, &seq_, MDB_LAST_DUP);
+  }
+  return res;
+}
+
+TxCursor::TxCursor(TxCursor &&other) noexcept
+    : rtx_(std::move(other.rtx_)),
+      index_(other.index_),
+      txs_(other.txs_),
+      attachments_(other.attachments_),
+      key_(other.key_),
+      seq_(other.seq_),
+      tx_(other.tx_),
+      codec_(other.codec_),
+      cold_(other.cold_),
+      step_(other.step_),
+      left_(other.left_),
+      token_(other.token_),
+      valid_(other.valid_) {
+  other.index_ = nullptr;
+  other.txs_ = nullptr;
+  other.valid_ = false;
+}
+
+TxCursor::~TxCursor() {
+  if (index_) mdb_cursor_close(index_);
+  if (txs_) mdb_cursor_close(txs_);
+}
+
+void TxCursor::next() {
+  if (!valid_) return;
+  load(mdb_cursor_get(index_, &key_, &seq_, step_));
+}
+
+void TxCursor::load(int res) {
+  valid_ = false;
+
+  if (res != 0) {
+    if (res == MDB_NOTFOUND) return;
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  if (left_ == 0) return;
+
+  // tx_store is keyed by native size_t
+  size_t seq = be64_decode(seq_.mv_data);
+  if (cold_ == nullptr || !cold_->get(seq, tx_)) {
+    MDB_val tx_key;
+    tx_key.mv_data = &seq;
+    tx_key.mv_size = sizeof(seq);
+    if ((res = mdb_cursor_get(txs_, &tx_key, &tx_, MDB_SET))) {
+      AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+  }
+
+  token_ = seq;
+
+  left_--;
+  valid_ = true;
+}
+
+}  // namespace ametsuchi
@@ -15,16 +15,116 @@
  * limitations under the License.
  */
 
+#include <ametsuchi/attachment.h>
 #include <ametsuchi/exception.h>
 #include <asset_generated.h>
+#include <block_generated.h>
 #include <transaction_generated.h>
 #include <ametsuchi/tx_store.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
 
 namespace ametsuchi {
 
+// [pubkey] => [autoincrement_key] (DUP)
+static const uint32_t INDEX_FLAGS = MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE;
 
-merkle::hash_t TxStore::append(const std::vector<uint8_t> *blob) {
-  auto tx = flatbuffers::GetRoot<iroha::Transaction>(blob->data());
+
+// [code][reason][height][autoincrement_key], big-endian
+static const size_t RECEIPT_LEN = 2 + 2 * SEQ_LEN;
+
+// in the order of TxStore::Tree
+static const TreeDef tx_store_trees[] = {
+    // autoincrement_key => tx (NODUP)
+    {"tx_store", MDB_CREATE | MDB_INTEGERKEY, nullptr},
+    {"merkle_tree", MDB_CREATE | MDB_INTEGERKEY, nullptr},
+    // tx hash => autoincrement_key (NODUP)
+    {"tx_hash", MDB_CREATE, nullptr},
+    // height => BlockHeader (NODUP)
+    {"blocks", MDB_CREATE | MDB_INTEGERKEY, nullptr},
+    // name => value, e.g. "dict/tx_store" => compression dictionary
+    {"meta", MDB_CREATE, nullptr},
+    // [timestamp] => [autoincrement_key] (DUP)
+    {"tx_time", INDEX_FLAGS, nullptr},
+    // [pubkey size][creator pubkey][timestamp] => [autoincrement_key] (DUP)
+    {"creator_time", INDEX_FLAGS, nullptr},
+    // hash of data => Attachment.data (NODUP)
+    {"attachments", MDB_CREATE, nullptr},
+    // hash => receipt of the transaction (NODUP)
+    {"receipts", MDB_CREATE, nullptr},
+    {"index_asset_create", INDEX_FLAGS, nullptr},
+    {"index_asset_add", INDEX_FLAGS, nullptr},
+    {"index_asset_remove", INDEX_FLAGS, nullptr},
+    {"index_asset_transfer", INDEX_FLAGS, nullptr},
+    {"index_transfer_sender", INDEX_FLAGS, nullptr},
+    {"index_transfer_receiver", INDEX_FLAGS, nullptr},
+    {"index_account_add", INDEX_FLAGS, nullptr},
+    {"index_account_add_sign", INDEX_FLAGS, nullptr},
+    {"index_account_remove", INDEX_FLAGS, nullptr},
+    {"index_account_remove_sign", INDEX_FLAGS, nullptr},
+    {"index_account_set_use_keys", INDEX_FLAGS, nullptr},
+    {"index_peer_add", INDEX_FLAGS, nullptr},
+    {"index_peer_change_trust", INDEX_FLAGS, nullptr},
+    {"index_peer_remove", INDEX_FLAGS, nullptr},
+    {"index_peer_set_active", INDEX_FLAGS, nullptr},
+    {"index_peer_set_trust", INDEX_FLAGS, nullptr},
+};
+static_assert(sizeof(tx_store_trees) / sizeof(TreeDef) == TxStore::TREES_TOTAL,
+              "every TxStore::Tree must be defined");
+
+
+static const flatbuffers::String *creator(const iroha::Transaction *tx) {
+  return tx->creatorPubKey();
+}
+
+static const flatbuffers::String *sender(const iroha::Transaction *tx) {
+  return tx->command_as_AssetTransfer()->sender();
+}
+
+static const flatbuffers::String *receiver(const iroha::Transaction *tx) {
+  return tx->command_as_AssetTransfer()->receiver();
+}
+
+// registry of secondary indexes: [key(tx)] => [autoincrement_key]
+static const TxStore::IndexDef tx_store_indexes[] = {
+    {TxStore::INDEX_ASSET_CREATE, iroha::Command::AssetCreate, creator},
+    {TxStore::INDEX_ASSET_ADD, iroha::Command::AssetAdd, creator},
+    {TxStore::INDEX_ASSET_REMOVE, iroha::Command::AssetRemove, creator},
+    {TxStore::INDEX_ASSET_TRANSFER, iroha::Command::AssetTransfer, creator},
+    {TxStore::INDEX_TRANSFER_SENDER, iroha::Command::AssetTransfer, sender},
+    {TxStore::INDEX_TRANSFER_RECEIVER, iroha::Command::AssetTransfer,
+     receiver},
+    {TxStore::INDEX_ACCOUNT_ADD, iroha::Command::AccountAdd, creator},
+    {TxStore::INDEX_ACCOUNT_ADD_SIGN, iroha::Command::AccountAddSignatory,
+     creator},
+    {TxStore::INDEX_ACCOUNT_REMOVE, iroha::Command::AccountRemove, creator},
+    {TxStore::INDEX_ACCOUNT_REMOVE_SIGN,
+     iroha::Command::AccountRemoveSignatory, creator},
+    {TxStore::INDEX_ACCOUNT_SET_USE_KEYS, iroha::Command::AccountSetUseKeys,
+     creator},
+    {TxStore::INDEX_PEER_ADD, iroha::Command::PeerAdd, creator},
+    {TxStore::INDEX_PEER_CHANGE_TRUST, iroha::Command::PeerChangeTrust,
+     creator},
+    {TxStore::INDEX_PEER_REMOVE, iroha::Command::PeerRemove, creator},
+    {TxStore::INDEX_PEER_SET_ACTIVE, iroha::Command::PeerSetActive, creator},
+    {TxStore::INDEX_PEER_SET_TRUST, iroha::Command::PeerSetTrust, creator},
+};
+
+
+merkle::hash_t TxStore::append(const DecodedTx &decoded) {
+  auto tx = decoded.tx;
+
+  auto command = static_cast<size_t>(tx->command_type());
+  if (command >= known_.size() || !known_[command]) {
+    throw exception::InvalidTransaction::WRONG_COMMAND;
+  }
+
+  // 0. reject already stored transaction, O(1) for new hashes
+  if (reject_duplicates_ && has_hash(decoded.hash)) {
+    throw exception::InvalidTransaction::TX_EXISTS;
+  }
 
   MDB_val c_key, c_val;
   int res;
@@ -32,10 +132,18 @@ merkle::hash_t TxStore::append(const std::vector<uint8_t> *blob) {
   {
     c_key.mv_data = &(++tx_store_total);
     c_key.mv_size = sizeof(tx_store_total);
-    c_val.mv_data = (void *)blob->data();
-    c_val.mv_size = blob->size();
+    c_val.mv_data = (void *)decoded.blob;
+    c_val.mv_size = decoded.size;
 
-    if ((res = mdb_cursor_put(trees_.at("tx_store").second, &c_key, &c_val,
+    // large attachment does not bloat pages of tx_store
+    std::vector<uint8_t> cut;
+    if (split_attachment(decoded, cut)) {
+      c_val.mv_data = cut.data();
+      c_val.mv_size = cut.size();
+    }
+    c_val = encode(TX_STORE, c_val);
+
+    if ((res = mdb_cursor_put(trees_[TX_STORE].second, &c_key, &c_val,
                               MDB_NOOVERWRITE | MDB_APPEND)) != 0) {
       AMETSUCHI_CRITICAL(res, MDB_KEYEXIST);
       AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
@@ -45,142 +153,152 @@ merkle::hash_t TxStore::append(const std::vector<uint8_t> *blob) {
     }
   }
 
-  // 2. insert record into index depending on the command
-  {
-    auto creator = tx->creatorPubKey();
-    switch (tx->command_type()) {
-      case iroha::Command::AssetCreate:
-        put_tx_into_tree_by_key(trees_.at("index_asset_create").second, creator,
-                                tx_store_total);
-        break;
-      case iroha::Command::AssetAdd:
-        put_tx_into_tree_by_key(trees_.at("index_asset_add").second, creator,
-                                tx_store_total);
-      case iroha::Command::AssetRemove:
-        put_tx_into_tree_by_key(trees_.at("index_asset_remove").second, creator,
-                                tx_store_total);
-      case iroha::Command::AssetTransfer:
-        put_tx_into_tree_by_key(trees_.at("index_asset_transfer").second,
-                                creator, tx_store_total);
-        break;
-      case iroha::Command::AccountAdd:
-        put_tx_into_tree_by_key(trees_.at("index_account_add").second, creator,
-                                tx_store_total);
-        break;
-      case iroha::Command::AccountAddSignatory:
-        put_tx_into_tree_by_key(trees_.at("index_account_add_sign").second,
-                                creator, tx_store_total);
-        break;
-      case iroha::Command::AccountRemove:
-        put_tx_into_tree_by_key(trees_.at("index_account_remove").second,
-                                creator, tx_store_total);
-        break;
-      case iroha::Command::AccountRemoveSignatory:
-        put_tx_into_tree_by_key(trees_.at("index_account_remove_sign").second,
-                                creator, tx_store_total);
-        break;
-      case iroha::Command::AccountSetUseKeys:
-        put_tx_into_tree_by_key(trees_.at("index_account_set_use_keys").second,
-                                creator, tx_store_total);
-        break;
-      case iroha::Command::PeerAdd:
-        put_tx_into_tree_by_key(trees_.at("index_peer_add").second, creator,
-                                tx_store_total);
-        break;
-      case iroha::Command::PeerChangeTrust:
-        put_tx_into_tree_by_key(trees_.at("index_peer_change_trust").second,
-                                creator, tx_store_total);
-        break;
-      case iroha::Command::PeerRemove:
-        put_tx_into_tree_by_key(trees_.at("index_peer_remove").second, creator,
-                                tx_store_total);
-        break;
-      case iroha::Command::PeerSetActive:
-        put_tx_into_tree_by_key(trees_.at("index_peer_set_active").second,
-                                creator, tx_store_total);
-        break;
-      case iroha::Command::PeerSetTrust:
-        put_tx_into_tree_by_key(trees_.at("index_peer_set_trust").second,
-                                creator, tx_store_total);
-        break;
-      default:
-        throw exception::InvalidTransaction::WRONG_COMMAND;
-    }
-  }
-
-  // 3. insert record into index_transfer_sender and index_transfer_receiver
-  if (tx->command_type() == iroha::Command::AssetTransfer) {
-    // update index_transfer_sender
-    auto cmd = tx->command_as_AssetTransfer();
-    c_key.mv_data = (void *)(cmd->sender()->data());
-    c_key.mv_size = cmd->sender()->size();
-
-    if ((res = mdb_cursor_put(trees_.at("index_transfer_sender").second, &c_key,
-                              &c_val, 0)) != 0) {
-      AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
-      AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
-      AMETSUCHI_CRITICAL(res, EACCES);
-      AMETSUCHI_CRITICAL(res, EINVAL);
-    }
-
-    // update index_transfer_receiver
-    c_key.mv_data = (void *)(cmd->receiver()->data());
-    c_key.mv_size = cmd->receiver()->size();
+  put_hash(decoded.hash);
+  put_time(tx, tx_store_total);
+  put_receipt(decoded.hash, {iroha::Code::COMMIT,
+                             static_cast<exception::InvalidTransaction>(0),
+                             block_height_ + 1, tx_store_total});
 
-    if ((res = mdb_cursor_put(trees_.at("index_transfer_receiver").second,
-                              &c_key, &c_val, 0)) != 0) {
-      AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
-      AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
-      AMETSUCHI_CRITICAL(res, EACCES);
-      AMETSUCHI_CRITICAL(res, EINVAL);
+  // 2. insert record into every enabled index of the command
+  for (auto index : indexes_[command]) {
+    auto key = index->key(tx);
+    if (key == nullptr) continue;
+    if (bulk_ != nullptr) {
+      // written in key order by end_bulk_load()
+      bulk_->add(index->tree, key->data(), key->size(), tx_store_total);
+    } else {
+      put_tx_into_tree_by_key(trees_[index->tree].second, key, tx_store_total);
     }
+    key_filters_[index->tree]->insert(key->data(), key->size());
   }
 
   // 4. Push to merkle tree
-  merkle::hash_t h;
-  assert(tx->hash()->size() == merkle::HASH_LEN);
-  std::copy(tx->hash()->begin(), tx->hash()->end(), &h[0]);
-  merkleTree_.push(h);
+  merkleTree_.push(decoded.hash);
+  savepoint_pushes_++;
   return merkleTree_.root();
 }
 
 void TxStore::init(MDB_txn *append_tx) {
   append_tx_ = append_tx;
 
-  // autoincrement_key => tx (NODUP)
-  create_new_tree(append_tx_, "tx_store", MDB_CREATE | MDB_INTEGERKEY);
-  create_new_tree(append_tx_, "merkle_tree", MDB_CREATE | MDB_INTEGERKEY);
+  init_btrees(append_tx_, tx_store_trees, trees_);
+
+  load_format();
+  load_segments();
+  load_stale();
+  if (format_ < FORMAT_VERSION) stale_ = true;
+  for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+    if (key_filters_[tree] == nullptr) continue;
+    key_filters_[tree]->init(trees_[tree].second, trees_[META].second);
+  }
+  set_tx_total();
+  set_block_height();
+  block_begin_ = tx_store_total + 1;
+  load_dictionaries();
+}
+
+void TxStore::close_cursors() { ametsuchi::close_cursors(trees_); }
+
+void TxStore::flush_filters() {
+  // persisted at the end of bulk load
+  if (stale_.load()) return;
+  for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+    if (key_filters_[tree] == nullptr) continue;
+    key_filters_[tree]->flush(trees_[META].second);
+  }
+}
+
+void TxStore::open_cursors(MDB_txn *txn) {
+  append_tx_ = txn;
+  ametsuchi::open_cursors(txn, trees_);
+}
+
+void TxStore::savepoint() {
+  savepoint_total_ = tx_store_total;
+  savepoint_pushes_ = 0;
+}
 
-  auto name_set = {
-      "index_asset_create",         "index_asset_add",
-      "index_asset_remove",         "index_asset_transfer",
-      "index_transfer_sender",      "index_transfer_receiver",
-      "index_account_add",          "index_account_add_sign",
-      "index_account_remove",       "index_account_remove_sign",
-      "index_account_set_use_keys", "index_peer_add",
-      "index_peer_change_trust",    "index_peer_remove",
-      "index_peer_set_active",      "index_peer_set_trust",
-  };
+void TxStore::rollback_savepoint() {
+  tx_store_total = savepoint_total_;
+  if (bulk_ != nullptr) bulk_->truncate(tx_store_total);
 
-  // TxStore trees: [pubkey] => [autoincrement_key] (DUP)
-  for (auto name : name_set) {
-    create_new_tree(append_tx_, name, MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE);
+  if (savepoint_pushes_ <= merkleTree_.max_rollback()) {
+    merkleTree_.rollback(savepoint_pushes_);
+  } else {
+    // the only leaf of the very first tree can not be rolled back
+    merkleTree_ = merkle::MerkleTree(merkle_leaves_);
   }
+  savepoint_pushes_ = 0;
+}
 
-  set_tx_total();
-  assert(get_trees_total() == trees_.size());
+void TxStore::rollback() {
+  block_signatures_.clear();
+  savepoint_pushes_ = 0;
+  if (bulk_ != nullptr) bulk_->truncate(tx_store_total);
+  merkleTree_ = merkle::MerkleTree(merkle_leaves_);
+  init_merkle_tree();
 }
 
-void TxStore::close_cursors() {
-  for (auto &&e : trees_) {
-    MDB_cursor *cursor = e.second.second;
-    if (cursor != nullptr) {
-      mdb_cursor_close(cursor);
+TxStore::TxStore(size_t merkle_leaves, const std::vector<Tree> &disabled,
+                 bool reject_duplicates, const std::vector<CodecDef> &codecs,
+                 size_t attachment_threshold)
+    : tx_store_total(0),
+      trees_(),
+      merkleTree_(merkle_leaves),
+      merkle_leaves_(merkle_leaves),
+      savepoint_total_(0),
+      savepoint_pushes_(0),
+      reject_duplicates_(reject_duplicates),
+      block_height_(0),
+      block_begin_(1),
+      hot_blocks_(0),
+      segment_blocks_(0),
+      cold_height_(0),
+      sealed_height_(0),
+      dropped_height_(0),
+      cold_loaded_(false),
+      stale_(false),
+      reload_filters_(false),
+      format_(FORMAT_VERSION),
+      codec_defs_(codecs),
+      attachment_threshold_(attachment_threshold) {
+  // compressed values are readable whatever codec is configured now
+  codecs_[TX_STORE].reset(new Codec());
+  codecs_[BLOCKS].reset(new Codec());
+  train_at_.fill(0);
+  for (auto &&def : codecs) {
+    if (def.tree != TX_STORE && def.tree != BLOCKS) {
+      throw exception::Exception("codec is supported for tx_store and blocks");
     }
+    codecs_[def.tree].reset(new Codec(def.type, def.level));
+    train_at_[def.tree] = def.dict_samples;
+  }
+
+  enabled_.fill(true);
+  for (auto tree : disabled) {
+    if (!is_index(tree)) throw exception::Exception("not an index tree");
+    enabled_[tree] = false;
+  }
+
+  for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+    if (!is_index(static_cast<Tree>(tree)) || !enabled_[tree]) continue;
+    key_filters_[tree].reset(
+        new KeyFilter(std::string("filter/") + tx_store_trees[tree].name));
   }
+
+  known_.fill(false);
+  for (auto &&index : tx_store_indexes) {
+    auto command = static_cast<size_t>(index.command);
+    known_[command] = true;
+    if (enabled_[index.tree]) indexes_[command].push_back(&index);
+  }
+}
+
+bool TxStore::is_index(Tree tree) {
+  return tree >= INDEX_ASSET_CREATE && tree < TREES_TOTAL;
 }
 
-TxStore::TxStore(size_t merkle_leaves) : merkleTree_(merkle_leaves) {}
+const char *TxStore::name(Tree tree) { return tx_store_trees[tree].name; }
 
 TxStore::~TxStore() = default;
 
@@ -188,11 +306,12 @@ void TxStore::set_tx_total() {
   MDB_val c_key, c_val;
   int res;
 
-  MDB_cursor *cursor = trees_.at("tx_store").second;
+  MDB_cursor *cursor = trees_[TX_STORE].second;
 
   if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_LAST)) != 0) {
     if (res == MDB_NOTFOUND) {
-      tx_store_total = 0u;
+      // all transactions may be in segments
+      tx_store_total = cold_.last();
     }
     AMETSUCHI_CRITICAL(res, EINVAL);
   } else {
@@ -201,28 +320,35 @@ void TxStore::set_tx_total() {
 }
 void TxStore::close_dbi(MDB_env *env) {
   for (auto &&it : trees_) {
-    auto dbi = it.second.first;
+    auto dbi = it.first;
     mdb_dbi_close(env, dbi);
   }
 }
-uint32_t TxStore::get_trees_total() {
-  TX_STORE_TREES_TOTAL = 18;
-  return TX_STORE_TREES_TOTAL;
-}
+uint32_t TxStore::get_trees_total() { return TREES_TOTAL; }
 
 
 void TxStore::put_tx_into_tree_by_key(MDB_cursor *cursor,
                                       const flatbuffers::String *acc_pub_key,
                                       size_t &tx_store_total) {
+  put_seq(cursor, acc_pub_key->data(), acc_pub_key->size(), tx_store_total);
+}
+
+void TxStore::put_seq(MDB_cursor *cursor, const void *key, size_t size,
+                      size_t seq) {
   MDB_val c_key, c_val;
   int res;
+  uint8_t value[SEQ_LEN];
 
-  c_key.mv_data = (void *)(acc_pub_key->data());
-  c_key.mv_size = acc_pub_key->size();
-  c_val.mv_data = &tx_store_total;
-  c_val.mv_size = sizeof(tx_store_total);
+  be64_encode(seq, value);
+
+  c_key.mv_data = (void *)key;
+  c_key.mv_size = size;
+  c_val.mv_data = value;
+  c_val.mv_size = SEQ_LEN;
 
-  if ((res = mdb_cursor_put(cursor, &c_key, &c_val, 0)) != 0) {
+  // seq is the largest among values of the key
+  if ((res = mdb_cursor_put(cursor, &c_key, &c_val, MDB_APPENDDUP)) != 0) {
+    AMETSUCHI_CRITICAL(res, MDB_KEYEXIST);
     AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
     AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
     AMETSUCHI_CRITICAL(res, EACCES);
@@ -231,66 +357,95 @@ void TxStore::put_tx_into_tree_by_key(MDB_cursor *cursor,
 }
 
 
-std::vector<AM_val> TxStore::getTxByKey(const std::string &tree_name,
+std::vector<AM_val> TxStore::getTxByKey(Tree tree,
                                         const flatbuffers::String *pubKey,
-                                        bool uncommitted, MDB_env *env) {
-  MDB_val c_key, c_val;
-  MDB_cursor *cursor;
-  MDB_txn *tx;
-  int res;
+                                        ReadTx *rtx) {
+  MDB_cursor *cursor, *tx_cursor;
 
-  // query asset by public key
-  c_key.mv_data = (void *)pubKey->data();
-  c_key.mv_size = pubKey->size();
+  check_index(tree);
 
-  if (uncommitted) {
-    cursor = trees_.at(tree_name).second;
-    tx = append_tx_;
+  // a key, which was never indexed, does not touch LMDB
+  if (!maybe_has_key(tree, pubKey, rtx == nullptr)) {
+    return std::vector<AM_val>{};
+  }
+
+  if (rtx == nullptr) {
+    // reuse cursors of "append" transaction
+    cursor = trees_[tree].second;
+    tx_cursor = trees_[TX_STORE].second;
   } else {
-    // create read-only transaction, create new RO cursor
-    if ((res = mdb_txn_begin(env, nullptr, MDB_RDONLY, &tx)) != 0) {
-      AMETSUCHI_CRITICAL(res, MDB_PANIC);
-      AMETSUCHI_CRITICAL(res, MDB_MAP_RESIZED);
-      AMETSUCHI_CRITICAL(res, MDB_READERS_FULL);
-      AMETSUCHI_CRITICAL(res, ENOMEM);
-    }
+    // take cursors of pooled read-only transaction
+    cursor = rtx->cursor(trees_[tree].first);
+    tx_cursor = rtx->cursor(trees_[TX_STORE].first);
+  }
 
-    if ((res = mdb_cursor_open(tx, trees_.at(tree_name).first, &cursor)) != 0) {
-      AMETSUCHI_CRITICAL(res, EINVAL);
-    }
+  std::vector<AM_val> ret;
+  read_key_txs(cursor, tx_cursor, attachments(rtx), pubKey, ret);
+  return ret;
+}
+
+std::vector<std::vector<AM_val>> TxStore::getTxByKeys(
+    Tree index, const std::vector<const flatbuffers::String *> &keys,
+    ReadTx *rtx) {
+  MDB_cursor *cursor, *tx_cursor;
+
+  check_index(index);
+
+  if (rtx == nullptr) {
+    cursor = trees_[index].second;
+    tx_cursor = trees_[TX_STORE].second;
+  } else {
+    cursor = rtx->cursor(trees_[index].first);
+    tx_cursor = rtx->cursor(trees_[TX_STORE].first);
+  }
+
+  // visit keys in tree order, so neighbouring keys share B-tree pages
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+    // LMDB default comparator
+    auto cmp = std::memcmp(keys[a]->data(), keys[b]->data(),
+                           std::min(keys[a]->size(), keys[b]->size()));
+    return cmp != 0 ? cmp < 0 : keys[a]->size() < keys[b]->size();
+  });
+
+  std::vector<std::vector<AM_val>> ret(keys.size());
+  for (auto i : order) {
+    if (!maybe_has_key(index, keys[i], rtx == nullptr)) continue;
+    read_key_txs(cursor, tx_cursor, attachments(rtx), keys[i], ret[i]);
   }
+  return ret;
+}
+
+void TxStore::read_key_txs(MDB_cursor *cursor, MDB_cursor *tx_cursor,
+                           MDB_cursor *attachments,
+                           const flatbuffers::String *key,
+                           std::vector<AM_val> &ret) const {
+  MDB_val c_key, c_val;
+  int res;
+
+  c_key.mv_data = (void *)key->data();
+  c_key.mv_size = key->size();
 
   // if sender has no such tx, then it is pub_key
   if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET)) != 0) {
-    if (res == MDB_NOTFOUND) {
-      return std::vector<AM_val>{};
-    }
+    if (res == MDB_NOTFOUND) return;
     AMETSUCHI_CRITICAL(res, EINVAL);
   }
 
-  std::vector<AM_val> ret;
   // index tree has transactions. try to find asset with the same `pk`
   // iterate over creator's transactions, O(N), where N is number of different
   // transactions,
-  MDB_val tx_key, tx_val;
-  MDB_cursor *tx_cursor;
-
-  if (uncommitted) {
-    tx_cursor = trees_.at("tx_store").second;
-  } else {
-    if ((res = mdb_cursor_open(tx, trees_.at("tx_store").first, &tx_cursor)) !=
-        0) {
-      AMETSUCHI_CRITICAL(res, EINVAL);
-    }
-  }
+  MDB_val tx_val;
+  size_t seq;
 
   do {
-    tx_key = c_val;
-    if ((res = mdb_cursor_get(tx_cursor, &tx_key, &tx_val, MDB_FIRST)) != 0) {
+    seq = be64_decode(c_val.mv_data);
+    if ((res = get_tx(tx_cursor, seq, tx_val)) != 0) {
       AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
       AMETSUCHI_CRITICAL(res, EINVAL);
     }
-    ret.push_back(AM_val(tx_val));
+    ret.push_back(read_tx(tx_val, attachments));
     if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT_DUP)) != 0) {
       if (res == MDB_NOTFOUND) {
         break;
@@ -298,106 +453,479 @@ std::vector<AM_val> TxStore::getTxByKey(const std::string &tree_name,
       AMETSUCHI_CRITICAL(res, EINVAL);
     }
   } while (res == 0);
+}
 
-  if (!uncommitted) {
-    mdb_cursor_close(cursor);
-    mdb_cursor_close(tx_cursor);
-    mdb_txn_abort(tx);
+/**
+ * Key of CREATOR_TIME tree, big-endian. The size of pubkey keeps keys of a
+ * creator together.
+ */
+static void creator_time_key(const flatbuffers::String *creator,
+                             uint64_t timestamp, std::vector<uint8_t> &key) {
+  key.resize(2 + creator->size() + SEQ_LEN);
+  key[0] = static_cast<uint8_t>(creator->size() >> 8);
+  key[1] = static_cast<uint8_t>(creator->size());
+  std::memcpy(key.data() + 2, creator->data(), creator->size());
+  be64_encode(timestamp, key.data() + 2 + creator->size());
+}
+
+/**
+ * Keys of \p tx in TX_TIME and CREATOR_TIME trees.
+ * @return false if \p tx has no signature with timestamp
+ */
+static bool time_keys(const iroha::Transaction *tx, uint8_t *time,
+                      std::vector<uint8_t> &creator_time) {
+  auto signatures = tx->signatures();
+  if (signatures == nullptr || signatures->size() == 0) return false;
+
+  auto timestamp = signatures->Get(0)->timestamp();
+  be64_encode(timestamp, time);
+  creator_time_key(tx->creatorPubKey(), timestamp, creator_time);
+  return true;
+}
+
+void TxStore::put_time(const iroha::Transaction *tx, size_t seq) {
+  uint8_t time[SEQ_LEN];
+  std::vector<uint8_t> creator_time;
+  if (!time_keys(tx, time, creator_time)) return;
+
+  if (bulk_ != nullptr) {
+    // written in key order by end_bulk_load(), like indexes
+    bulk_->add(TX_TIME, time, sizeof(time), seq);
+    bulk_->add(CREATOR_TIME, creator_time.data(), creator_time.size(), seq);
+    return;
+  }
+  put_seq(trees_[TX_TIME].second, time, sizeof(time), seq);
+  put_seq(trees_[CREATOR_TIME].second, creator_time.data(),
+          creator_time.size(), seq);
+}
+
+bool TxStore::split_attachment(const DecodedTx &decoded,
+                               std::vector<uint8_t> &cut) {
+  MDB_val c_key, c_val;
+  int res;
+
+  auto attachment = decoded.tx->attachment();
+  if (attachment_threshold_ == 0 || attachment == nullptr ||
+      attachment->data() == nullptr ||
+      attachment->data()->size() < attachment_threshold_) {
+    return false;
+  }
+
+  auto data = attachment->data();
+  // hashed by a pipeline worker, unless decoded with another threshold
+  auto hash = decoded.attachment_hashed
+                  ? decoded.attachment_hash
+                  : merkle::MerkleTree::hash(data->data(), data->size());
+
+  // the same data is stored once
+  c_key.mv_data = hash.data();
+  c_key.mv_size = hash.size();
+  c_val.mv_data = (void *)data->data();
+  c_val.mv_size = data->size();
+  if ((res = mdb_cursor_put(trees_[ATTACHMENTS].second, &c_key, &c_val,
+                            MDB_NOOVERWRITE))) {
+    AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+    AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+    AMETSUCHI_CRITICAL(res, EACCES);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  // the rest of the signed bytes is kept as is
+  cut = cut_attachment(decoded.blob, decoded.size, data->data(), data->size(),
+                       hash);
+  return true;
+}
+
+MDB_cursor *TxStore::attachments(ReadTx *rtx) {
+  return rtx == nullptr ? trees_[ATTACHMENTS].second
+                        : rtx->cursor(trees_[ATTACHMENTS].first);
+}
+
+AM_val TxStore::read_tx(const MDB_val &val, MDB_cursor *attachments) const {
+  return join_attachment(decode(TX_STORE, val), attachments);
+}
+
+AM_val TxStore::getAttachment(const merkle::hash_t &hash, ReadTx *rtx) {
+  MDB_val c_key, c_val;
+  int res;
+
+  auto cursor = rtx == nullptr ? trees_[ATTACHMENTS].second
+                               : rtx->cursor(trees_[ATTACHMENTS].first);
+  c_key.mv_data = (void *)hash.data();
+  c_key.mv_size = hash.size();
+  if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
+    if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+    c_val.mv_data = nullptr;
+    c_val.mv_size = 0;
+  }
+  return AM_val(c_val);
+}
+
+std::vector<AM_val> TxStore::getTxByTime(uint64_t from, uint64_t to,
+                                         ReadTx *rtx) {
+  MDB_val c_key, c_val, tx_val;
+  MDB_cursor *cursor, *tx_cursor;
+  int res;
+
+  if (stale_.load()) throw exception::Exception("indexes are stale");
+
+  if (rtx == nullptr) {
+    cursor = trees_[TX_TIME].second;
+    tx_cursor = trees_[TX_STORE].second;
+  } else {
+    cursor = rtx->cursor(trees_[TX_TIME].first);
+    tx_cursor = rtx->cursor(trees_[TX_STORE].first);
+  }
+
+  uint8_t begin[SEQ_LEN];
+  be64_encode(from, begin);
+  c_key.mv_data = begin;
+  c_key.mv_size = sizeof(begin);
+
+  // seqs of a timestamp are its duplicates, MDB_NEXT walks them too
+  std::vector<AM_val> ret;
+  res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET_RANGE);
+  while (res == 0 && be64_decode(c_key.mv_data) <= to) {
+    auto seq = be64_decode(c_val.mv_data);
+    if ((res = get_tx(tx_cursor, seq, tx_val))) {
+      AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    ret.push_back(read_tx(tx_val, attachments(rtx)));
+    res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT);
+  }
+  if (res != 0 && res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+  return ret;
+}
+
+std::vector<AM_val> TxStore::getTxByKeyTime(const flatbuffers::String *key,
+                                            uint64_t from, uint64_t to,
+                                            ReadTx *rtx) {
+  MDB_val c_key, c_val, tx_val;
+  MDB_cursor *cursor, *tx_cursor;
+  int res;
+
+  if (stale_.load()) throw exception::Exception("indexes are stale");
+
+  if (rtx == nullptr) {
+    cursor = trees_[CREATOR_TIME].second;
+    tx_cursor = trees_[TX_STORE].second;
+  } else {
+    cursor = rtx->cursor(trees_[CREATOR_TIME].first);
+    tx_cursor = rtx->cursor(trees_[TX_STORE].first);
   }
 
+  // keys of the creator have the same size and prefix
+  std::vector<uint8_t> begin;
+  creator_time_key(key, from, begin);
+  auto prefix = begin.size() - SEQ_LEN;
+  c_key.mv_data = begin.data();
+  c_key.mv_size = begin.size();
+
+  std::vector<AM_val> ret;
+  res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET_RANGE);
+  while (res == 0 && c_key.mv_size == begin.size() &&
+         std::memcmp(c_key.mv_data, begin.data(), prefix) == 0 &&
+         be64_decode(static_cast<uint8_t *>(c_key.mv_data) + prefix) <= to) {
+    auto seq = be64_decode(c_val.mv_data);
+    if ((res = get_tx(tx_cursor, seq, tx_val))) {
+      AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    ret.push_back(read_tx(tx_val, attachments(rtx)));
+    res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT);
+  }
+  if (res != 0 && res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
   return ret;
 }
 
-void TxStore::create_new_tree(MDB_txn *append_tx, const std::string &name,
-                              uint32_t flags, MDB_cmp_func *dupsort) {
-  trees_[name] = init_btree(append_tx, name, flags, dupsort);
+bool TxStore::has_hash(const merkle::hash_t &hash) {
+  if (!hash_filter_.maybe_contains(hash.data(), hash.size())) return false;
+
+  MDB_val c_key, c_val;
+  int res;
+
+  c_key.mv_data = (void *)hash.data();
+  c_key.mv_size = hash.size();
+  if ((res = mdb_cursor_get(trees_[TX_HASH].second, &c_key, &c_val,
+                            MDB_SET))) {
+    if (res == MDB_NOTFOUND) return false;
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  return true;
+}
+
+void TxStore::put_hash(const merkle::hash_t &hash) {
+  MDB_val c_key, c_val;
+  int res;
+
+  c_key.mv_data = (void *)hash.data();
+  c_key.mv_size = hash.size();
+  c_val.mv_data = &tx_store_total;
+  c_val.mv_size = sizeof(tx_store_total);
+
+  // duplicate (if allowed) is not indexed, hash points to the first one
+  if ((res = mdb_cursor_put(trees_[TX_HASH].second, &c_key, &c_val,
+                            MDB_NOOVERWRITE))) {
+    if (res == MDB_KEYEXIST) return;
+    AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+    AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+    AMETSUCHI_CRITICAL(res, EACCES);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  hash_filter_.insert(hash.data(), hash.size());
+
+  // keep false positive rate, amortized O(1)
+  if (hash_filter_.size() > hash_filter_.capacity()) {
+    rebuild_hash_filter(2 * hash_filter_.capacity());
+  }
+}
+
+void TxStore::init_hash_filter() {
+  MDB_stat stat;
+  int res;
+
+  if ((res = mdb_stat(append_tx_, trees_[TX_HASH].first, &stat))) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  rebuild_hash_filter(std::max<size_t>(2 * stat.ms_entries, 1u << 16));
+}
+
+void TxStore::rebuild_hash_filter(size_t capacity) {
+  MDB_val c_key, c_val;
+  int res;
+  auto cursor = trees_[TX_HASH].second;
+
+  hash_filter_ = BloomFilter(capacity);
+
+  res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_FIRST);
+  while (res == 0) {
+    hash_filter_.insert(c_key.mv_data, c_key.mv_size);
+    res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT);
+  }
+  if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+}
+
+AM_val TxStore::getTxByHash(const merkle::hash_t &hash, ReadTx *rtx) {
+  MDB_val c_key, c_val;
+  MDB_cursor *cursor, *tx_cursor;
+  int res;
+
+  if (rtx == nullptr) {
+    cursor = trees_[TX_HASH].second;
+    tx_cursor = trees_[TX_STORE].second;
+  } else {
+    cursor = rtx->cursor(trees_[TX_HASH].first);
+    tx_cursor = rtx->cursor(trees_[TX_STORE].first);
+  }
+
+  c_key.mv_data = (void *)hash.data();
+  c_key.mv_size = hash.size();
+  if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
+    if (res == MDB_NOTFOUND) {
+      c_val.mv_data = nullptr;
+      c_val.mv_size = 0;
+      return AM_val(c_val);
+    }
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  MDB_val tx_val;
+  if ((res = get_tx(tx_cursor, *static_cast<size_t *>(c_val.mv_data),
+                    tx_val))) {
+    AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  return read_tx(tx_val, attachments(rtx));
+}
+
+MDB_cursor *TxStore::seek_key(Tree tree, const flatbuffers::String *key,
+                              ReadTx *rtx) {
+  MDB_val c_key, c_val;
+  int res;
+
+  check_index(tree);
+  if (!maybe_has_key(tree, key, rtx == nullptr)) return nullptr;
+
+  auto cursor = rtx == nullptr ? trees_[tree].second
+                               : rtx->cursor(trees_[tree].first);
+  c_key.mv_data = (void *)key->data();
+  c_key.mv_size = key->size();
+  if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
+    if (res == MDB_NOTFOUND) return nullptr;
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  return cursor;
+}
+
+size_t TxStore::countTxByKey(Tree index, const flatbuffers::String *key,
+                             ReadTx *rtx) {
+  size_t count;
+  int res;
+
+  auto cursor = seek_key(index, key, rtx);
+  if (cursor == nullptr) return 0;
+
+  // number of duplicates is stored in the sub-database of the key
+  if ((res = mdb_cursor_count(cursor, &count))) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  return count;
+}
+
+bool TxStore::hasTxByKey(Tree index, const flatbuffers::String *key,
+                         ReadTx *rtx) {
+  return seek_key(index, key, rtx) != nullptr;
+}
+
+bool TxStore::maybe_has_key(Tree index, const flatbuffers::String *key,
+                            bool uncommitted) const {
+  if (!is_index(index) || key_filters_[index] == nullptr) return true;
+  // query throws in check_index()
+  if (stale_.load()) return true;
+  return key_filters_[index]->maybe_contains(key->data(), key->size(),
+                                             uncommitted);
+}
+
+void TxStore::check_index(Tree tree) {
+  if (!is_index(tree)) throw exception::Exception("not an index tree");
+  if (!enabled_[tree]) throw exception::Exception("index is disabled");
+  if (stale_.load()) throw exception::Exception("indexes are stale");
+}
+
+TxCursor TxStore::streamTxByKey(Tree index, const flatbuffers::String *key,
+                                ReadTx &&rtx, size_t limit, size_t offset,
+                                uint64_t token, bool newest_first) {
+  check_index(index);
+  return TxCursor(std::move(rtx), trees_[index].first, trees_[TX_STORE].first,
+                  trees_[ATTACHMENTS].first, key, limit, offset, token, newest_first,
+                  codecs_[TX_STORE].get(), &cold_);
 }
 
 std::vector<AM_val> TxStore::getAssetTransferBySender(
-    const flatbuffers::String *senderKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_transfer_sender", senderKey, uncommitted, env);
+    const flatbuffers::String *senderKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_TRANSFER_SENDER, senderKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAssetTransferByReceiver(
-    const flatbuffers::String *receiverKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_transfer_receiver", receiverKey, uncommitted, env);
+    const flatbuffers::String *receiverKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_TRANSFER_RECEIVER, receiverKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAssetCreateByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_asset_create", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ASSET_CREATE, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAssetAddByKey(const flatbuffers::String *pubKey,
-                                              bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_asset_add", pubKey, uncommitted, env);
+                                              ReadTx *rtx) {
+  return getTxByKey(INDEX_ASSET_ADD, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAssetRemoveByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_asset_remove", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ASSET_REMOVE, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAssetTransferByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_asset_transfer", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ASSET_TRANSFER, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAccountAddByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_account_add", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ACCOUNT_ADD, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAccountAddSignByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_account_add_sign", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ACCOUNT_ADD_SIGN, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAccountRemoveByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_account_remove", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ACCOUNT_REMOVE, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAccountRemoveSignByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_account_remove_sign", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ACCOUNT_REMOVE_SIGN, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getAccountSetUseKeysByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_account_set_use_keys", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_ACCOUNT_SET_USE_KEYS, pubKey, rtx);
 }
 
 std::vector<AM_val> TxStore::getPeerAddByKey(const flatbuffers::String *pubKey,
-                                             bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_peer_add", pubKey, uncommitted, env);
+                                             ReadTx *rtx) {
+  return getTxByKey(INDEX_PEER_ADD, pubKey, rtx);
 }
 std::vector<AM_val> TxStore::getPeerChangeTrustByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_peer_change_trust", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_PEER_CHANGE_TRUST, pubKey, rtx);
 }
 std::vector<AM_val> TxStore::getPeerRemoveByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_peer_remove", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_PEER_REMOVE, pubKey, rtx);
 }
 std::vector<AM_val> TxStore::getPeerSetActiveByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_peer_set_active", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_PEER_SET_ACTIVE, pubKey, rtx);
 }
 std::vector<AM_val> TxStore::getPeerSetTrustByKey(
-    const flatbuffers::String *pubKey, bool uncommitted, MDB_env *env) {
-  return getTxByKey("index_peer_set_trust", pubKey, uncommitted, env);
+    const flatbuffers::String *pubKey, ReadTx *rtx) {
+  return getTxByKey(INDEX_PEER_SET_TRUST, pubKey, rtx);
 }
 merkle::hash_t TxStore::merkle_root() {
   return merkleTree_.root();
 }
 
 void TxStore::commit() {
+  write_block_header();
+  drop_sealed();
+  train_dictionaries();
+
+  // the tree is persisted during bulk load too, it matches tx_store after
+  // an interrupted load
+  write_merkle_tree();
+
+  if (bulk_ != nullptr) {
+    // the rest is written once by end_bulk_load()
+    bulk_->commit();
+    return;
+  }
+
+  for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+    if (key_filters_[tree] == nullptr) continue;
+    key_filters_[tree]->commit(trees_[tree].second, trees_[META].second);
+  }
+}
+
+void TxStore::committed() {
+  cold_height_ = dropped_height_;
+  for (auto &&def : codec_defs_) {
+    auto &dictionary = trained_[def.tree];
+    if (dictionary.empty()) continue;
+    codecs_[def.tree]->set_dictionary(dictionary.data(), dictionary.size());
+    dictionary.clear();
+  }
+
+  // commit() skips filters during bulk load
+  if (bulk_ != nullptr) return;
+  for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+    if (key_filters_[tree] == nullptr) continue;
+    key_filters_[tree]->committed();
+  }
+}
+
+void TxStore::write_merkle_tree() {
   int res;
   MDB_val c_key, c_val;
 
   // Clear old hashes
-  if ((res = mdb_drop(append_tx_, trees_.at("merkle_tree").first, 0))){
+  if ((res = mdb_drop(append_tx_, trees_[MERKLE_TREE].first, 0))){
     AMETSUCHI_CRITICAL(res, EINVAL);
   }
 
@@ -411,7 +939,8 @@ void TxStore::commit() {
     c_val.mv_data = (void *)last_block.at(begin).data();
     c_val.mv_size = merkle::HASH_LEN;
 
-    if ((res = mdb_cursor_put(trees_.at("merkle_tree").second, &c_key, &c_val, MDB_APPEND))) { // ???
+    if ((res = mdb_cursor_put(trees_[MERKLE_TREE].second, &c_key, &c_val,
+                              MDB_APPEND))) {
       AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
       AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
       AMETSUCHI_CRITICAL(res, EACCES);
@@ -419,8 +948,489 @@ void TxStore::commit() {
     }
   }
 }
-void TxStore::init_merkle_tree() {
-  auto records = read_all_records(trees_.at("merkle_tree").second);
+
+MDB_val TxStore::encode(Tree tree, const MDB_val &val) {
+  auto &codec = codecs_[tree];
+  return codec == nullptr ? val : codec->encode(val);
+}
+
+AM_val TxStore::decode(Tree tree, const MDB_val &val) const {
+  return Codec::decode(codecs_[tree].get(), val);
+}
+
+static std::string dictionary_key(const char *tree) {
+  return std::string("dict/") + tree;
+}
+
+void TxStore::load_dictionaries() {
+  MDB_val c_key, c_val;
+  int res;
+
+  for (auto tree : {TX_STORE, BLOCKS}) {
+    auto &codec = codecs_[tree];
+    if (codec->has_dictionary()) continue;
+
+    auto key = dictionary_key(tx_store_trees[tree].name);
+    c_key.mv_data = (void *)key.data();
+    c_key.mv_size = key.size();
+    if ((res = mdb_cursor_get(trees_[META].second, &c_key, &c_val,
+                              MDB_SET))) {
+      if (res == MDB_NOTFOUND) continue;
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    codec->set_dictionary(c_val.mv_data, c_val.mv_size);
+  }
+}
+
+void TxStore::train_dictionaries() {
+  MDB_val c_key, c_val;
+  MDB_stat stat;
+  int res;
+
+  for (auto &&def : codec_defs_) {
+    auto &codec = codecs_[def.tree];
+    // left by a commit, which failed
+    trained_[def.tree].clear();
+    if (codec->type() == Codec::NONE || codec->has_dictionary()) continue;
+    if (def.dict_samples == 0 || def.dict_size == 0) continue;
+
+    if ((res = mdb_stat(append_tx_, trees_[def.tree].first, &stat))) {
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    if (stat.ms_entries < train_at_[def.tree]) continue;
+
+    // values evenly spread over the tree, compressed without dictionary or
+    // raw, so a retry samples values which were not tried before
+    std::vector<AM_val> values;
+    auto step = std::max<size_t>(1, stat.ms_entries / def.dict_samples);
+    auto cursor = trees_[def.tree].second;
+    size_t i = 0;
+    res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_FIRST);
+    while (res == 0 && values.size() < def.dict_samples) {
+      if (i++ % step == 0) values.push_back(decode(def.tree, c_val));
+      res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT);
+    }
+    if (res != 0 && res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+
+    std::vector<MDB_val> samples;
+    for (auto &&v : values) {
+      samples.push_back(MDB_val{v.size, const_cast<void *>(v.data)});
+    }
+    auto dictionary = Codec::train(samples, def.dict_size);
+    if (dictionary.empty()) {
+      // samples are too similar or too small, retry on twice more values
+      train_at_[def.tree] = 2 * stat.ms_entries;
+      continue;
+    }
+
+    c_val.mv_data = dictionary.data();
+    c_val.mv_size = dictionary.size();
+    put_meta(dictionary_key(tx_store_trees[def.tree].name), c_val);
+    // values are encoded with it once it is committed
+    trained_[def.tree] = std::move(dictionary);
+  }
+}
+
+void TxStore::put_meta(const std::string &name, const MDB_val &val) {
+  MDB_val c_key, c_val = val;
+  int res;
+
+  c_key.mv_data = (void *)name.data();
+  c_key.mv_size = name.size();
+  if ((res = mdb_cursor_put(trees_[META].second, &c_key, &c_val, 0))) {
+    AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+    AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+    AMETSUCHI_CRITICAL(res, EACCES);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+}
+
+void TxStore::del_meta(const std::string &name) {
+  MDB_val c_key, c_val;
+  int res;
+
+  c_key.mv_data = (void *)name.data();
+  c_key.mv_size = name.size();
+  if ((res = mdb_cursor_get(trees_[META].second, &c_key, &c_val, MDB_SET))) {
+    if (res == MDB_NOTFOUND) return;
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  if ((res = mdb_cursor_del(trees_[META].second, 0))) {
+    AMETSUCHI_CRITICAL(res, EACCES);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+}
+
+static const char FORMAT[] = "format_version";
+
+void TxStore::load_format() {
+  MDB_val c_key, c_val;
+  MDB_stat stat;
+  int res;
+
+  std::string key = FORMAT;
+  c_key.mv_data = (void *)key.data();
+  c_key.mv_size = key.size();
+  if ((res = mdb_cursor_get(trees_[META].second, &c_key, &c_val, MDB_SET))) {
+    if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+    // a new database is written in the current format
+    size_t entries = 0;
+    for (auto tree : {TX_STORE, BLOCKS}) {
+      if ((res = mdb_stat(append_tx_, trees_[tree].first, &stat))) {
+        AMETSUCHI_CRITICAL(res, EINVAL);
+      }
+      entries += stat.ms_entries;
+    }
+    if (entries != 0) {
+      throw exception::Exception("database format is not versioned");
+    }
+    format_ = FORMAT_VERSION;
+    c_val.mv_data = &format_;
+    c_val.mv_size = sizeof(format_);
+    put_meta(FORMAT, c_val);
+    return;
+  }
+
+  if (c_val.mv_size != sizeof(format_)) {
+    throw exception::Exception("database format is corrupted");
+  }
+  std::memcpy(&format_, c_val.mv_data, sizeof(format_));
+  if (format_ < MIN_FORMAT_VERSION || format_ > FORMAT_VERSION) {
+    console->error("database format {} is not supported", format_);
+    throw exception::Exception("database format is not supported");
+  }
+}
+
+static const char COLD_HEIGHT[] = "cold_height";
+
+void TxStore::set_segments(const std::string &dir, size_t hot_blocks,
+                           size_t segment_blocks) {
+  segments_dir_ = dir;
+  hot_blocks_ = hot_blocks;
+  segment_blocks_ = segment_blocks;
+}
+
+void TxStore::load_segments() {
+  MDB_val c_key, c_val;
+  int res;
+
+  if (cold_loaded_ || segments_dir_.empty()) return;
+  cold_loaded_ = true;
+
+  std::string key = COLD_HEIGHT;
+  c_key.mv_data = (void *)key.data();
+  c_key.mv_size = key.size();
+  if ((res = mdb_cursor_get(trees_[META].second, &c_key, &c_val, MDB_SET))) {
+    if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+    cold_height_ = 0;
+  } else {
+    cold_height_ = *static_cast<size_t *>(c_val.mv_data);
+  }
+  dropped_height_ = cold_height_;
+
+  uint64_t sealed_seq = 0;
+  if (cold_height_ > 0) {
+    auto header = getBlockHeader(cold_height_);
+    sealed_seq =
+        flatbuffers::GetRoot<iroha::BlockHeader>(header.data)->tx_end() - 1;
+  }
+
+  // segments beyond committed transactions are left by interrupted commit,
+  // sealed ones not yet dropped from tx_store are kept
+  uint64_t committed_seq = sealed_seq;
+  if (!(res = mdb_cursor_get(trees_[TX_STORE].second, &c_key, &c_val,
+                             MDB_LAST))) {
+    committed_seq =
+        std::max(committed_seq, *static_cast<uint64_t *>(c_key.mv_data));
+  } else if (res != MDB_NOTFOUND) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  cold_.open(segments_dir_, committed_seq);
+
+  // blocks found in segment files, segment_blocks_ may have been changed
+  sealed_height_ = cold_height_;
+  if (cold_.last() <= sealed_seq) return;
+  while (true) {
+    auto header = getBlockHeader(sealed_height_ + 1);
+    if (header.data == nullptr) break;
+    auto end = flatbuffers::GetRoot<iroha::BlockHeader>(header.data)->tx_end();
+    if (end > 0 && end - 1 > cold_.last()) break;
+    sealed_height_++;
+  }
+}
+
+void TxStore::start_sealing(MDB_env *env) {
+  poll_sealing(false);
+  if (hot_blocks_ == 0 || sealing_.valid()) return;
+  if (block_height_ < sealed_height_ + segment_blocks_ + hot_blocks_) return;
+
+  // whole segments of blocks older than the hot ones
+  auto from = sealed_height_;
+  auto to = from + (block_height_ - hot_blocks_ - from) / segment_blocks_ *
+                       segment_blocks_;
+  sealing_ = std::async(std::launch::async,
+                        [this, env, from, to]() { return seal(env, from, to); });
+}
+
+void TxStore::wait_sealing() { poll_sealing(true); }
+
+void TxStore::poll_sealing(bool wait) {
+  if (!sealing_.valid()) return;
+  if (!wait &&
+      sealing_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    return;
+  }
+  // rethrows error of sealing
+  sealed_height_ = sealing_.get();
+}
+
+size_t TxStore::seal(MDB_env *env, size_t from, size_t to) {
+  MDB_txn *txn;
+  MDB_cursor *blocks, *cursor;
+  MDB_val c_key, c_val;
+  int res;
+
+  if ((res = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn))) {
+    AMETSUCHI_CRITICAL(res, MDB_PANIC);
+    AMETSUCHI_CRITICAL(res, MDB_MAP_RESIZED);
+    AMETSUCHI_CRITICAL(res, MDB_READERS_FULL);
+    AMETSUCHI_CRITICAL(res, ENOMEM);
+  }
+  if ((res = mdb_cursor_open(txn, trees_[BLOCKS].first, &blocks))) {
+    mdb_txn_abort(txn);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  if ((res = mdb_cursor_open(txn, trees_[TX_STORE].first, &cursor))) {
+    mdb_cursor_close(blocks);
+    mdb_txn_abort(txn);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  try {
+    for (auto height = from; height < to; height += segment_blocks_) {
+      // [tx_begin of the first block, tx_end of the last block)
+      size_t heights[] = {height + 1, height + segment_blocks_};
+      size_t range[2];
+      for (size_t i = 0; i < 2; i++) {
+        c_key.mv_data = &heights[i];
+        c_key.mv_size = sizeof(heights[i]);
+        if ((res = mdb_cursor_get(blocks, &c_key, &c_val, MDB_SET))) {
+          AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+          AMETSUCHI_CRITICAL(res, EINVAL);
+        }
+        auto header = flatbuffers::GetRoot<iroha::BlockHeader>(
+            decode(BLOCKS, c_val).data);
+        range[i] = i == 0 ? header->tx_begin() : header->tx_end();
+      }
+      if (range[0] == range[1]) continue;
+
+      // copy the range: stored values as is, compressed or not
+      auto path = cold_.path(range[0]);
+      SegmentWriter writer(path, range[0]);
+      size_t seq = range[0];
+      c_key.mv_data = &seq;
+      c_key.mv_size = sizeof(seq);
+      res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET_RANGE);
+      while (res == 0 && *static_cast<size_t *>(c_key.mv_data) < range[1]) {
+        writer.append(c_val);
+        res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT);
+      }
+      if (res != 0 && res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+      writer.seal();
+
+      // the range is the same in both places until drop_sealed() commits
+      cold_.add(std::make_shared<const Segment>(path));
+    }
+  } catch (...) {
+    mdb_cursor_close(cursor);
+    mdb_cursor_close(blocks);
+    mdb_txn_abort(txn);
+    throw;
+  }
+
+  mdb_cursor_close(cursor);
+  mdb_cursor_close(blocks);
+  mdb_txn_abort(txn);
+  return to;
+}
+
+void TxStore::drop_sealed() {
+  MDB_val c_key, c_val;
+  int res;
+
+  poll_sealing(false);
+  if (sealed_height_ <= cold_height_) return;
+
+  auto first = getBlockHeader(cold_height_ + 1);
+  auto last = getBlockHeader(sealed_height_);
+  size_t begin =
+      flatbuffers::GetRoot<iroha::BlockHeader>(first.data)->tx_begin();
+  size_t end = flatbuffers::GetRoot<iroha::BlockHeader>(last.data)->tx_end();
+
+  // segment files are durable, so the range is removed from tx_store
+  auto cursor = trees_[TX_STORE].second;
+  size_t seq = begin;
+  c_key.mv_data = &seq;
+  c_key.mv_size = sizeof(seq);
+  res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET_RANGE);
+  while (res == 0 && *static_cast<size_t *>(c_key.mv_data) < end) {
+    if ((res = mdb_cursor_del(cursor, 0))) {
+      AMETSUCHI_CRITICAL(res, EACCES);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT);
+  }
+  if (res != 0 && res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+
+  // the range is still in tx_store, if the commit fails
+  dropped_height_ = sealed_height_;
+  c_val.mv_data = &dropped_height_;
+  c_val.mv_size = sizeof(dropped_height_);
+  put_meta(COLD_HEIGHT, c_val);
+}
+
+int TxStore::get_tx(MDB_cursor *cursor, size_t seq, MDB_val &val) const {
+  if (cold_.get(seq, val)) return 0;
+
+  MDB_val key;
+  key.mv_data = &seq;
+  key.mv_size = sizeof(seq);
+  return mdb_cursor_get(cursor, &key, &val, MDB_SET);
+}
+
+void TxStore::set_block_height() {
+  MDB_val c_key, c_val;
+  int res;
+
+  if ((res = mdb_cursor_get(trees_[BLOCKS].second, &c_key, &c_val,
+                            MDB_LAST))) {
+    if (res == MDB_NOTFOUND) {
+      block_height_ = 0;
+      return;
+    }
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  block_height_ = *reinterpret_cast<size_t *>(c_key.mv_data);
+}
+
+void TxStore::add_block_signatures(
+    const flatbuffers::Vector<flatbuffers::Offset<iroha::Signature>>
+        *signatures) {
+  if (signatures == nullptr) return;
+
+  for (auto sig : *signatures) {
+    PeerSignature copy;
+    if (sig->publicKey()) copy.public_key = sig->publicKey()->str();
+    if (sig->signature()) {
+      auto data = sig->signature()->data();
+      copy.signature.assign(data, data + sig->signature()->size());
+    }
+    copy.timestamp = sig->timestamp();
+    block_signatures_.push_back(std::move(copy));
+  }
+}
+
+void TxStore::write_block_header() {
+  MDB_val c_key, c_val;
+  int res;
+
+  // commit without transactions does not create a block
+  if (tx_store_total < block_begin_) return;
+
+  flatbuffers::FlatBufferBuilder fbb;
+  std::vector<flatbuffers::Offset<iroha::Signature>> signatures;
+  for (auto &&sig : block_signatures_) {
+    signatures.push_back(iroha::CreateSignature(
+        fbb, fbb.CreateString(sig.public_key), fbb.CreateVector(sig.signature),
+        sig.timestamp));
+  }
+
+  auto root = merkleTree_.root();
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+
+  size_t height = block_height_ + 1;
+  fbb.Finish(iroha::CreateBlockHeader(
+      fbb, height, block_begin_, tx_store_total + 1,
+      fbb.CreateVector(root.data(), root.size()), now.count(),
+      fbb.CreateVector(signatures)));
+
+  c_key.mv_data = &height;
+  c_key.mv_size = sizeof(height);
+  c_val.mv_data = fbb.GetBufferPointer();
+  c_val.mv_size = fbb.GetSize();
+  c_val = encode(BLOCKS, c_val);
+
+  if ((res = mdb_cursor_put(trees_[BLOCKS].second, &c_key, &c_val,
+                            MDB_APPEND))) {
+    AMETSUCHI_CRITICAL(res, MDB_KEYEXIST);
+    AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+    AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+    AMETSUCHI_CRITICAL(res, EACCES);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  block_height_ = height;
+  block_signatures_.clear();
+}
+
+AM_val TxStore::getBlockHeader(uint64_t height, ReadTx *rtx) {
+  MDB_val c_key, c_val;
+  int res;
+
+  auto cursor = rtx == nullptr ? trees_[BLOCKS].second
+                               : rtx->cursor(trees_[BLOCKS].first);
+
+  size_t key = height;
+  c_key.mv_data = &key;
+  c_key.mv_size = sizeof(key);
+  if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
+    if (res == MDB_NOTFOUND) {
+      c_val.mv_data = nullptr;
+      c_val.mv_size = 0;
+      return AM_val(c_val);
+    }
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  return decode(BLOCKS, c_val);
+}
+
+std::vector<AM_val> TxStore::getBlockTxs(uint64_t height, ReadTx *rtx) {
+  MDB_val c_key, c_val;
+  int res;
+
+  auto header = getBlockHeader(height, rtx);
+  if (header.data == nullptr) return std::vector<AM_val>{};
+
+  auto block = flatbuffers::GetRoot<iroha::BlockHeader>(header.data);
+  auto cursor = rtx == nullptr ? trees_[TX_STORE].second
+                               : rtx->cursor(trees_[TX_STORE].first);
+
+  std::vector<AM_val> ret;
+  ret.reserve(block->tx_end() - block->tx_begin());
+
+  // cold part of the block
+  size_t seq = block->tx_begin();
+  for (; seq < block->tx_end() && cold_.get(seq, c_val); seq++) {
+    ret.push_back(read_tx(c_val, attachments(rtx)));
+  }
+  if (seq == block->tx_end()) return ret;
+
+  c_key.mv_data = &seq;
+  c_key.mv_size = sizeof(seq);
+  res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET_KEY);
+  while (res == 0 &&
+         *reinterpret_cast<size_t *>(c_key.mv_data) < block->tx_end()) {
+    ret.push_back(read_tx(c_val, attachments(rtx)));
+    res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT);
+  }
+  if (res != 0 && res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+
+  return ret;
+}
+
+void TxStore::init_merkle_tree() {
+  auto records = read_all_records(trees_[MERKLE_TREE].second);
   for (auto &record : records) {
     merkle::hash_t hash;
     assert(record.second.size == merkle::HASH_LEN);
@@ -430,4 +1440,254 @@ void TxStore::init_merkle_tree() {
     assert((merkleTree_.last_block_end() - 1) == *(size_t*)record.first.data);
   }
 }
+
+static const char STALE_INDEXES[] = "stale_indexes";
+
+void TxStore::load_stale() {
+  MDB_val c_key, c_val;
+  int res;
+
+  std::string key = STALE_INDEXES;
+  c_key.mv_data = (void *)key.data();
+  c_key.mv_size = key.size();
+  if ((res = mdb_cursor_get(trees_[META].second, &c_key, &c_val, MDB_SET))) {
+    if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+    stale_ = false;
+  } else {
+    stale_ = true;
+  }
+}
+
+void TxStore::begin_bulk_load(MDB_env *env, const std::string &dir,
+                              size_t run_size) {
+  MDB_val c_key, c_val;
+  int res;
+
+  if (bulk_ != nullptr) throw exception::Exception("bulk load is started");
+  // indexes of an old format are not resumed, but dropped and rebuilt
+  if (format_ < FORMAT_VERSION) {
+    throw exception::Exception("indexes are outdated, rebuild them");
+  }
+
+  bulk_.reset(new IndexBuilder(dir, run_size));
+
+  if (stale_) {
+    // resume: index records of the interrupted load are lost with its runs,
+    // the value is the first seq of the load
+    size_t from = 1;
+    std::string key = STALE_INDEXES;
+    c_key.mv_data = (void *)key.data();
+    c_key.mv_size = key.size();
+    if ((res = mdb_cursor_get(trees_[META].second, &c_key, &c_val,
+                              MDB_SET))) {
+      AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    if (c_val.mv_size == sizeof(from)) std::memcpy(&from, c_val.mv_data, sizeof(from));
+    if (from <= tx_store_total) {
+      extract_keys(env, *bulk_, from, tx_store_total);
+    }
+    reload_filters_ = true;
+    return;
+  }
+
+  // filters are rebuilt from trees, if the load is interrupted
+  for (auto &&filter : key_filters_) {
+    if (filter != nullptr) filter->drop(trees_[META].second);
+  }
+  size_t from = tx_store_total + 1;
+  c_val.mv_data = &from;
+  c_val.mv_size = sizeof(from);
+  put_meta(STALE_INDEXES, c_val);
+  stale_ = true;
+}
+
+void TxStore::end_bulk_load() {
+  if (bulk_ == nullptr) throw exception::Exception("bulk load is not started");
+
+  write_indexes(*bulk_);
+  bulk_.reset();
+
+  // filters were built after restart without keys of the interrupted load
+  if (reload_filters_) {
+    for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+      if (key_filters_[tree] == nullptr) continue;
+      key_filters_[tree]->reload(trees_[tree].second);
+    }
+    reload_filters_ = false;
+  }
+
+  del_meta(STALE_INDEXES);
+  stale_ = false;
+}
+
+void TxStore::write_indexes(IndexBuilder &builder) {
+  MDB_val c_key, c_val;
+  int res;
+
+  // the last key of the current tree before the merge
+  size_t current = TREES_TOTAL;
+  std::string last;
+  bool tail = false;
+
+  builder.merge([&](size_t tree, const MDB_val &key,
+                    std::vector<uint8_t> &seqs) {
+    auto cursor = trees_[tree].second;
+
+    if (tree != current) {
+      current = tree;
+      if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_LAST))) {
+        if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
+        tail = true;
+      } else {
+        last.assign(static_cast<char *>(c_key.mv_data), c_key.mv_size);
+        tail = false;
+      }
+    }
+    // keys come in order, so all keys after the first new one are new
+    if (!tail) {
+      c_key.mv_data = (void *)last.data();
+      c_key.mv_size = last.size();
+      tail = mdb_cmp(append_tx_, trees_[tree].first, &key, &c_key) > 0;
+    }
+
+    // seqs are greater than stored ones of the key
+    MDB_val data[2];
+    data[0].mv_data = seqs.data();
+    data[0].mv_size = SEQ_LEN;
+    data[1].mv_data = nullptr;
+    data[1].mv_size = seqs.size() / SEQ_LEN;
+    c_key = key;
+    if ((res = mdb_cursor_put(cursor, &c_key, data,
+                              MDB_MULTIPLE |
+                                  (tail ? MDB_APPEND : MDB_APPENDDUP)))) {
+      AMETSUCHI_CRITICAL(res, MDB_KEYEXIST);
+      AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+      AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+      AMETSUCHI_CRITICAL(res, EACCES);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+  });
+}
+
+void TxStore::rebuild_indexes(MDB_env *env, const std::string &dir,
+                              size_t run_size, size_t threads) {
+  int res;
+
+  if (bulk_ != nullptr) throw exception::Exception("bulk load is started");
+  threads = std::max<size_t>(threads, 1);
+
+  // time trees are written like indexes
+  for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+    if (!is_index(static_cast<Tree>(tree)) && tree != TX_TIME &&
+        tree != CREATOR_TIME) {
+      continue;
+    }
+    if ((res = mdb_drop(append_tx_, trees_[tree].first, 0))) {
+      AMETSUCHI_CRITICAL(res, EACCES);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+  }
+
+  // created first, so it removes its directory last
+  IndexBuilder all(dir, run_size);
+  std::vector<std::unique_ptr<IndexBuilder>> builders;
+  std::vector<std::future<void>> workers;
+
+  size_t per_thread = (tx_store_total + threads - 1) / threads;
+  for (size_t i = 0; i < threads; i++) {
+    size_t begin = 1 + i * per_thread;
+    size_t end = std::min(tx_store_total, begin + per_thread - 1);
+    if (begin > end) break;
+
+    builders.emplace_back(new IndexBuilder(dir + std::to_string(i) + "/",
+                                           run_size / threads + 1));
+    auto builder = builders.back().get();
+    workers.push_back(std::async(std::launch::async, [=]() {
+      extract_keys(env, *builder, begin, end);
+    }));
+  }
+  // rethrow exception of a worker
+  for (auto &&worker : workers) worker.get();
+
+  for (auto &&builder : builders) all.adopt(*builder);
+  write_indexes(all);
+
+  for (size_t tree = 0; tree < TREES_TOTAL; tree++) {
+    if (key_filters_[tree] == nullptr) continue;
+    key_filters_[tree]->reload(trees_[tree].second);
+  }
+
+  MDB_val c_val;
+  format_ = FORMAT_VERSION;
+  c_val.mv_data = &format_;
+  c_val.mv_size = sizeof(format_);
+  put_meta(FORMAT, c_val);
+
+  del_meta(STALE_INDEXES);
+  stale_ = false;
+}
+
+void TxStore::extract_keys(MDB_env *env, IndexBuilder &builder, size_t begin,
+                           size_t end) const {
+  MDB_txn *txn;
+  MDB_cursor *cursor, *attachments;
+  MDB_val c_val;
+  int res;
+
+  if ((res = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn))) {
+    AMETSUCHI_CRITICAL(res, MDB_PANIC);
+    AMETSUCHI_CRITICAL(res, MDB_MAP_RESIZED);
+    AMETSUCHI_CRITICAL(res, MDB_READERS_FULL);
+    AMETSUCHI_CRITICAL(res, ENOMEM);
+  }
+  if ((res = mdb_cursor_open(txn, trees_[TX_STORE].first, &cursor))) {
+    mdb_txn_abort(txn);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  if ((res = mdb_cursor_open(txn, trees_[ATTACHMENTS].first, &attachments))) {
+    mdb_cursor_close(cursor);
+    mdb_txn_abort(txn);
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  uint8_t time[SEQ_LEN];
+  std::vector<uint8_t> creator_time;
+
+  try {
+    for (size_t seq = begin; seq <= end; seq++) {
+      if ((res = get_tx(cursor, seq, c_val))) {
+        AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+        AMETSUCHI_CRITICAL(res, EINVAL);
+      }
+      auto value = read_tx(c_val, attachments);
+      auto decoded =
+          ametsuchi::decode(static_cast<const uint8_t *>(value.data),
+                            value.size);
+      if (!decoded.valid) throw exception::InternalError::FATAL;
+
+      auto command = static_cast<size_t>(decoded.tx->command_type());
+      for (auto index : indexes_[command]) {
+        auto key = index->key(decoded.tx);
+        if (key == nullptr) continue;
+        builder.add(index->tree, key->data(), key->size(), seq);
+      }
+      if (time_keys(decoded.tx, time, creator_time)) {
+        builder.add(TX_TIME, time, sizeof(time), seq);
+        builder.add(CREATOR_TIME, creator_time.data(), creator_time.size(),
+                    seq);
+      }
+      builder.commit();
+    }
+  } catch (...) {
+    mdb_cursor_close(attachments);
+    mdb_cursor_close(cursor);
+    mdb_txn_abort(txn);
+    throw;
+  }
+
+  mdb_cursor_close(attachments);
+  mdb_cursor_close(cursor);
+  mdb_txn_abort(txn);
+}
 }
@@ -22,33 +22,102 @@
 
 namespace ametsuchi {
 
+// in the order of WSV::Tree
+static const TreeDef wsv_trees[] = {
+    // [pubkey] => assets (DUP)
+    {"wsv_pubkey_assets", MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE,
+     comparator::cmp_assets},
+    // [pubkey] => account (NODUP)
+    {"wsv_pubkey_account", MDB_CREATE, nullptr},
+    // [ledger_name+domain_name+asset_name] => creator public key (NODUP)
+    {"wsv_assetid_asset", MDB_CREATE, nullptr},
+    // [ip] => peer (NODUP)
+    {"wsv_ip_peer", MDB_CREATE, nullptr},
+    // name => value, e.g. "filter/wsv_pubkey_assets" => key filter
+    {"wsv_meta", MDB_CREATE, nullptr},
+};
+static_assert(sizeof(wsv_trees) / sizeof(TreeDef) == WSV::TREES_TOTAL,
+              "every WSV::Tree must be defined");
+
+// ledger+domain+asset, key of created assets and order of account's assets
+static std::string asset_id(const iroha::Currency *currency) {
+  std::string id;
+  id += currency->ledger_name()->data();
+  id += currency->domain_name()->data();
+  id += currency->currency_name()->data();
+  return id;
+}
+
 void WSV::init(MDB_txn *append_tx) {
   append_tx_ = append_tx;
 
-  // [pubkey] => assets (DUP)
-  trees_["wsv_pubkey_assets"] = init_btree(
-      append_tx_, "wsv_pubkey_assets", MDB_DUPSORT | MDB_DUPFIXED | MDB_CREATE,
-      comparator::cmp_assets);
-
-  // [pubkey] => account (NODUP)
-  trees_["wsv_pubkey_account"] =
-      init_btree(append_tx_, "wsv_pubkey_account", MDB_CREATE);
+  init_btrees(append_tx_, wsv_trees, trees_);
+  assets_filter_.init(trees_[PUBKEY_ASSETS].second, trees_[META].second);
 
-  // [ledger_name+domain_name+asset_name] => creator public key (NODUP)
-  trees_["wsv_assetid_asset"] =
-      init_btree(append_tx_, "wsv_assetid_asset", MDB_CREATE);
-
-  // [ip] => peer (NODUP)
-  trees_["wsv_ip_peer"] = init_btree(append_tx_, "wsv_ip_peer", MDB_CREATE);
+  // balances of a block, which is not committed, are lost
+  balances_.clear();
+  balances_undo_.clear();
+  touched_accounts_.clear();
 
   // we should know created assets, so read entire table in memory
   read_created_assets();
+}
+
+size_t WSV::accountCountAssets(const flatbuffers::String *pubKey,
+                               ReadTx *rtx) {
+  MDB_val c_key, c_val;
+  size_t count;
+  int res;
+
+  if (!maybe_has_assets(pubKey, rtx == nullptr)) return 0;
+
+  auto cursor = rtx == nullptr ? trees_[PUBKEY_ASSETS].second
+                               : rtx->cursor(trees_[PUBKEY_ASSETS].first);
+  c_key.mv_data = (void *)pubKey->data();
+  c_key.mv_size = pubKey->size();
+  count = 0;
+  if (rtx == nullptr) {
+    // assets, which are not in the tree yet
+    std::string pk{pubKey->data(), pubKey->data() + pubKey->size()};
+    for (auto it = balances_.lower_bound({pk, ""});
+         it != balances_.end() && it->first.first == pk; ++it) {
+      if (!it->second.stored) count++;
+    }
+  }
+
+  if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
+    if (res == MDB_NOTFOUND) return count;
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
 
-  assert(get_trees_total() == trees_.size());
+  size_t stored;
+  if ((res = mdb_cursor_count(cursor, &stored))) {
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+  return count + stored;
 }
 
-void WSV::update(const std::vector<uint8_t> *blob) {
-  auto tx = flatbuffers::GetRoot<iroha::Transaction>(blob->data());
+bool WSV::maybe_has_assets(const flatbuffers::String *pubKey,
+                           bool uncommitted) const {
+  return assets_filter_.maybe_contains(pubKey->data(), pubKey->size(),
+                                       uncommitted);
+}
+
+void WSV::commit(bool persist) {
+  flush_balances();
+  assets_filter_.commit(trees_[PUBKEY_ASSETS].second, trees_[META].second,
+                        persist);
+}
+
+void WSV::committed() { assets_filter_.committed(); }
+
+void WSV::drop_filter() { assets_filter_.drop(trees_[META].second); }
+
+void WSV::flush_filter() {
+  assets_filter_.flush(trees_[META].second);
+}
+
+void WSV::update(const iroha::Transaction *tx) {
   // 4. update WSV
   {
     switch (tx->command_type()) {
@@ -91,11 +160,11 @@ void WSV::update(const std::vector<uint8_t> *blob) {
     }
   }
 }
-WSV::WSV() {}
+WSV::WSV() : trees_(), assets_filter_("filter/wsv_pubkey_assets") {}
 WSV::~WSV() {}
 
 void WSV::read_created_assets() {
-  auto records = read_all_records(trees_["wsv_assetid_asset"].second);
+  auto records = read_all_records(trees_[ASSETID_ASSET].second);
   created_assets_.clear();
   for (auto &&asset : records) {
     std::string assetid{(char *)asset.first.data,
@@ -109,11 +178,113 @@ void WSV::read_created_assets() {
 }
 
 
-void WSV::close_cursors() {
-  for (auto &&e : trees_) {
-    MDB_cursor *cursor = e.second.second;
-    if (cursor) mdb_cursor_close(cursor);
+void WSV::close_cursors() { ametsuchi::close_cursors(trees_); }
+
+void WSV::open_cursors(MDB_txn *txn) {
+  append_tx_ = txn;
+  ametsuchi::open_cursors(txn, trees_);
+}
+
+void WSV::savepoint() {
+  savepoint_assets_.clear();
+  balances_undo_.clear();
+}
+
+void WSV::rollback_savepoint() {
+  for (auto &&assetid : savepoint_assets_) created_assets_.erase(assetid);
+  savepoint_assets_.clear();
+
+  // the latest change is undone first
+  for (auto it = balances_undo_.rbegin(); it != balances_undo_.rend(); ++it) {
+    if (it->existed) {
+      balances_[it->key] = std::move(it->balance);
+    } else {
+      balances_.erase(it->key);
+    }
+  }
+  balances_undo_.clear();
+}
+
+void WSV::log_balance(const BalanceKey &key) {
+  auto it = balances_.find(key);
+  if (it == balances_.end()) {
+    balances_undo_.push_back({key, false, Balance{}});
+  } else {
+    balances_undo_.push_back({key, true, it->second});
+  }
+}
+
+WSV::Balance &WSV::load_balance(const BalanceKey &key) {
+  MDB_val c_key, c_val;
+  int res;
+
+  auto it = balances_.find(key);
+  if (it != balances_.end()) return it->second;
+
+  auto blob = created_assets_.find(key.second);
+  if (blob == created_assets_.end()) {
+    throw exception::InvalidTransaction::ASSET_NOT_FOUND;
+  }
+
+  // the tree decides whether the asset is created or updated, not the filter
+  c_key.mv_data = (void *)key.first.data();
+  c_key.mv_size = key.first.size();
+  c_val.mv_data = (void *)blob->second.data();
+  c_val.mv_size = blob->second.size();
+  if ((res = mdb_cursor_get(trees_[PUBKEY_ASSETS].second, &c_key, &c_val,
+                            MDB_GET_BOTH))) {
+    if (res == MDB_NOTFOUND)
+      throw exception::InvalidTransaction::ASSET_NOT_FOUND;
+    AMETSUCHI_CRITICAL(res, EINVAL);
+  }
+
+  auto data = static_cast<const uint8_t *>(c_val.mv_data);
+  Balance balance{{data, data + c_val.mv_size}, true};
+  return balances_.emplace(key, std::move(balance)).first->second;
+}
+
+void WSV::flush_balances() {
+  MDB_val c_key, c_val, c_stored;
+  int res;
+
+  auto cursor = trees_[PUBKEY_ASSETS].second;
+  // in tree order, neighbouring balances share pages
+  for (auto &&it : balances_) {
+    if (touched_accounts_.empty() || touched_accounts_.back() != it.first.first)
+      touched_accounts_.push_back(it.first.first);
+
+    c_key.mv_data = (void *)it.first.first.data();
+    c_key.mv_size = it.first.first.size();
+    c_val.mv_data = (void *)it.second.asset.data();
+    c_val.mv_size = it.second.asset.size();
+
+    if (!it.second.stored) {
+      if ((res = mdb_cursor_put(cursor, &c_key, &c_val, 0))) {
+        AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+        AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+        AMETSUCHI_CRITICAL(res, EACCES);
+        AMETSUCHI_CRITICAL(res, EINVAL);
+      }
+      continue;
+    }
+
+    // move cursor to the stored asset, then replace it with MDB_CURRENT
+    c_stored = c_val;
+    if ((res = mdb_cursor_get(cursor, &c_key, &c_stored, MDB_GET_BOTH))) {
+      AMETSUCHI_CRITICAL(res, MDB_NOTFOUND);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
+    if ((res = mdb_cursor_put(cursor, &c_key, &c_val, MDB_CURRENT))) {
+      AMETSUCHI_CRITICAL(res, MDB_KEYEXIST);
+      AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
+      AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
+      AMETSUCHI_CRITICAL(res, EACCES);
+      AMETSUCHI_CRITICAL(res, EINVAL);
+    }
   }
+
+  balances_.clear();
+  balances_undo_.clear();
 }
 
 // WSV commands:
@@ -148,7 +319,7 @@ void WSV::asset_create(const iroha::AssetCreate *command) {
   c_val.mv_size = fbb.GetSize();
 
   // Put and sort by assetid
-  if ((res = mdb_cursor_put(trees_.at("wsv_assetid_asset").second, &c_key,
+  if ((res = mdb_cursor_put(trees_[ASSETID_ASSET].second, &c_key,
                             &c_val, 0))) {
     if (res == MDB_KEYEXIST) {
       throw exception::InvalidTransaction::ASSET_EXISTS;
@@ -159,7 +330,9 @@ void WSV::asset_create(const iroha::AssetCreate *command) {
     AMETSUCHI_CRITICAL(res, EINVAL);
   }
 
-  created_assets_[pk] = std::vector<uint8_t>{ptr, ptr + fbb.GetSize()};
+  auto created = created_assets_.insert(
+      {pk, std::vector<uint8_t>{ptr, ptr + fbb.GetSize()}});
+  if (created.second) savepoint_assets_.push_back(pk);
 }
 
 void WSV::asset_add(const iroha::AssetAdd *command) {
@@ -183,99 +356,62 @@ void WSV::asset_remove(const iroha::AssetRemove *command) {
 
 void WSV::account_add_currency(const flatbuffers::String *acc_pub_key,
                                const flatbuffers::Vector<uint8_t> *asset_fb) {
-  int res;
-  MDB_val c_key, c_val;
-  auto cursor = trees_.at("wsv_pubkey_assets").second;
-  std::vector<uint8_t> copy;
   const iroha::Currency *currency =
       flatbuffers::GetRoot<iroha::Asset>(asset_fb->Data())->asset_as_Currency();
 
+  BalanceKey key{{acc_pub_key->data(),
+                  acc_pub_key->data() + acc_pub_key->size()},
+                 asset_id(currency)};
+  log_balance(key);
+
+  Balance *balance;
   try {
     // may throw ASSET_NOT_FOUND
-    AM_val account_asset = accountGetAsset(acc_pub_key, currency->ledger_name(),
-                                           currency->domain_name(),
-                                           currency->currency_name(), true);
-
-    assert(asset_fb->size() == account_asset.size);
-
-    // asset exists, change it:
-
-    copy = {(char *)account_asset.data,
-            (char *)account_asset.data + account_asset.size};
-
-    // update the copy
-    auto copy_fb = flatbuffers::GetMutableRoot<iroha::Asset>(copy.data());
-    auto copy_cur = static_cast<iroha::Currency *>(copy_fb->mutable_asset());
-
-    Currency current(copy_cur->amount(), copy_cur->precision());
-    Currency delta(currency->amount(), currency->precision());
-    current = current + delta;
-
-    copy_cur->mutate_amount(current.get_amount());
-    copy_cur->mutate_precision(current.get_precision());
+    balance = &load_balance(key);
+  } catch (exception::InvalidTransaction e) {
+    if (e != exception::InvalidTransaction::ASSET_NOT_FOUND) throw;
 
-    // write to tree
-    c_key.mv_data = (void *)acc_pub_key->data();
-    c_key.mv_size = acc_pub_key->size();
-    c_val.mv_data = (void *)copy.data();
-    c_val.mv_size = copy.size();
+    // Create new Asset, it is put into the tree by flush_balances()
+    balances_[key] =
+        Balance{{asset_fb->Data(), asset_fb->Data() + asset_fb->size()}, false};
+    assets_filter_.insert(acc_pub_key->data(), acc_pub_key->size());
+    return;
+  }
 
-    // cursor is at the correct asset, just replace with a copy of FB and flag
-    // MDB_CURRENT
+  assert(asset_fb->size() == balance->asset.size());
 
-    if ((res = mdb_cursor_put(cursor, &c_key, &c_val, MDB_CURRENT))) {
-      AMETSUCHI_CRITICAL(res, MDB_KEYEXIST);
-      AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
-      AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
-      AMETSUCHI_CRITICAL(res, EACCES);
-      AMETSUCHI_CRITICAL(res, EINVAL);
-    }
+  // asset exists, change it:
+  auto copy_fb = flatbuffers::GetMutableRoot<iroha::Asset>(
+      balance->asset.data());
+  auto copy_cur = static_cast<iroha::Currency *>(copy_fb->mutable_asset());
 
-  } catch (exception::InvalidTransaction e) {
-    // Create new Asset
-    if (e == exception::InvalidTransaction::ASSET_NOT_FOUND) {
-      // write to tree
-      c_key.mv_data = (void *)acc_pub_key->data();
-      c_key.mv_size = acc_pub_key->size();
-      c_val.mv_data = (void *)asset_fb->Data();
-      c_val.mv_size = asset_fb->size();
+  Currency current(copy_cur->amount(), copy_cur->precision());
+  Currency delta(currency->amount(), currency->precision());
+  current = current + delta;
 
-      if ((res = mdb_cursor_put(cursor, &c_key, &c_val, 0))) {
-        AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
-        AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
-        AMETSUCHI_CRITICAL(res, EACCES);
-        AMETSUCHI_CRITICAL(res, EINVAL);
-      }
-    } else {
-      throw;
-    }
-  }
+  copy_cur->mutate_amount(current.get_amount());
+  copy_cur->mutate_precision(current.get_precision());
 }
 
 void WSV::account_remove_currency(
     const flatbuffers::String *acc_pub_key,
     const flatbuffers::Vector<uint8_t> *asset_fb) {
-  int res;
-  MDB_val c_key, c_val;
-  auto cursor = trees_.at("wsv_pubkey_assets").second;
-  std::vector<uint8_t> copy;
   const iroha::Currency *currency =
       flatbuffers::GetRoot<iroha::Asset>(asset_fb->Data())->asset_as_Currency();
 
+  BalanceKey key{{acc_pub_key->data(),
+                  acc_pub_key->data() + acc_pub_key->size()},
+                 asset_id(currency)};
+  log_balance(key);
+
   // may throw ASSET_NOT_FOUND
-  AM_val account_asset =
-      accountGetAsset(acc_pub_key, currency->ledger_name(),
-                      currency->domain_name(), currency->currency_name(), true);
+  Balance &balance = load_balance(key);
 
-  assert(asset_fb->size() == account_asset.size);
+  assert(asset_fb->size() == balance.asset.size());
 
   // asset exists, change it:
-
-  copy = {(char *)account_asset.data,
-          (char *)account_asset.data + account_asset.size};
-
-  // update the copy
-  auto copy_fb = flatbuffers::GetMutableRoot<iroha::Asset>(copy.data());
+  auto copy_fb =
+      flatbuffers::GetMutableRoot<iroha::Asset>(balance.asset.data());
   auto copy_cur = static_cast<iroha::Currency *>(copy_fb->mutable_asset());
 
   Currency current(copy_cur->amount(), copy_cur->precision());
@@ -285,22 +421,6 @@ void WSV::account_remove_currency(
 
   copy_cur->mutate_amount(current.get_amount());
   copy_cur->mutate_precision(current.get_precision());
-
-  // write to tree
-  c_key.mv_data = (void *)acc_pub_key->data();
-  c_key.mv_size = acc_pub_key->size();
-  c_val.mv_data = (void *)copy.data();
-  c_val.mv_size = copy.size();
-
-  // cursor is at the correct asset, just replace with a copy of FB and flag
-  // MDB_CURRENT
-  if ((res = mdb_cursor_put(cursor, &c_key, &c_val, MDB_CURRENT))) {
-    AMETSUCHI_CRITICAL(res, MDB_KEYEXIST);
-    AMETSUCHI_CRITICAL(res, MDB_MAP_FULL);
-    AMETSUCHI_CRITICAL(res, MDB_TXN_FULL);
-    AMETSUCHI_CRITICAL(res, EACCES);
-    AMETSUCHI_CRITICAL(res, EINVAL);
-  }
 }
 
 void WSV::asset_transfer(const iroha::AssetTransfer *command) {
@@ -327,7 +447,7 @@ void WSV::account_add(const iroha::AccountAdd *command) {
   c_val.mv_data = (void *)command->account()->data();
   c_val.mv_size = command->account()->size();
 
-  if ((res = mdb_cursor_put(trees_.at("wsv_pubkey_account").second, &c_key,
+  if ((res = mdb_cursor_put(trees_[PUBKEY_ACCOUNT].second, &c_key,
                             &c_val, 0))) {
     // account with this public key exists
     if (res == MDB_KEYEXIST) {
@@ -350,7 +470,7 @@ void WSV::account_remove(const iroha::AccountRemove *command) {
   c_key.mv_size = pubkey->size();
 
   // move cursor to account in pubkey_account tree
-  auto cursor = trees_.at("wsv_pubkey_account").second;
+  auto cursor = trees_[PUBKEY_ACCOUNT].second;
   if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
     if (res == MDB_NOTFOUND)
       throw exception::InvalidTransaction::ACCOUNT_NOT_FOUND;
@@ -365,8 +485,17 @@ void WSV::account_remove(const iroha::AccountRemove *command) {
   }
 
 
+  // balances of the block are removed with the account
+  std::string pk{pubkey->data(), pubkey->data() + pubkey->size()};
+  touched_accounts_.push_back(pk);
+  auto it = balances_.lower_bound({pk, ""});
+  while (it != balances_.end() && it->first.first == pk) {
+    log_balance(it->first);
+    it = balances_.erase(it);
+  }
+
   // move cursor to pubkey in pubkey_assets tree
-  cursor = trees_.at("wsv_pubkey_assets").second;
+  cursor = trees_[PUBKEY_ASSETS].second;
   if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
     AMETSUCHI_CRITICAL(res, EINVAL);
     // do not handle MDB_NOTFOUND! it means, that account has no assets
@@ -381,7 +510,7 @@ void WSV::account_remove(const iroha::AccountRemove *command) {
 }
 
 void WSV::peer_add(const iroha::PeerAdd *command) {
-  MDB_cursor *cursor = trees_.at("wsv_ip_peer").second;
+  MDB_cursor *cursor = trees_[IP_PEER].second;
   MDB_val c_key, c_val;
   int res;
 
@@ -409,7 +538,7 @@ void WSV::peer_add(const iroha::PeerAdd *command) {
 
 
 void WSV::peer_remove(const iroha::PeerRemove *command) {
-  auto cursor = trees_.at("wsv_ip_peer").second;
+  auto cursor = trees_[IP_PEER].second;
   MDB_val c_key, c_val;
   int res;
 
@@ -440,11 +569,9 @@ void WSV::peer_remove(const iroha::PeerRemove *command) {
 AM_val WSV::accountGetAsset(const flatbuffers::String *pubKey,
                             const flatbuffers::String *ln,
                             const flatbuffers::String *dn,
-                            const flatbuffers::String *an, bool uncommitted,
-                            MDB_env *env) {
+                            const flatbuffers::String *an, ReadTx *rtx) {
   MDB_val c_key, c_val;
   MDB_cursor *cursor;
-  MDB_txn *tx;
   int res;
 
   std::string pk;
@@ -465,26 +592,31 @@ AM_val WSV::accountGetAsset(const flatbuffers::String *pubKey,
     throw exception::InvalidTransaction::ASSET_NOT_FOUND;
   }
 
-  // depending on 'uncommitted' we use RO or RW transaction
-  if (uncommitted) {
-    // reuse existing cursor and "append" transaction
-    cursor = trees_.at("wsv_pubkey_assets").second;
-    tx = append_tx_;
-  } else {
-    // create read-only transaction, create new RO cursor
-    if ((res = mdb_txn_begin(env, NULL, MDB_RDONLY, &tx))) {
-      AMETSUCHI_CRITICAL(res, MDB_PANIC);
-      AMETSUCHI_CRITICAL(res, MDB_MAP_RESIZED);
-      AMETSUCHI_CRITICAL(res, MDB_READERS_FULL);
-      AMETSUCHI_CRITICAL(res, ENOMEM);
-    }
+  // account without assets does not touch LMDB
+  if (!maybe_has_assets(pubKey, rtx == nullptr)) {
+    throw exception::InvalidTransaction::ASSET_NOT_FOUND;
+  }
 
-    if ((res = mdb_cursor_open(tx, trees_.at("wsv_pubkey_assets").first,
-                               &cursor))) {
-      AMETSUCHI_CRITICAL(res, EINVAL);
+  // balance changed in the uncommitted block
+  if (rtx == nullptr) {
+    auto balance = balances_.find(
+        {{pubKey->data(), pubKey->data() + pubKey->size()}, pk});
+    if (balance != balances_.end()) {
+      c_val.mv_data = (void *)balance->second.asset.data();
+      c_val.mv_size = balance->second.asset.size();
+      return AM_val(c_val);
     }
   }
 
+  // depending on 'rtx' we use RO or RW transaction
+  if (rtx == nullptr) {
+    // reuse existing cursor and "append" transaction
+    cursor = trees_[PUBKEY_ASSETS].second;
+  } else {
+    // take cursor of pooled read-only transaction
+    cursor = rtx->cursor(trees_[PUBKEY_ASSETS].first);
+  }
+
   // query asset by public key
   c_key.mv_data = (void *)pubKey->data();
   c_key.mv_size = pubKey->size();
@@ -506,78 +638,84 @@ AM_val WSV::accountGetAsset(const flatbuffers::String *pubKey,
     AMETSUCHI_CRITICAL(res, EINVAL);
   }
 
-  if (!uncommitted) {
-    mdb_cursor_close(cursor);
-    mdb_txn_abort(tx);
-  }
   return AM_val(c_val);
 }
 
 std::vector<AM_val> WSV::accountGetAllAssets(const flatbuffers::String *pubKey,
-                                             bool uncommitted, MDB_env *env) {
+                                             ReadTx *rtx) {
   MDB_val c_key, c_val;
   MDB_cursor *cursor;
-  MDB_txn *tx;
   int res;
 
+  std::vector<AM_val> ret;
+
+  // account without assets does not touch LMDB
+  if (!maybe_has_assets(pubKey, rtx == nullptr)) {
+    return ret;
+  }
+
   // query asset by public key
   c_key.mv_data = (void *)pubKey->data();
   c_key.mv_size = pubKey->size();
 
-  if (uncommitted) {
-    cursor = trees_.at("wsv_pubkey_assets").second;
-    tx = append_tx_;
+  if (rtx == nullptr) {
+    cursor = trees_[PUBKEY_ASSETS].second;
   } else {
-    // create read-only transaction, create new RO cursor
-    if ((res = mdb_txn_begin(env, NULL, MDB_RDONLY, &tx))) {
-      AMETSUCHI_CRITICAL(res, MDB_PANIC);
-      AMETSUCHI_CRITICAL(res, MDB_MAP_RESIZED);
-      AMETSUCHI_CRITICAL(res, MDB_READERS_FULL);
-      AMETSUCHI_CRITICAL(res, ENOMEM);
-    }
-
-    if ((res = mdb_cursor_open(tx, trees_.at("wsv_pubkey_assets").first,
-                               &cursor))) {
-      AMETSUCHI_CRITICAL(res, EINVAL);
-    }
+    // take cursor of pooled read-only transaction
+    cursor = rtx->cursor(trees_[PUBKEY_ASSETS].first);
   }
 
+  // balances of the uncommitted block replace stored ones
+  std::string pk{pubKey->data(), pubKey->data() + pubKey->size()};
+  auto uncommitted = [&](const MDB_val &stored) {
+    auto currency = flatbuffers::GetRoot<iroha::Asset>(stored.mv_data)
+                        ->asset_as_Currency();
+    if (rtx != nullptr || currency == nullptr) return AM_val(stored);
+    auto balance = balances_.find({pk, asset_id(currency)});
+    if (balance == balances_.end()) return AM_val(stored);
+
+    MDB_val val;
+    val.mv_data = (void *)balance->second.asset.data();
+    val.mv_size = balance->second.asset.size();
+    return AM_val(val);
+  };
+
   // if sender has no such asset, then it is incorrect transaction
-  if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET))) {
-    if (res == MDB_NOTFOUND) return std::vector<AM_val>{};
-    AMETSUCHI_CRITICAL(res, EINVAL);
-  }
+  res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_SET);
+  if (res != 0 && res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
 
-  std::vector<AM_val> ret;
   // account has assets. try to find asset with the same `pk`
   // iterate over account's assets, O(N), where N is number of different
   // assets,
-  do {
+  while (res == 0) {
     // user's current amount
-    ret.push_back(AM_val(c_val));
+    ret.push_back(uncommitted(c_val));
 
     // move to next asset in user's account
     if ((res = mdb_cursor_get(cursor, &c_key, &c_val, MDB_NEXT_DUP))) {
-      if (res == MDB_NOTFOUND) return ret;
-      AMETSUCHI_CRITICAL(res, EINVAL);
+      if (res != MDB_NOTFOUND) AMETSUCHI_CRITICAL(res, EINVAL);
     }
-  } while (res == 0);
+  }
 
-  if (!uncommitted) {
-    mdb_cursor_close(cursor);
-    mdb_txn_abort(tx);
+  // assets, which are not in the tree yet
+  if (rtx == nullptr) {
+    for (auto it = balances_.lower_bound({pk, ""});
+         it != balances_.end() && it->first.first == pk; ++it) {
+      if (it->second.stored) continue;
+      c_val.mv_data = (void *)it->second.asset.data();
+      c_val.mv_size = it->second.asset.size();
+      ret.push_back(AM_val(c_val));
+    }
   }
+
   return ret;
 }
 
 void WSV::close_dbi(MDB_env *env) {
   for (auto &&it : trees_) {
-    auto dbi = it.second.first;
+    auto dbi = it.first;
     mdb_dbi_close(env, dbi);
   }
 }
-uint32_t WSV::get_trees_total() {
-  wsv_trees_total = 4;
-  return wsv_trees_total;
-}
+uint32_t WSV::get_trees_total() { return TREES_TOTAL; }
 }
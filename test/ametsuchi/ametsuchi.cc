@@ -16,10 +16,16 @@
  */
 
 #include <ametsuchi/ametsuchi.h>
+#include <block_generated.h>
 #include <transaction_generated.h>
 #include <flatbuffers/flatbuffers.h>
 #include <gtest/gtest.h>
 #include <spdlog/spdlog.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <thread>
 #include "../generator/tx_generator.h"
 
 class Ametsuchi_Test : public ::testing::Test {
@@ -224,3 +230,1352 @@ TEST_F(Ametsuchi_Test, AssetTest) {
   }
   //});
 }
+
+TEST_F(Ametsuchi_Test, BatchAppendTest) {
+  // more than one chunk, so workers are involved
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < 2 * AMETSUCHI_PIPELINE_CHUNK + 1; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union()));
+  }
+
+  std::vector<std::vector<uint8_t> *> batch;
+  for (auto &blob : blobs) batch.push_back(&blob);
+
+  // the same transactions appended one by one
+  std::string seq_folder = "/tmp/ametsuchi_seq/";
+  ametsuchi::merkle::hash_t seq_root;
+  {
+    ametsuchi::Ametsuchi seq(seq_folder);
+    for (auto &blob : blobs) seq_root = seq.append(&blob);
+  }
+  system(("rm -rf " + seq_folder).c_str());
+
+  ASSERT_EQ(ametsuchi_.append(batch), seq_root);
+}
+
+TEST_F(Ametsuchi_Test, MalformedTransactionTest) {
+  std::vector<uint8_t> blob(16, 0xff);
+  ASSERT_THROW(ametsuchi_.append(&blob),
+               ametsuchi::exception::InvalidTransaction);
+}
+
+TEST_F(Ametsuchi_Test, ConsensusEventAppendTest) {
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < 8; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union()));
+  }
+
+  flatbuffers::FlatBufferBuilder fbb(2048);
+  std::vector<flatbuffers::Offset<iroha::TransactionWrapper>> wrappers;
+  for (auto &blob : blobs) {
+    wrappers.push_back(
+        iroha::CreateTransactionWrapper(fbb, fbb.CreateVector(blob)));
+  }
+  fbb.Finish(iroha::CreateConsensusEvent(fbb, 0, fbb.CreateVector(wrappers)));
+  auto event = flatbuffers::GetRoot<iroha::ConsensusEvent>(
+      fbb.GetBufferPointer());
+
+  std::string seq_folder = "/tmp/ametsuchi_seq/";
+  ametsuchi::merkle::hash_t seq_root;
+  {
+    ametsuchi::Ametsuchi seq(seq_folder);
+    for (auto &blob : blobs) seq_root = seq.append(&blob);
+  }
+  system(("rm -rf " + seq_folder).c_str());
+
+  ASSERT_EQ(ametsuchi_.append(event), seq_root);
+}
+
+/**
+ * Append AssetCreate of Dollar/USA/l1 currency
+ */
+void create_dollar(ametsuchi::Ametsuchi &ametsuchi) {
+  flatbuffers::FlatBufferBuilder fbb(2048);
+  auto blob = generator::random_transaction(
+      fbb, iroha::Command::AssetCreate,
+      generator::random_AssetCreate(fbb, "Dollar", "USA", "l1").Union());
+  ametsuchi.append(&blob);
+}
+
+/**
+ * Append AssetAdd of \p amount Dollar/USA/l1 to \p account
+ */
+void add_dollars(ametsuchi::Ametsuchi &ametsuchi, const std::string &account,
+                 uint64_t amount) {
+  flatbuffers::FlatBufferBuilder fbb(2048);
+  auto blob = generator::random_transaction(
+      fbb, iroha::Command::AssetAdd,
+      generator::random_AssetAdd(
+          fbb, account,
+          generator::random_asset_wrapper_currency(amount, 2, "Dollar", "USA",
+                                                   "l1")).Union());
+  ametsuchi.append(&blob);
+}
+
+/**
+ * Flatbuffer strings: account "1", ledger, domain, currency of Dollar
+ */
+class DollarKeys {
+ public:
+  DollarKeys() : fbb_(256) {
+    fbb_.Finish(fbb_.CreateVectorOfStrings({"1", "l1", "USA", "Dollar"}));
+    keys_ = flatbuffers::GetRoot<
+        flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>>(
+        fbb_.GetBufferPointer());
+  }
+
+  const flatbuffers::String *operator[](size_t i) const {
+    return keys_->Get(i);
+  }
+
+  static uint64_t amount(const ametsuchi::AM_val &asset) {
+    return flatbuffers::GetRoot<iroha::Asset>(asset.data)
+        ->asset_as_Currency()
+        ->amount();
+  }
+
+ private:
+  flatbuffers::FlatBufferBuilder fbb_;
+  const flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>> *keys_;
+};
+
+TEST_F(Ametsuchi_Test, PooledReadTest) {
+  create_dollar(ametsuchi_);
+  add_dollars(ametsuchi_, "1", 200);
+  ametsuchi_.commit();
+
+  DollarKeys k;
+  auto amount = [this, &k]() {
+    return DollarKeys::amount(
+        ametsuchi_.accountGetAsset(k[0], k[1], k[2], k[3]));
+  };
+
+  // read-only transaction of this thread is renewed for every query
+  for (size_t i = 0; i < 100; i++) ASSERT_EQ(amount(), 200u);
+
+  // another thread gets its own transaction
+  uint64_t other = 0;
+  std::thread reader([&other, &amount]() { other = amount(); });
+  reader.join();
+  ASSERT_EQ(other, 200u);
+
+  // reader slots of finished threads are reused
+  for (size_t i = 0; i < 2 * AMETSUCHI_MAX_READERS; i++) {
+    std::thread t([&other, &amount]() { other = amount(); });
+    t.join();
+  }
+  ASSERT_EQ(other, 200u);
+}
+
+TEST_F(Ametsuchi_Test, SnapshotTest) {
+  create_dollar(ametsuchi_);
+  add_dollars(ametsuchi_, "1", 200);
+  ametsuchi_.commit();
+
+  DollarKeys k;
+  {
+    auto snapshot = ametsuchi_.snapshot();
+    auto before = snapshot.accountGetAsset(k[0], k[1], k[2], k[3]);
+
+    add_dollars(ametsuchi_, "1", 100);
+    ametsuchi_.commit();
+
+    // snapshot does not see the new commit, old result is still valid
+    ASSERT_EQ(DollarKeys::amount(before), 200u);
+    ASSERT_EQ(
+        DollarKeys::amount(snapshot.accountGetAsset(k[0], k[1], k[2], k[3])),
+        200u);
+    ASSERT_EQ(snapshot.accountGetAllAssets(k[0]).size(), 1u);
+  }
+
+  ASSERT_EQ(
+      DollarKeys::amount(ametsuchi_.accountGetAsset(k[0], k[1], k[2], k[3])),
+      300u);
+}
+
+TEST_F(Ametsuchi_Test, AsyncCommitTest) {
+  ametsuchi_.set_durability(ametsuchi::Durability::ASYNC,
+                            std::chrono::milliseconds(10));
+
+  create_dollar(ametsuchi_);
+  add_dollars(ametsuchi_, "1", 200);
+  auto durable = ametsuchi_.commit_async();
+
+  // committed data is visible before it is synced
+  DollarKeys k;
+  ASSERT_EQ(
+      DollarKeys::amount(ametsuchi_.accountGetAsset(k[0], k[1], k[2], k[3])),
+      200u);
+
+  ASSERT_EQ(durable.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  ASSERT_NO_THROW(durable.get());
+
+  // switching back syncs pending commits
+  add_dollars(ametsuchi_, "1", 100);
+  durable = ametsuchi_.commit_async();
+  ametsuchi_.set_durability(ametsuchi::Durability::FULL);
+  ASSERT_EQ(durable.wait_for(std::chrono::seconds(0)),
+            std::future_status::ready);
+}
+
+TEST_F(Ametsuchi_Test, SavepointTest) {
+  auto currency = [](uint64_t amount) {
+    return generator::random_asset_wrapper_currency(amount, 2, "Dollar", "USA",
+                                                    "l1");
+  };
+
+  std::vector<std::vector<uint8_t>> valid;
+  {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    valid.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb, "Dollar", "USA", "l1").Union()));
+  }
+  for (uint64_t amount : {200, 100}) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    valid.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetAdd,
+        generator::random_AssetAdd(fbb, "1", currency(amount)).Union()));
+  }
+
+  flatbuffers::FlatBufferBuilder fbb(2048);
+  auto invalid = generator::random_transaction(
+      fbb, iroha::Command::AssetRemove,
+      generator::random_AssetRemove(fbb, "1", currency(1000)).Union());
+
+  // invalid transaction in the middle of the block
+  ametsuchi_.append(&valid[0]);
+  ametsuchi_.append(&valid[1]);
+  ASSERT_THROW(ametsuchi_.append(&invalid),
+               ametsuchi::exception::InvalidTransaction);
+  auto root = ametsuchi_.append(&valid[2]);
+
+  DollarKeys k;
+  ASSERT_EQ(DollarKeys::amount(
+                ametsuchi_.accountGetAsset(k[0], k[1], k[2], k[3], true)),
+            300u);
+
+  // the same block without invalid transaction
+  std::string seq_folder = "/tmp/ametsuchi_seq/";
+  ametsuchi::merkle::hash_t seq_root;
+  {
+    ametsuchi::Ametsuchi seq(seq_folder);
+    for (auto &blob : valid) seq_root = seq.append(&blob);
+  }
+  system(("rm -rf " + seq_folder).c_str());
+  ASSERT_EQ(root, seq_root);
+
+  // rollback restores merkle tree of the latest commit
+  ametsuchi_.commit();
+  auto next = ametsuchi_.append(&valid[2]);
+  ametsuchi_.rollback();
+  ASSERT_EQ(ametsuchi_.append(&valid[2]), next);
+}
+
+TEST_F(Ametsuchi_Test, StreamQueryTest) {
+  for (size_t i = 0; i < 10; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, "creator");
+    ametsuchi_.append(&blob);
+  }
+  ametsuchi_.commit();
+
+  flatbuffers::FlatBufferBuilder fbb(256);
+  fbb.Finish(fbb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+
+  auto all = ametsuchi_.getAssetCreateByKey(key);
+  ASSERT_EQ(all.size(), 10u);
+
+  std::vector<const void *> streamed;
+  for (auto tx : ametsuchi_.streamTxByKey(
+           ametsuchi::TxStore::INDEX_ASSET_CREATE, key)) {
+    streamed.push_back(tx.data);
+  }
+  ASSERT_EQ(streamed.size(), all.size());
+
+  // pages of 3 transactions, resumed by token
+  std::vector<const void *> paged;
+  uint64_t token = 0;
+  while (true) {
+    auto page = ametsuchi_.streamTxByKey(
+        ametsuchi::TxStore::INDEX_ASSET_CREATE, key, 3, 0, token);
+    size_t read = 0;
+    for (auto tx : page) {
+      paged.push_back(tx.data);
+      read++;
+    }
+    if (read == 0) break;
+    ASSERT_LE(read, 3u);
+    token = page.token();
+  }
+  ASSERT_EQ(paged, streamed);
+
+  auto tail = ametsuchi_.streamTxByKey(ametsuchi::TxStore::INDEX_ASSET_CREATE,
+                                       key, 0, 8);
+  ASSERT_EQ(std::distance(tail.begin(), tail.end()), 2);
+
+  ASSERT_THROW(ametsuchi_.streamTxByKey(ametsuchi::TxStore::TX_STORE, key),
+               ametsuchi::exception::Exception);
+}
+
+TEST_F(Ametsuchi_Test, OptionsTest) {
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+
+  ametsuchi::Ametsuchi::Options invalid;
+  invalid.write_map = true;  // nested transactions are not supported
+  ASSERT_THROW(ametsuchi::Ametsuchi(opt_folder, invalid),
+               ametsuchi::exception::Exception);
+  invalid = ametsuchi::Ametsuchi::Options();
+  invalid.map_size = 1000;
+  ASSERT_THROW(ametsuchi::Ametsuchi(opt_folder, invalid),
+               ametsuchi::exception::Exception);
+
+  ametsuchi::Ametsuchi::Options options;
+  options.map_size = 64L * 1024 * 1024;
+  options.max_readers = 8;
+  options.block_size = 16;
+  options.no_readahead = true;
+  options.write_map = true;
+  options.savepoints = false;
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    create_dollar(ametsuchi);
+    add_dollars(ametsuchi, "1", 200);
+    ametsuchi.commit();
+
+    add_dollars(ametsuchi, "1", 100);
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto remove = generator::random_transaction(
+        fbb, iroha::Command::AssetRemove,
+        generator::random_AssetRemove(
+            fbb, "1", generator::random_asset_wrapper_currency(
+                          1000, 2, "Dollar", "USA", "l1")).Union());
+    ASSERT_THROW(ametsuchi.append(&remove),
+                 ametsuchi::exception::InvalidTransaction);
+
+    // without savepoints the whole block is rolled back
+    DollarKeys k;
+    ASSERT_EQ(DollarKeys::amount(
+                  ametsuchi.accountGetAsset(k[0], k[1], k[2], k[3], true)),
+              200u);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, IndexRegistryTest) {
+  create_dollar(ametsuchi_);
+  flatbuffers::FlatBufferBuilder fbb(2048);
+  auto blob = generator::random_transaction(
+      fbb, iroha::Command::AssetAdd,
+      generator::random_AssetAdd(
+          fbb, "1", generator::random_asset_wrapper_currency(200, 2, "Dollar",
+                                                             "USA", "l1"))
+          .Union(),
+      5, "creator");
+  ametsuchi_.append(&blob);
+  ametsuchi_.commit();
+
+  flatbuffers::FlatBufferBuilder kb(256);
+  kb.Finish(kb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(kb.GetBufferPointer());
+
+  // AssetAdd is written into its own index only
+  ASSERT_EQ(ametsuchi_.getAssetAddByKey(key).size(), 1u);
+  ASSERT_EQ(ametsuchi_.getAssetRemoveByKey(key).size(), 0u);
+  ASSERT_EQ(ametsuchi_.getAssetTransferByKey(key).size(), 0u);
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  ametsuchi::Ametsuchi::Options options;
+  options.disabled_indexes = {ametsuchi::TxStore::INDEX_ASSET_ADD};
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    create_dollar(ametsuchi);
+    ametsuchi.append(&blob);
+    ametsuchi.commit();
+    ASSERT_THROW(ametsuchi.getAssetAddByKey(key),
+                 ametsuchi::exception::Exception);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, LatestTxTest) {
+  // more than 256, so order of sequence numbers depends on byte order
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < 300; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, "creator"));
+    ametsuchi_.append(&blobs.back());
+  }
+  ametsuchi_.commit();
+
+  flatbuffers::FlatBufferBuilder fbb(256);
+  fbb.Finish(fbb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+
+  auto same = [](const ametsuchi::AM_val &tx,
+                 const std::vector<uint8_t> &blob) {
+    return tx.size == blob.size() &&
+           std::equal(blob.begin(), blob.end(),
+                      static_cast<const uint8_t *>(tx.data));
+  };
+
+  // chronological order
+  auto all = ametsuchi_.getAssetCreateByKey(key);
+  ASSERT_EQ(all.size(), blobs.size());
+  for (size_t i = 0; i < all.size(); i++) ASSERT_TRUE(same(all[i], blobs[i]));
+
+  size_t i = blobs.size();
+  for (auto tx : ametsuchi_.latestTxByKey(
+           ametsuchi::TxStore::INDEX_ASSET_CREATE, key, 5)) {
+    ASSERT_TRUE(same(tx, blobs[--i]));
+  }
+  ASSERT_EQ(i, blobs.size() - 5);
+
+  // newest first, pages resumed by token
+  i = blobs.size();
+  uint64_t token = 0;
+  while (i > 0) {
+    auto page = ametsuchi_.streamTxByKey(
+        ametsuchi::TxStore::INDEX_ASSET_CREATE, key, 100, 0, token, true);
+    ASSERT_TRUE(page.begin() != page.end());
+    for (auto tx : page) ASSERT_TRUE(same(tx, blobs[--i]));
+    token = page.token();
+  }
+  auto rest = ametsuchi_.streamTxByKey(ametsuchi::TxStore::INDEX_ASSET_CREATE,
+                                       key, 100, 0, token, true);
+  ASSERT_TRUE(rest.begin() == rest.end());
+}
+
+TEST_F(Ametsuchi_Test, TxHashTest) {
+  ametsuchi::merkle::hash_t hash;
+  hash.fill(7);
+
+  flatbuffers::FlatBufferBuilder fbb(2048);
+  auto blob = generator::random_transaction(
+      fbb, iroha::Command::AssetCreate,
+      generator::random_AssetCreate(fbb).Union(), 5, "creator",
+      std::vector<uint8_t>(hash.begin(), hash.end()));
+
+  ametsuchi_.append(&blob);
+  ASSERT_EQ(ametsuchi_.getTxByHash(hash, true).size, blob.size());
+  ASSERT_TRUE(ametsuchi_.getTxByHash(hash).data == nullptr);
+  ametsuchi_.commit();
+  ASSERT_EQ(ametsuchi_.getTxByHash(hash).size, blob.size());
+
+  ametsuchi::merkle::hash_t unknown;
+  unknown.fill(8);
+  ASSERT_TRUE(ametsuchi_.getTxByHash(unknown).data == nullptr);
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  ametsuchi::Ametsuchi::Options options;
+  options.reject_duplicates = true;
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    ametsuchi.append(&blob);
+    // duplicate in the same block
+    ASSERT_THROW(ametsuchi.append(&blob),
+                 ametsuchi::exception::InvalidTransaction);
+    ametsuchi.commit();
+  }
+  {
+    // filter is filled from stored hashes on open
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    ASSERT_THROW(ametsuchi.append(&blob),
+                 ametsuchi::exception::InvalidTransaction);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, BlockTest) {
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < 3; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union()));
+  }
+
+  flatbuffers::FlatBufferBuilder fbb(2048);
+  std::vector<flatbuffers::Offset<iroha::TransactionWrapper>> wrappers;
+  for (auto &blob : blobs) {
+    wrappers.push_back(
+        iroha::CreateTransactionWrapper(fbb, fbb.CreateVector(blob)));
+  }
+  std::vector<uint8_t> sig(64, 1);
+  std::vector<flatbuffers::Offset<iroha::Signature>> signatures{
+      iroha::CreateSignature(fbb, fbb.CreateString("peer"),
+                             fbb.CreateVector(sig), 42)};
+  fbb.Finish(iroha::CreateConsensusEvent(fbb, fbb.CreateVector(signatures),
+                                         fbb.CreateVector(wrappers)));
+  auto event = flatbuffers::GetRoot<iroha::ConsensusEvent>(
+      fbb.GetBufferPointer());
+
+  auto root = ametsuchi_.append(event);
+  ASSERT_TRUE(ametsuchi_.getBlockHeader(1).data == nullptr);
+  ametsuchi_.commit();
+
+  // empty commit does not create a block
+  ametsuchi_.commit();
+  ASSERT_TRUE(ametsuchi_.getBlockHeader(2).data == nullptr);
+
+  auto header = flatbuffers::GetRoot<iroha::BlockHeader>(
+      ametsuchi_.getBlockHeader(1).data);
+  ASSERT_EQ(header->height(), 1u);
+  ASSERT_EQ(header->tx_end() - header->tx_begin(), blobs.size());
+  ASSERT_TRUE(std::equal(root.begin(), root.end(),
+                         header->merkle_root()->begin()));
+  ASSERT_EQ(header->peerSignatures()->size(), 1u);
+  ASSERT_EQ(header->peerSignatures()->Get(0)->publicKey()->str(), "peer");
+  ASSERT_EQ(header->peerSignatures()->Get(0)->timestamp(), 42u);
+
+  auto txs = ametsuchi_.getBlockTxs(1);
+  ASSERT_EQ(txs.size(), blobs.size());
+  for (size_t i = 0; i < txs.size(); i++) {
+    ASSERT_EQ(txs[i].size, blobs[i].size());
+  }
+  ASSERT_TRUE(ametsuchi_.getBlockTxs(2).empty());
+
+  ametsuchi_.append(&blobs[0]);
+  ametsuchi_.commit();
+  header = flatbuffers::GetRoot<iroha::BlockHeader>(
+      ametsuchi_.getBlockHeader(2).data);
+  ASSERT_EQ(header->tx_begin(), blobs.size() + 1);
+  ASSERT_EQ(ametsuchi_.getBlockTxs(2).size(), 1u);
+}
+
+TEST_F(Ametsuchi_Test, CompressionTest) {
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < 200; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, "creator"));
+  }
+
+  flatbuffers::FlatBufferBuilder fbb(256);
+  fbb.Finish(fbb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+
+  auto check = [&](ametsuchi::Ametsuchi &db) {
+    auto txs = db.getAssetCreateByKey(key);
+    ASSERT_EQ(txs.size(), blobs.size());
+    for (size_t i = 0; i < txs.size(); i++) {
+      ASSERT_EQ(txs[i].size, blobs[i].size());
+      ASSERT_EQ(std::memcmp(txs[i].data, blobs[i].data(), txs[i].size), 0);
+    }
+    size_t i = 0;
+    for (auto tx : db.streamTxByKey(ametsuchi::TxStore::INDEX_ASSET_CREATE,
+                                    key)) {
+      ASSERT_EQ(tx.size, blobs[i++].size());
+    }
+    ASSERT_EQ(i, blobs.size());
+    ASSERT_EQ(db.getBlockTxs(4).size(), 50u);
+  };
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  ametsuchi::Ametsuchi::Options options;
+  // dictionary is trained after the first commit
+  options.codecs.push_back(
+      {ametsuchi::TxStore::TX_STORE, ametsuchi::Codec::ZSTD, 3, 50, 4096});
+  // compressed without dictionary
+  options.codecs.push_back(
+      {ametsuchi::TxStore::BLOCKS, ametsuchi::Codec::ZSTD, 3, 0, 0});
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    for (size_t i = 0; i < blobs.size(); i++) {
+      ametsuchi.append(&blobs[i]);
+      if (i % 50 == 49) ametsuchi.commit();
+    }
+    check(ametsuchi);
+  }
+  {
+    // compressed values are read without codec configured
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    check(ametsuchi);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+
+  options.codecs[0].tree = ametsuchi::TxStore::TX_HASH;
+  ASSERT_THROW(ametsuchi::Ametsuchi(opt_folder, options),
+               ametsuchi::exception::Exception);
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, SegmentTest) {
+  std::vector<std::vector<uint8_t>> blobs;
+  for (size_t i = 0; i < 50; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, "creator"));
+  }
+
+  flatbuffers::FlatBufferBuilder fbb(256);
+  fbb.Finish(fbb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+
+  auto check = [&](ametsuchi::Ametsuchi &db) {
+    auto txs = db.getAssetCreateByKey(key);
+    ASSERT_EQ(txs.size(), blobs.size());
+    for (size_t i = 0; i < txs.size(); i++) {
+      ASSERT_EQ(txs[i].size, blobs[i].size());
+      ASSERT_EQ(std::memcmp(txs[i].data, blobs[i].data(), txs[i].size), 0);
+    }
+    auto streamed = db.streamTxByKey(ametsuchi::TxStore::INDEX_ASSET_CREATE,
+                                     key);
+    ASSERT_EQ(static_cast<size_t>(
+                  std::distance(streamed.begin(), streamed.end())),
+              blobs.size());
+    // blocks of 10 transactions, both cold and hot
+    for (uint64_t height = 1; height <= 5; height++) {
+      ASSERT_EQ(db.getBlockTxs(height).size(), 10u);
+    }
+  };
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  ametsuchi::Ametsuchi::Options options;
+  options.hot_blocks = 1;
+  options.segment_blocks = 2;
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    for (size_t i = 0; i < blobs.size(); i++) {
+      ametsuchi.append(&blobs[i]);
+      if (i % 10 == 9) ametsuchi.commit();
+    }
+    // blocks 1-2 and 3-4 are sealed in background, block 5 is hot
+    ametsuchi.wait_sealing();
+    ASSERT_EQ(ametsuchi.segments_total(), 2u);
+    check(ametsuchi);
+  }
+  {
+    // segments are read, but no more are sealed
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    ASSERT_EQ(ametsuchi.segments_total(), 2u);
+    check(ametsuchi);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, KeyFilterTest) {
+  auto make_key = [](flatbuffers::FlatBufferBuilder &fbb, const char *s) {
+    fbb.Finish(fbb.CreateString(s));
+    return flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+  };
+  flatbuffers::FlatBufferBuilder fbb1, fbb2, fbb3;
+  auto creator = make_key(fbb1, "creator");
+  auto fresh = make_key(fbb2, "fresh");
+  auto unknown = make_key(fbb3, "unknown");
+
+  auto tx = [](const char *creator) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    return generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, creator);
+  };
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    auto blob = tx("creator");
+    ametsuchi.append(&blob);
+    ametsuchi.commit();
+
+    blob = tx("fresh");
+    ametsuchi.append(&blob);
+    // uncommitted key is visible to uncommitted queries only
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(fresh, true).size(), 1u);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(fresh).size(), 0u);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(creator).size(), 1u);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(unknown).size(), 0u);
+    ASSERT_EQ(ametsuchi.accountGetAllAssets(unknown).size(), 0u);
+    ametsuchi.commit();
+  }
+  {
+    // filters are loaded from the database
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(creator).size(), 1u);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(fresh).size(), 1u);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(unknown).size(), 0u);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, KeyFilterCrashTest) {
+  auto add_account = [](ametsuchi::Ametsuchi &ametsuchi,
+                        const std::string &pubkey) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AccountAdd,
+        generator::random_AccountAdd(fbb, generator::random_account(pubkey))
+            .Union());
+    ametsuchi.append(&blob);
+  };
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  pid_t pid = fork();
+  ASSERT_NE(pid, -1);
+  if (pid == 0) {
+    try {
+      ametsuchi::Ametsuchi ametsuchi(opt_folder);
+      // the filter is persisted with many keys, so one more key is not
+      create_dollar(ametsuchi);
+      add_account(ametsuchi, "2");
+      for (int i = 2; i < 32; i++) add_dollars(ametsuchi, std::to_string(i), 1);
+      ametsuchi.commit();
+
+      // the tree has as many entries as the persisted filter has
+      flatbuffers::FlatBufferBuilder fbb(2048);
+      auto blob = generator::random_transaction(
+          fbb, iroha::Command::AccountRemove,
+          generator::random_AccountRemove(fbb, "2").Union());
+      ametsuchi.append(&blob);
+      add_dollars(ametsuchi, "1", 200);
+      ametsuchi.commit();
+    } catch (...) {
+      _exit(1);
+    }
+    // crash, the filter is not flushed at close
+    _exit(0);
+  }
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    DollarKeys k;
+    ASSERT_EQ(DollarKeys::amount(
+                  ametsuchi.accountGetAsset(k[0], k[1], k[2], k[3])),
+              200u);
+    ASSERT_EQ(ametsuchi.accountCountAssets(k[0]), 1u);
+
+    // the balance is updated, not created again
+    add_dollars(ametsuchi, "1", 100);
+    ametsuchi.commit();
+    ASSERT_EQ(DollarKeys::amount(
+                  ametsuchi.accountGetAsset(k[0], k[1], k[2], k[3])),
+              300u);
+    ASSERT_EQ(ametsuchi.accountCountAssets(k[0]), 1u);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, CommitFailureTest) {
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  ametsuchi::Ametsuchi::Options options;
+  options.map_size = 256 * page;
+
+  flatbuffers::FlatBufferBuilder fbb(256);
+  fbb.Finish(fbb.CreateString("0"));
+  auto first =
+      flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+  DollarKeys k;
+
+  size_t committed = 0;
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    create_dollar(ametsuchi);
+    ametsuchi.commit();
+    committed++;
+
+    // blocks of new accounts until the map is full, in append() or commit()
+    bool full = false;
+    for (int block = 0; block < 10000 && !full; block++) {
+      try {
+        for (int i = 0; i < 16; i++) {
+          add_dollars(ametsuchi, std::to_string(16 * block + i), 1);
+        }
+        ametsuchi.commit();
+        committed++;
+      } catch (ametsuchi::exception::InternalError e) {
+        ASSERT_EQ(e, ametsuchi::exception::InternalError::FATAL);
+        full = true;
+      }
+    }
+    ASSERT_TRUE(full);
+    ASSERT_GE(committed, 2u);
+
+    // the failed block is rolled back, the last commit is intact
+    ASSERT_NE(ametsuchi.getBlockHeader(committed).data, nullptr);
+    ASSERT_EQ(ametsuchi.getBlockHeader(committed + 1).data, nullptr);
+    ASSERT_EQ(DollarKeys::amount(
+                  ametsuchi.accountGetAsset(first, k[1], k[2], k[3])),
+              1u);
+  }
+
+  // key filters and blocks continue from the last commit
+  options.map_size = 4096 * page;
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    ASSERT_EQ(ametsuchi.getBlockHeader(committed + 1).data, nullptr);
+    add_dollars(ametsuchi, "0", 1);
+    ametsuchi.commit();
+    ASSERT_NE(ametsuchi.getBlockHeader(committed + 1).data, nullptr);
+    ASSERT_EQ(DollarKeys::amount(
+                  ametsuchi.accountGetAsset(first, k[1], k[2], k[3])),
+              2u);
+    ASSERT_EQ(ametsuchi.accountCountAssets(first), 1u);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, CountQueryTest) {
+  auto make_key = [](flatbuffers::FlatBufferBuilder &fbb, const char *s) {
+    fbb.Finish(fbb.CreateString(s));
+    return flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+  };
+  flatbuffers::FlatBufferBuilder fbb1, fbb2;
+  auto creator = make_key(fbb1, "creator");
+  auto unknown = make_key(fbb2, "unknown");
+
+  for (int i = 0; i < 3; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, "creator");
+    ametsuchi_.append(&blob);
+  }
+  create_dollar(ametsuchi_);
+  add_dollars(ametsuchi_, "1", 200);
+
+  auto index = ametsuchi::TxStore::INDEX_ASSET_CREATE;
+  ASSERT_EQ(ametsuchi_.countTxByKey(index, creator, true), 3u);
+  ASSERT_EQ(ametsuchi_.countTxByKey(index, creator), 0u);
+  ASSERT_FALSE(ametsuchi_.hasTxByKey(index, creator));
+  ametsuchi_.commit();
+
+  ASSERT_EQ(ametsuchi_.countTxByKey(index, creator),
+            ametsuchi_.getAssetCreateByKey(creator).size());
+  ASSERT_TRUE(ametsuchi_.hasTxByKey(index, creator));
+  ASSERT_EQ(ametsuchi_.countTxByKey(index, unknown), 0u);
+  ASSERT_FALSE(ametsuchi_.hasTxByKey(index, unknown));
+
+  DollarKeys k;
+  ASSERT_EQ(ametsuchi_.accountCountAssets(k[0]), 1u);
+  ASSERT_EQ(ametsuchi_.accountCountAssets(unknown), 0u);
+
+  auto snapshot = ametsuchi_.snapshot();
+  ASSERT_EQ(snapshot.countTxByKey(index, creator), 3u);
+  ASSERT_TRUE(snapshot.hasTxByKey(index, creator));
+  ASSERT_EQ(snapshot.accountCountAssets(k[0]), 1u);
+}
+
+TEST_F(Ametsuchi_Test, BulkLoadTest) {
+  auto make_key = [](flatbuffers::FlatBufferBuilder &fbb, const char *s) {
+    fbb.Finish(fbb.CreateString(s));
+    return flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+  };
+  flatbuffers::FlatBufferBuilder fbb1, fbb2;
+  auto early = make_key(fbb1, "early");
+  auto creator = make_key(fbb2, "creator");
+
+  auto append = [](ametsuchi::Ametsuchi &ametsuchi, const char *creator) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, creator);
+    ametsuchi.append(&blob);
+  };
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  ametsuchi::Ametsuchi::Options options;
+  // every commit spills a sorted run
+  options.bulk_run_size = 1;
+  auto index = ametsuchi::TxStore::INDEX_ASSET_CREATE;
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    // bulk loaded keys go before and into the key stored already
+    append(ametsuchi, "middle");
+    ametsuchi.commit();
+
+    ametsuchi.begin_bulk_load();
+    for (int block = 0; block < 5; block++) {
+      for (int i = 0; i < 10; i++) append(ametsuchi, "creator");
+      append(ametsuchi, "early");
+      ametsuchi.commit();
+    }
+    append(ametsuchi, "middle");
+    ASSERT_THROW(ametsuchi.getAssetCreateByKey(creator),
+                 ametsuchi::exception::Exception);
+
+    ametsuchi.end_bulk_load();
+    ASSERT_EQ(ametsuchi.countTxByKey(index, creator), 50u);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(early).size(), 5u);
+    ASSERT_EQ(ametsuchi.getBlockTxs(2).size(), 11u);
+
+    // interrupted load
+    ametsuchi.begin_bulk_load();
+    append(ametsuchi, "creator");
+    ametsuchi.commit();
+  }
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder, options);
+    ASSERT_THROW(ametsuchi.getAssetCreateByKey(creator),
+                 ametsuchi::exception::Exception);
+    // indexes would miss it
+    ASSERT_THROW(append(ametsuchi, "creator"),
+                 ametsuchi::exception::Exception);
+
+    // the load is resumed with records of the interrupted one
+    ametsuchi.begin_bulk_load();
+    append(ametsuchi, "creator");
+    ametsuchi.end_bulk_load();
+    ASSERT_EQ(ametsuchi.countTxByKey(index, creator), 52u);
+    ASSERT_EQ(ametsuchi.getAssetCreateByKey(creator).size(), 52u);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, RebuildIndexesTest) {
+  flatbuffers::FlatBufferBuilder kb(256);
+  kb.Finish(kb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(kb.GetBufferPointer());
+  auto index = ametsuchi::TxStore::INDEX_ASSET_CREATE;
+
+  std::vector<std::vector<uint8_t>> blobs;
+  for (int i = 0; i < 40; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    blobs.push_back(generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5,
+        i % 2 ? "creator" : "other"));
+  }
+
+  // reference: all transactions appended as usual
+  ametsuchi::merkle::hash_t root;
+  for (size_t i = 0; i < blobs.size(); i++) {
+    root = ametsuchi_.append(&blobs[i]);
+    if (i % 10 == 9) ametsuchi_.commit();
+  }
+  ametsuchi_.rebuild_indexes(3);
+  ASSERT_EQ(ametsuchi_.countTxByKey(index, key), 20u);
+  ASSERT_EQ(ametsuchi_.getAssetCreateByKey(key).size(), 20u);
+
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    ametsuchi.begin_bulk_load();
+    for (size_t i = 0; i < blobs.size() - 1; i++) {
+      ametsuchi.append(&blobs[i]);
+      if (i % 10 == 9) ametsuchi.commit();
+    }
+    ametsuchi.commit();
+  }
+  {
+    // interrupted bulk load: merkle tree is persisted, indexes are restored
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    ASSERT_THROW(ametsuchi.countTxByKey(index, key),
+                 ametsuchi::exception::Exception);
+    ASSERT_THROW(ametsuchi.getTxByTime(0, UINT64_MAX),
+                 ametsuchi::exception::Exception);
+    ametsuchi.rebuild_indexes(2);
+    ASSERT_EQ(ametsuchi.countTxByKey(index, key), 19u);
+    // time trees are rebuilt as well
+    ASSERT_EQ(ametsuchi.getTxByTime(0, UINT64_MAX).size(), 39u);
+    ASSERT_EQ(ametsuchi.getTxByKeyTime(key, 0, UINT64_MAX).size(), 19u);
+    ASSERT_EQ(ametsuchi.append(&blobs.back()), root);
+  }
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, FormatVersionTest) {
+  std::string opt_folder = "/tmp/ametsuchi_opt/";
+  {
+    ametsuchi::Ametsuchi ametsuchi(opt_folder);
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union());
+    ametsuchi.append(&blob);
+    ametsuchi.commit();
+  }
+
+  // a database of a newer format
+  MDB_env *env;
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  uint32_t version = UINT32_MAX;
+  std::string name = "format_version";
+  MDB_val c_key{name.size(), (void *)name.data()};
+  MDB_val c_val{sizeof(version), &version};
+  ASSERT_EQ(mdb_env_create(&env), 0);
+  ASSERT_EQ(mdb_env_set_maxdbs(env, 64), 0);
+  ASSERT_EQ(mdb_env_open(env, opt_folder.c_str(), 0, 0700), 0);
+  ASSERT_EQ(mdb_txn_begin(env, nullptr, 0, &txn), 0);
+  ASSERT_EQ(mdb_dbi_open(txn, "meta", 0, &dbi), 0);
+  ASSERT_EQ(mdb_put(txn, dbi, &c_key, &c_val, 0), 0);
+  ASSERT_EQ(mdb_txn_commit(txn), 0);
+  mdb_env_close(env);
+
+  ASSERT_THROW(ametsuchi::Ametsuchi ametsuchi(opt_folder),
+               ametsuchi::exception::Exception);
+  system(("rm -rf " + opt_folder).c_str());
+}
+
+TEST_F(Ametsuchi_Test, BatchedKeyQueryTest) {
+  std::vector<std::string> names = {"zed", "alice", "bob", "unknown"};
+  flatbuffers::FlatBufferBuilder kb(256);
+  kb.Finish(kb.CreateVectorOfStrings(names));
+  auto strings = flatbuffers::GetRoot<
+      flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>>(
+      kb.GetBufferPointer());
+  std::vector<const flatbuffers::String *> keys;
+  for (size_t i = 0; i < strings->size(); i++) keys.push_back(strings->Get(i));
+
+  // zed: 3, alice: 1, bob: 2 transactions
+  for (auto creator : {"zed", "alice", "bob", "zed", "bob", "zed"}) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5, creator);
+    ametsuchi_.append(&blob);
+  }
+
+  auto index = ametsuchi::TxStore::INDEX_ASSET_CREATE;
+  auto uncommitted = ametsuchi_.getTxByKeys(index, keys, true);
+  ASSERT_EQ(uncommitted.size(), 4u);
+  ASSERT_EQ(uncommitted[0].size(), 3u);
+  ametsuchi_.commit();
+
+  // results are in the order of keys, same as separate queries
+  auto result = ametsuchi_.getTxByKeys(index, keys);
+  ASSERT_EQ(result.size(), 4u);
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto single = ametsuchi_.getAssetCreateByKey(keys[i]);
+    ASSERT_EQ(result[i].size(), single.size());
+    for (size_t j = 0; j < single.size(); j++) {
+      ASSERT_EQ(result[i][j].size, single[j].size);
+      ASSERT_EQ(memcmp(result[i][j].data, single[j].data, single[j].size), 0);
+    }
+  }
+  ASSERT_EQ(result[0].size(), 3u);
+  ASSERT_EQ(result[1].size(), 1u);
+  ASSERT_EQ(result[2].size(), 2u);
+  ASSERT_EQ(result[3].size(), 0u);
+
+  auto snapshot = ametsuchi_.snapshot();
+  ASSERT_EQ(snapshot.getTxByKeys(index, keys)[2].size(), 2u);
+}
+
+TEST_F(Ametsuchi_Test, TimeRangeTest) {
+  flatbuffers::FlatBufferBuilder kb(256);
+  kb.Finish(kb.CreateString("creator"));
+  auto key = flatbuffers::GetRoot<flatbuffers::String>(kb.GetBufferPointer());
+
+  auto timestamp = [](const void *tx) {
+    return flatbuffers::GetRoot<iroha::Transaction>(tx)
+        ->signatures()
+        ->Get(0)
+        ->timestamp();
+  };
+
+  // timestamps of transactions of "creator" and of all transactions
+  std::vector<uint64_t> mine, all;
+  for (int i = 0; i < 30; i++) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb).Union(), 5,
+        i % 3 ? "other" : "creator");
+    all.push_back(timestamp(blob.data()));
+    if (i % 3 == 0) mine.push_back(timestamp(blob.data()));
+    ametsuchi_.append(&blob);
+  }
+  ametsuchi_.commit();
+
+  std::sort(all.begin(), all.end());
+  auto from = all[5], to = all[20];
+  auto in_window = [from, to](uint64_t ts) { return from <= ts && ts <= to; };
+
+  auto txs = ametsuchi_.getTxByTime(from, to);
+  ASSERT_EQ(txs.size(), static_cast<size_t>(std::count_if(
+                            all.begin(), all.end(), in_window)));
+  for (size_t i = 1; i < txs.size(); i++) {
+    ASSERT_LE(timestamp(txs[i - 1].data), timestamp(txs[i].data));
+  }
+  for (auto &&tx : txs) ASSERT_TRUE(in_window(timestamp(tx.data)));
+
+  auto own = ametsuchi_.getTxByKeyTime(key, from, to);
+  ASSERT_EQ(own.size(), static_cast<size_t>(std::count_if(
+                            mine.begin(), mine.end(), in_window)));
+  for (auto &&tx : own) {
+    ASSERT_EQ(flatbuffers::GetRoot<iroha::Transaction>(tx.data)
+                  ->creatorPubKey()
+                  ->str(),
+              "creator");
+  }
+
+  ASSERT_EQ(ametsuchi_.getTxByTime(0, UINT64_MAX).size(), 30u);
+  ASSERT_EQ(ametsuchi_.getTxByKeyTime(key, 0, UINT64_MAX).size(), 10u);
+  ASSERT_EQ(ametsuchi_.snapshot().getTxByTime(from, to).size(), txs.size());
+}
+
+TEST_F(Ametsuchi_Test, AttachmentTest) {
+  auto make_tx = [](const std::vector<uint8_t> &data) {
+    flatbuffers::FlatBufferBuilder fbb(data.size() + 2048);
+    std::vector<flatbuffers::Offset<iroha::Signature>> sigs{
+        generator::random_signature(fbb)};
+    auto cmd = generator::random_AssetCreate(fbb).Union();
+    auto tx = iroha::CreateTransaction(
+        fbb, fbb.CreateString("creator"), iroha::Command::AssetCreate, cmd,
+        fbb.CreateVector(sigs), fbb.CreateVector(generator::random_blob(32)),
+        iroha::CreateAttachment(fbb, fbb.CreateString("application/pdf"),
+                                fbb.CreateVector(data)));
+    fbb.Finish(tx);
+    uint8_t *ptr = fbb.GetBufferPointer();
+    return std::vector<uint8_t>(ptr, ptr + fbb.GetSize());
+  };
+  auto same = [](const ametsuchi::AM_val &val,
+                 const std::vector<uint8_t> &blob) {
+    return val.size == blob.size() &&
+           std::memcmp(val.data, blob.data(), blob.size()) == 0;
+  };
+
+  auto large = generator::random_blob(AMETSUCHI_ATTACHMENT_THRESHOLD);
+  auto small = generator::random_blob(100);
+
+  auto large_tx = make_tx(large), small_tx = make_tx(small);
+  ametsuchi_.append(&large_tx);
+  ametsuchi_.append(&small_tx);
+
+  // the same data is stored once
+  auto copy_tx = make_tx(large);
+  ametsuchi_.append(&copy_tx);
+  ametsuchi_.commit();
+
+  // transactions are read back exactly as appended, so signatures match
+  auto txs = ametsuchi_.getTxByTime(0, UINT64_MAX);
+  ASSERT_EQ(txs.size(), 3u);
+  ASSERT_TRUE(same(txs[0], large_tx));
+  ASSERT_TRUE(same(txs[1], small_tx));
+  ASSERT_TRUE(same(txs[2], copy_tx));
+
+  auto tx_hash =
+      flatbuffers::GetRoot<iroha::Transaction>(large_tx.data())->hash();
+  ametsuchi::merkle::hash_t hash;
+  std::copy(tx_hash->begin(), tx_hash->end(), hash.begin());
+  ASSERT_TRUE(same(ametsuchi_.getTxByHash(hash), large_tx));
+  auto block = ametsuchi_.getBlockTxs(1);
+  ASSERT_EQ(block.size(), 3u);
+  ASSERT_TRUE(same(block[2], copy_tx));
+
+  auto data_hash = ametsuchi::merkle::MerkleTree::hash(large);
+  auto data = ametsuchi_.getAttachment(data_hash);
+  ASSERT_EQ(data.size, large.size());
+  ASSERT_EQ(std::memcmp(data.data, large.data(), large.size()), 0);
+  ASSERT_EQ(ametsuchi_.snapshot().getAttachment(data_hash).size,
+            large.size());
+
+  // small data is not stored apart
+  auto small_hash = ametsuchi::merkle::MerkleTree::hash(small);
+  ASSERT_EQ(ametsuchi_.getAttachment(small_hash).data, nullptr);
+}
+
+TEST_F(Ametsuchi_Test, ReceiptTest) {
+  auto currency = [](uint64_t amount) {
+    return generator::random_asset_wrapper_currency(amount, 2, "Dollar", "USA",
+                                                    "l1");
+  };
+  auto to_hash = [](const std::vector<uint8_t> &blob) {
+    ametsuchi::merkle::hash_t hash;
+    std::copy(blob.begin(), blob.end(), hash.begin());
+    return hash;
+  };
+
+  auto create_hash = generator::random_blob(32);
+  auto add_hash = generator::random_blob(32);
+  auto remove_hash = generator::random_blob(32);
+  std::vector<uint8_t> create, add, remove;
+  {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    create = generator::random_transaction(
+        fbb, iroha::Command::AssetCreate,
+        generator::random_AssetCreate(fbb, "Dollar", "USA", "l1").Union(), 5,
+        generator::random_public_key(), create_hash);
+  }
+  {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    add = generator::random_transaction(
+        fbb, iroha::Command::AssetAdd,
+        generator::random_AssetAdd(fbb, "1", currency(100)).Union(), 5,
+        generator::random_public_key(), add_hash);
+  }
+  {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    remove = generator::random_transaction(
+        fbb, iroha::Command::AssetRemove,
+        generator::random_AssetRemove(fbb, "1", currency(1000)).Union(), 5,
+        generator::random_public_key(), remove_hash);
+  }
+
+  ametsuchi_.append(&create);
+  ametsuchi_.commit();
+  ametsuchi_.append(&add);
+  ASSERT_THROW(ametsuchi_.append(&remove),
+               ametsuchi::exception::InvalidTransaction);
+  // a failed transaction is not the end of a block
+  ASSERT_THROW(ametsuchi_.append(&remove),
+               ametsuchi::exception::InvalidTransaction);
+
+  ametsuchi::TxStore::Receipt receipt;
+  ASSERT_FALSE(ametsuchi_.getReceipt(to_hash(add_hash), receipt));
+  ASSERT_TRUE(ametsuchi_.getReceipt(to_hash(remove_hash), receipt, true));
+  ametsuchi_.commit();
+
+  ASSERT_TRUE(ametsuchi_.getReceipt(to_hash(create_hash), receipt));
+  ASSERT_EQ(receipt.code, iroha::Code::COMMIT);
+  ASSERT_EQ(receipt.height, 1u);
+  ASSERT_EQ(receipt.seq, 1u);
+
+  ASSERT_TRUE(ametsuchi_.getReceipt(to_hash(add_hash), receipt));
+  ASSERT_EQ(receipt.code, iroha::Code::COMMIT);
+  ASSERT_EQ(receipt.height, 2u);
+  ASSERT_EQ(receipt.seq, 2u);
+
+  ASSERT_TRUE(ametsuchi_.snapshot().getReceipt(to_hash(remove_hash), receipt));
+  ASSERT_EQ(receipt.code, iroha::Code::FAIL);
+  ASSERT_EQ(receipt.reason,
+            ametsuchi::exception::InvalidTransaction::NOT_ENOUGH_ASSETS);
+  ASSERT_EQ(receipt.height, 2u);
+
+  // resubmitted transaction does not lose its COMMIT receipt
+  ametsuchi_.append(&add);
+  ametsuchi_.commit();
+  ASSERT_TRUE(ametsuchi_.getReceipt(to_hash(add_hash), receipt));
+  ASSERT_EQ(receipt.code, iroha::Code::COMMIT);
+  ASSERT_EQ(receipt.seq, 2u);
+
+  ASSERT_FALSE(ametsuchi_.getReceipt(to_hash(generator::random_blob(32)),
+                                     receipt));
+}
+
+TEST_F(Ametsuchi_Test, BalanceOverlayTest) {
+  auto transfer = [this](uint64_t amount, const std::string &from,
+                         const std::string &to) {
+    flatbuffers::FlatBufferBuilder fbb(2048);
+    auto blob = generator::random_transaction(
+        fbb, iroha::Command::AssetTransfer,
+        generator::random_AssetTransfer(
+            fbb, generator::random_asset_wrapper_currency(amount, 2, "Dollar",
+                                                          "USA", "l1"),
+            from, to).Union());
+    ametsuchi_.append(&blob);
+  };
+
+  create_dollar(ametsuchi_);
+  add_dollars(ametsuchi_, "1", 1000);
+  ametsuchi_.commit();
+
+  flatbuffers::FlatBufferBuilder kb(256);
+  kb.Finish(kb.CreateVectorOfStrings({"2"}));
+  auto second = flatbuffers::GetRoot<
+      flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>>(
+      kb.GetBufferPointer())->Get(0);
+
+  DollarKeys k;
+  auto amount = [this, &k](const flatbuffers::String *account,
+                           bool uncommitted) {
+    return DollarKeys::amount(
+        ametsuchi_.accountGetAsset(account, k[1], k[2], k[3], uncommitted));
+  };
+
+  // a hot pair of accounts, "2" gets its first asset in this block
+  for (int i = 0; i < 100; i++) transfer(3, "1", "2");
+  for (int i = 0; i < 50; i++) transfer(1, "2", "1");
+  ASSERT_THROW(transfer(1000, "1", "2"),
+               ametsuchi::exception::InvalidTransaction);
+
+  ASSERT_EQ(amount(k[0], true), 750u);
+  ASSERT_EQ(amount(second, true), 250u);
+  ASSERT_EQ(ametsuchi_.accountGetAllAssets(second, true).size(), 1u);
+  ASSERT_EQ(
+      DollarKeys::amount(ametsuchi_.accountGetAllAssets(k[0], true).at(0)),
+      750u);
+  ASSERT_EQ(ametsuchi_.accountCountAssets(second, true), 1u);
+
+  // committed state is not changed until commit
+  ASSERT_EQ(amount(k[0], false), 1000u);
+  ASSERT_THROW(amount(second, false), ametsuchi::exception::InvalidTransaction);
+  ASSERT_EQ(ametsuchi_.accountCountAssets(second), 0u);
+
+  ametsuchi_.commit();
+  ASSERT_EQ(amount(k[0], false), 750u);
+  ASSERT_EQ(amount(second, false), 250u);
+  ASSERT_EQ(ametsuchi_.snapshot().accountGetAllAssets(second).size(), 1u);
+
+  // changes of a rolled back block are lost
+  transfer(250, "2", "1");
+  ASSERT_EQ(amount(second, true), 0u);
+  ametsuchi_.rollback();
+  ASSERT_EQ(amount(second, true), 250u);
+  ASSERT_EQ(amount(k[0], true), 750u);
+}
+
+TEST_F(Ametsuchi_Test, AssetsCacheTest) {
+  create_dollar(ametsuchi_);
+  add_dollars(ametsuchi_, "1", 200);
+  ametsuchi_.commit();
+
+  DollarKeys k;
+  auto amount = [this, &k]() {
+    return DollarKeys::amount(
+        ametsuchi_.accountGetAsset(k[0], k[1], k[2], k[3]));
+  };
+
+  // the second read is a hit
+  ASSERT_EQ(amount(), 200u);
+  ASSERT_EQ(amount(), 200u);
+  ASSERT_EQ(ametsuchi_.accountGetAllAssets(k[0]).size(), 1u);
+
+  // uncommitted change does not reach the cache
+  add_dollars(ametsuchi_, "1", 100);
+  ASSERT_EQ(amount(), 200u);
+  {
+    auto snapshot = ametsuchi_.snapshot();
+    ametsuchi_.commit();
+
+    // reads of this thread share the snapshot, the old state is not cached
+    ASSERT_EQ(amount(), 200u);
+    ASSERT_EQ(DollarKeys::amount(
+                  snapshot.accountGetAsset(k[0], k[1], k[2], k[3])),
+              200u);
+  }
+
+  // commit invalidates the changed account
+  ASSERT_EQ(amount(), 300u);
+  ASSERT_EQ(DollarKeys::amount(ametsuchi_.accountGetAllAssets(k[0]).at(0)),
+            300u);
+
+  // readers in other threads share the cache
+  std::vector<std::thread> readers;
+  std::atomic<int> wrong(0);
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&]() {
+      for (int j = 0; j < 100; j++) {
+        if (amount() != 300) wrong++;
+      }
+    });
+  }
+  for (auto &&reader : readers) reader.join();
+  ASSERT_EQ(wrong, 0);
+
+  flatbuffers::FlatBufferBuilder fbb(256);
+  fbb.Finish(fbb.CreateString("Euro"));
+  auto euro = flatbuffers::GetRoot<flatbuffers::String>(fbb.GetBufferPointer());
+  ASSERT_THROW(ametsuchi_.accountGetAsset(k[0], k[1], k[2], euro),
+               ametsuchi::exception::InvalidTransaction);
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/bloom_filter.h>
+#include <gtest/gtest.h>
+#include <cstdint>
+
+using ametsuchi::BloomFilter;
+
+TEST(BloomFilter_Test, NoFalseNegativesTest) {
+  BloomFilter filter(1000);
+  for (uint64_t i = 0; i < 1000; i++) filter.insert(&i, sizeof(i));
+
+  ASSERT_EQ(filter.size(), 1000);
+  for (uint64_t i = 0; i < 1000; i++) {
+    ASSERT_TRUE(filter.maybe_contains(&i, sizeof(i)));
+  }
+}
+
+TEST(BloomFilter_Test, FalsePositiveRateTest) {
+  BloomFilter filter(10000);
+  for (uint64_t i = 0; i < 10000; i++) filter.insert(&i, sizeof(i));
+
+  size_t positives = 0;
+  for (uint64_t i = 10000; i < 110000; i++) {
+    if (filter.maybe_contains(&i, sizeof(i))) positives++;
+  }
+  // ~1% expected for 10 bits per key
+  ASSERT_LT(positives, 3000);
+}
+
+TEST(BloomFilter_Test, ClearTest) {
+  BloomFilter filter(16);
+  uint64_t key = 42;
+  filter.insert(&key, sizeof(key));
+  filter.clear();
+  ASSERT_EQ(filter.size(), 0);
+  ASSERT_FALSE(filter.maybe_contains(&key, sizeof(key)));
+}
+
+TEST(BloomFilter_Test, SerializeTest) {
+  BloomFilter filter(100);
+  for (uint64_t i = 0; i < 100; i++) filter.insert(&i, sizeof(i));
+
+  auto bytes = filter.serialize();
+  BloomFilter restored;
+  ASSERT_TRUE(restored.deserialize(bytes.data(), bytes.size()));
+  ASSERT_EQ(restored.size(), filter.size());
+  ASSERT_EQ(restored.capacity(), filter.capacity());
+  for (uint64_t i = 0; i < 100; i++) {
+    ASSERT_TRUE(restored.maybe_contains(&i, sizeof(i)));
+  }
+
+  ASSERT_FALSE(restored.deserialize(bytes.data(), bytes.size() - 1));
+}
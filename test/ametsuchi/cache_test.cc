@@ -0,0 +1,112 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/cache.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using ametsuchi::Cache;
+
+TEST(CacheTest, LruTest) {
+  // a single shard evicts in exact LRU order
+  Cache<int, std::string> cache(3, 1);
+  cache.put(1, "a");
+  cache.put(2, "b");
+  cache.put(3, "c");
+
+  // 1 is used, so 2 is the oldest one
+  ASSERT_EQ(*cache.get(1), "a");
+  cache.put(4, "d");
+  ASSERT_EQ(cache.get(2), nullptr);
+  ASSERT_EQ(*cache.get(1), "a");
+  ASSERT_EQ(*cache.get(3), "c");
+  ASSERT_EQ(*cache.get(4), "d");
+  ASSERT_EQ(cache.size(), 3u);
+
+  // replaced value is the most recent one
+  cache.put(3, "e");
+  cache.put(5, "f");
+  ASSERT_EQ(cache.get(1), nullptr);
+  ASSERT_EQ(*cache.get(3), "e");
+
+  // returned value outlives eviction
+  auto kept = cache.get(4);
+  cache.erase(4);
+  ASSERT_EQ(cache.get(4), nullptr);
+  ASSERT_EQ(*kept, "d");
+
+  cache.clear();
+  ASSERT_EQ(cache.size(), 0u);
+}
+
+TEST(CacheTest, ShardCapacityTest) {
+  Cache<int, int> cache(64, 8);
+  for (int i = 0; i < 1000; i++) cache.put(i, i);
+  ASSERT_LE(cache.size(), 64u);
+  for (int i = 0; i < 1000; i++) {
+    auto value = cache.get(i);
+    if (value != nullptr) {
+      ASSERT_EQ(*value, i);
+    }
+  }
+
+  Cache<int, int> disabled(0);
+  disabled.put(1, 1);
+  ASSERT_EQ(disabled.get(1), nullptr);
+}
+
+TEST(CacheTest, VersionTest) {
+  Cache<std::string, int> cache(16);
+
+  // read from the source, then invalidated before put
+  auto version = cache.version("key");
+  cache.erase("key");
+  ASSERT_EQ(*cache.put("key", 1, version), 1);
+  ASSERT_EQ(cache.get("key"), nullptr);
+
+  version = cache.version("key");
+  cache.put("key", 2, version);
+  ASSERT_EQ(*cache.get("key"), 2);
+}
+
+TEST(CacheTest, ConcurrentTest) {
+  Cache<int, int> cache(128);
+  std::atomic<bool> wrong(false);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&cache, &wrong, t]() {
+      for (int i = 0; i < 10000; i++) {
+        auto key = (i * 31 + t) % 512;
+        auto value = cache.get(key);
+        if (value == nullptr) {
+          cache.put(key, key * 2, cache.version(key));
+        } else if (*value != key * 2) {
+          wrong = true;
+        }
+        if (i % 100 == 0) cache.erase(key);
+      }
+    });
+  }
+  for (auto &&thread : threads) thread.join();
+
+  ASSERT_FALSE(wrong);
+  ASSERT_LE(cache.size(), 128u);
+}
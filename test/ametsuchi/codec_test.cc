@@ -0,0 +1,131 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/codec.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using ametsuchi::Codec;
+
+static MDB_val make_val(const std::string &s) {
+  MDB_val val;
+  val.mv_data = (void *)s.data();
+  val.mv_size = s.size();
+  return val;
+}
+
+static std::string to_string(const ametsuchi::AM_val &val) {
+  return std::string(static_cast<const char *>(val.data), val.size);
+}
+
+static std::string sample(size_t i) {
+  return "{creator: \"account" + std::to_string(i % 7) +
+         "@domain\", command: AssetTransfer, amount: " + std::to_string(i) +
+         ", receiver: \"account" + std::to_string(i % 5) + "@domain\"}";
+}
+
+TEST(Codec_Test, NoneTest) {
+  Codec codec;
+  auto s = sample(1);
+  auto val = make_val(s);
+
+  ASSERT_EQ(codec.encode(val).mv_data, val.mv_data);
+  // raw value is not copied
+  ASSERT_EQ(codec.decode(val).data, val.mv_data);
+}
+
+TEST(Codec_Test, RoundTripTest) {
+  Codec codec(Codec::ZSTD);
+  std::string s;
+  for (size_t i = 0; i < 16; i++) s += sample(i);
+
+  auto encoded = codec.encode(make_val(s));
+  ASSERT_TRUE(Codec::is_compressed(encoded));
+  ASSERT_LT(encoded.mv_size, s.size());
+  ASSERT_EQ(to_string(codec.decode(encoded)), s);
+}
+
+TEST(Codec_Test, IncompressibleTest) {
+  Codec codec(Codec::ZSTD);
+  std::string s = "x";
+  auto val = make_val(s);
+
+  // stored as is, read without a copy
+  ASSERT_EQ(codec.encode(val).mv_data, val.mv_data);
+  ASSERT_FALSE(Codec::is_compressed(val));
+}
+
+TEST(Codec_Test, DictionaryTest) {
+  std::vector<std::string> strings;
+  for (size_t i = 0; i < 1000; i++) strings.push_back(sample(i));
+  std::vector<MDB_val> samples;
+  for (auto &&s : strings) samples.push_back(make_val(s));
+
+  auto dictionary = Codec::train(samples, 4096);
+  ASSERT_FALSE(dictionary.empty());
+  ASSERT_LE(dictionary.size(), 4096);
+
+  Codec codec(Codec::ZSTD);
+  auto s = sample(1001) + sample(1002) + sample(1003);
+  auto plain = codec.encode(make_val(s));
+  ASSERT_TRUE(Codec::is_compressed(plain));
+  std::vector<uint8_t> before(static_cast<uint8_t *>(plain.mv_data),
+                              static_cast<uint8_t *>(plain.mv_data) +
+                                  plain.mv_size);
+
+  codec.set_dictionary(dictionary.data(), dictionary.size());
+  auto encoded = codec.encode(make_val(s));
+  ASSERT_TRUE(Codec::is_compressed(encoded));
+  ASSERT_EQ(to_string(codec.decode(encoded)), s);
+
+  // values compressed before the dictionary are still readable
+  MDB_val old;
+  old.mv_data = before.data();
+  old.mv_size = before.size();
+  ASSERT_EQ(to_string(codec.decode(old)), s);
+}
+
+TEST(Codec_Test, ReplaceDictionaryTest) {
+  std::vector<std::string> strings;
+  for (size_t i = 0; i < 1000; i++) strings.push_back(sample(i));
+  std::vector<MDB_val> samples;
+  for (auto &&s : strings) samples.push_back(make_val(s));
+  auto first = Codec::train(samples, 4096);
+
+  for (auto &&s : strings) s = "{hash: \"" + s + s + "\"}";
+  samples.clear();
+  for (auto &&s : strings) samples.push_back(make_val(s));
+  auto second = Codec::train(samples, 4096);
+  ASSERT_FALSE(first.empty());
+  ASSERT_FALSE(second.empty());
+
+  Codec codec(Codec::ZSTD);
+  codec.set_dictionary(first.data(), first.size());
+  auto s = sample(1001) + sample(1002) + sample(1003);
+  auto encoded = codec.encode(make_val(s));
+  std::vector<uint8_t> before(static_cast<uint8_t *>(encoded.mv_data),
+                              static_cast<uint8_t *>(encoded.mv_data) +
+                                  encoded.mv_size);
+
+  // values compressed with the replaced dictionary are still readable
+  codec.set_dictionary(second.data(), second.size());
+  MDB_val old;
+  old.mv_data = before.data();
+  old.mv_size = before.size();
+  ASSERT_EQ(to_string(codec.decode(old)), s);
+  ASSERT_EQ(to_string(codec.decode(codec.encode(make_val(s)))), s);
+}
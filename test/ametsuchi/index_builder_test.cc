@@ -0,0 +1,142 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/common.h>
+#include <ametsuchi/index_builder.h>
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using ametsuchi::IndexBuilder;
+
+class IndexBuilder_Test : public ::testing::Test {
+ protected:
+  virtual void TearDown() { system(("rm -rf " + dir).c_str()); }
+
+  // (tree, key) => seqs in the order of merge()
+  using Merged = std::vector<std::tuple<size_t, std::string,
+                                        std::vector<uint64_t>>>;
+
+  static Merged merge(IndexBuilder &builder) {
+    Merged merged;
+    builder.merge([&merged](size_t tree, const MDB_val &key,
+                            std::vector<uint8_t> &seqs) {
+      std::vector<uint64_t> decoded;
+      for (size_t i = 0; i < seqs.size(); i += ametsuchi::SEQ_LEN) {
+        decoded.push_back(ametsuchi::be64_decode(&seqs[i]));
+      }
+      merged.emplace_back(
+          tree, std::string(static_cast<char *>(key.mv_data), key.mv_size),
+          decoded);
+    });
+    return merged;
+  }
+
+  static void add(IndexBuilder &builder, size_t tree, const std::string &key,
+                  uint64_t seq) {
+    builder.add(tree, key.data(), key.size(), seq);
+  }
+
+  std::string dir = "/tmp/ametsuchi_runs/";
+};
+
+TEST_F(IndexBuilder_Test, MergeTest) {
+  // every commit spills a run
+  IndexBuilder builder(dir, 1);
+  std::map<std::pair<size_t, std::string>, std::vector<uint64_t>> expected;
+
+  uint64_t seq = 0;
+  for (size_t run = 0; run < 5; run++) {
+    for (size_t i = 0; i < 100; i++) {
+      auto tree = i % 3;
+      auto key = "key" + std::to_string((i * 7 + run) % 17);
+      add(builder, tree, key, ++seq);
+      expected[{tree, key}].push_back(seq);
+    }
+    builder.commit();
+  }
+  ASSERT_EQ(builder.runs(), 5);
+  ASSERT_EQ(builder.size(), 500);
+
+  auto merged = merge(builder);
+  ASSERT_EQ(merged.size(), expected.size());
+  size_t i = 0;
+  for (auto &&e : expected) {
+    ASSERT_EQ(std::get<0>(merged[i]), e.first.first);
+    ASSERT_EQ(std::get<1>(merged[i]), e.first.second);
+    ASSERT_EQ(std::get<2>(merged[i]), e.second);
+    i++;
+  }
+  ASSERT_EQ(builder.runs(), 0);
+  ASSERT_EQ(builder.size(), 0);
+}
+
+TEST_F(IndexBuilder_Test, KeyOrderTest) {
+  IndexBuilder builder(dir, 1 << 20);
+  // shorter key first, bytes are unsigned
+  add(builder, 0, std::string("\xff", 1), 1);
+  add(builder, 0, "ab", 2);
+  add(builder, 0, "a", 3);
+  builder.commit();
+  ASSERT_EQ(builder.runs(), 0);
+
+  auto merged = merge(builder);
+  ASSERT_EQ(merged.size(), 3);
+  ASSERT_EQ(std::get<1>(merged[0]), "a");
+  ASSERT_EQ(std::get<1>(merged[1]), "ab");
+  ASSERT_EQ(std::get<1>(merged[2]), "\xff");
+}
+
+TEST_F(IndexBuilder_Test, TruncateTest) {
+  IndexBuilder builder(dir, 1 << 20);
+  add(builder, 0, "a", 1);
+  add(builder, 0, "b", 2);
+  builder.commit();
+  add(builder, 0, "a", 3);
+  add(builder, 0, "c", 4);
+
+  // committed records stay
+  builder.truncate(0);
+  ASSERT_EQ(builder.size(), 2);
+
+  add(builder, 0, "a", 3);
+  builder.truncate(3);
+  ASSERT_EQ(builder.size(), 3);
+
+  auto merged = merge(builder);
+  ASSERT_EQ(merged.size(), 2);
+  ASSERT_EQ(std::get<2>(merged[0]), std::vector<uint64_t>({1, 3}));
+  ASSERT_EQ(std::get<2>(merged[1]), std::vector<uint64_t>({2}));
+}
+
+TEST_F(IndexBuilder_Test, AdoptTest) {
+  IndexBuilder builder(dir, 1 << 20);
+  IndexBuilder other(dir + "other/", 1 << 20);
+  add(builder, 0, "a", 3);
+  add(other, 0, "a", 1);
+  add(other, 1, "a", 2);
+  builder.adopt(other);
+  ASSERT_EQ(other.size(), 0);
+  ASSERT_EQ(builder.size(), 3);
+
+  auto merged = merge(builder);
+  ASSERT_EQ(merged.size(), 2);
+  ASSERT_EQ(std::get<2>(merged[0]), std::vector<uint64_t>({1, 3}));
+  ASSERT_EQ(std::get<0>(merged[1]), 1);
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <ametsuchi/exception.h>
+#include <ametsuchi/segment.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <string>
+
+using ametsuchi::Segment;
+using ametsuchi::SegmentSet;
+using ametsuchi::SegmentWriter;
+
+class Segment_Test : public ::testing::Test {
+ protected:
+  virtual void SetUp() { mkdir(dir.c_str(), 0700); }
+  virtual void TearDown() { system(("rm -rf " + dir).c_str()); }
+
+  static std::string value(uint64_t seq) {
+    return "tx" + std::string(seq % 13, '*') + std::to_string(seq);
+  }
+
+  // values of [first, first + count)
+  std::string write(SegmentSet &set, uint64_t first, uint64_t count) {
+    auto path = set.path(first);
+    SegmentWriter writer(path, first);
+    for (auto seq = first; seq < first + count; seq++) {
+      auto s = value(seq);
+      MDB_val val;
+      val.mv_data = (void *)s.data();
+      val.mv_size = s.size();
+      writer.append(val);
+    }
+    writer.seal();
+    return path;
+  }
+
+  std::string dir = "/tmp/ametsuchi_segments/";
+};
+
+TEST_F(Segment_Test, ReadTest) {
+  SegmentSet set;
+  set.open(dir, 0);
+  // more records than a single step of sparse index
+  Segment segment(write(set, 10, 200));
+  ASSERT_EQ(segment.first(), 10);
+  ASSERT_EQ(segment.last(), 209);
+
+  MDB_val val;
+  for (uint64_t seq = 10; seq < 210; seq++) {
+    ASSERT_TRUE(segment.get(seq, val));
+    ASSERT_EQ(std::string(static_cast<char *>(val.mv_data), val.mv_size),
+              value(seq));
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(val.mv_data) % 8, 0);
+  }
+  ASSERT_FALSE(segment.get(9, val));
+  ASSERT_FALSE(segment.get(210, val));
+}
+
+TEST_F(Segment_Test, SetTest) {
+  SegmentSet set;
+  set.open(dir, 0);
+  set.add(std::make_shared<const Segment>(write(set, 1, 100)));
+  set.add(std::make_shared<const Segment>(write(set, 101, 50)));
+  ASSERT_EQ(set.last(), 150);
+
+  MDB_val val;
+  ASSERT_TRUE(set.get(100, val));
+  ASSERT_TRUE(set.get(101, val));
+  ASSERT_EQ(std::string(static_cast<char *>(val.mv_data), val.mv_size),
+            value(101));
+  ASSERT_FALSE(set.get(151, val));
+
+  // the second segment is not sealed by a durable commit
+  SegmentSet reopened;
+  reopened.open(dir, 100);
+  ASSERT_EQ(reopened.size(), 1);
+  ASSERT_EQ(reopened.last(), 100);
+  ASSERT_FALSE(reopened.get(101, val));
+}
+
+TEST_F(Segment_Test, InvalidTest) {
+  auto path = dir + "invalid.seg";
+  std::ofstream(path) << "not a segment";
+  ASSERT_THROW(Segment segment(path), ametsuchi::exception::Exception);
+}
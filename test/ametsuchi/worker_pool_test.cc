@@ -0,0 +1,74 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/worker_pool.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <set>
+#include <stdexcept>
+
+using ametsuchi::WorkerPool;
+
+TEST(WorkerPool_Test, ResultTest) {
+  WorkerPool pool(4);
+  ASSERT_EQ(pool.size(), 4u);
+
+  std::vector<std::future<size_t>> results;
+  for (size_t i = 0; i < 100; i++) {
+    results.push_back(pool.submit([i]() { return i * i; }));
+  }
+  for (size_t i = 0; i < results.size(); i++) {
+    ASSERT_EQ(results[i].get(), i * i);
+  }
+}
+
+TEST(WorkerPool_Test, ExceptionTest) {
+  WorkerPool pool(2);
+  auto failed = pool.submit([]() -> int { throw std::runtime_error("x"); });
+  ASSERT_THROW(failed.get(), std::runtime_error);
+  // the thread survives the exception
+  ASSERT_EQ(pool.submit([]() { return 1; }).get(), 1);
+}
+
+TEST(WorkerPool_Test, ReuseTest) {
+  WorkerPool pool(3);
+  std::mutex mutex;
+  std::set<std::thread::id> ids;
+
+  // threads are not started per task
+  for (size_t round = 0; round < 50; round++) {
+    std::vector<std::future<void>> done;
+    for (size_t i = 0; i < 6; i++) {
+      done.push_back(pool.submit([&mutex, &ids]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.insert(std::this_thread::get_id());
+      }));
+    }
+    for (auto &&d : done) d.get();
+  }
+  ASSERT_LE(ids.size(), 3u);
+}
+
+TEST(WorkerPool_Test, DrainTest) {
+  std::atomic<size_t> count{0};
+  {
+    WorkerPool pool(2);
+    for (size_t i = 0; i < 1000; i++) pool.submit([&count]() { count++; });
+  }
+  // queued tasks are run before the pool is destroyed
+  ASSERT_EQ(count.load(), 1000u);
+}
@@ -0,0 +1,128 @@
+/**
+ * Copyright Soramitsu Co., Ltd. 2017 All Rights Reserved.
+ * http://soramitsu.co.jp
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ametsuchi/ametsuchi.h>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+static const char USAGE[] =
+    " <db_folder> [options]\n"
+    "  --threads N         threads decoding transactions\n"
+    "  --disable INDEX     index disabled in the database, e.g.\n"
+    "                      index_asset_create, may be repeated\n"
+    "  --block-size N      Options::block_size of the database\n"
+    "  --map-size N        Options::map_size of the database\n"
+    "  --hot-blocks N      Options::hot_blocks of the database\n"
+    "  --segment-blocks N  Options::segment_blocks of the database\n"
+    "  --run-size N        Options::bulk_run_size\n";
+
+static size_t parse_size(const char *flag, const char *value) {
+  // stoull skips spaces and accepts negative numbers
+  size_t pos = 0;
+  if (std::isdigit(static_cast<unsigned char>(value[0]))) {
+    auto n = std::stoull(value, &pos);
+    if (value[pos] == '\0') return n;
+  }
+  throw std::invalid_argument(std::string(flag) + ": not a number");
+}
+
+static ametsuchi::TxStore::Tree parse_index(const char *value) {
+  using ametsuchi::TxStore;
+  for (size_t tree = 0; tree < TxStore::TREES_TOTAL; tree++) {
+    auto t = static_cast<TxStore::Tree>(tree);
+    if (TxStore::is_index(t) && std::strcmp(TxStore::name(t), value) == 0) {
+      return t;
+    }
+  }
+  throw std::invalid_argument(std::string("unknown index ") + value);
+}
+
+/**
+ * Rebuild all indexes of the database, e.g. after an index was enabled or
+ * an interrupted bulk load. The database must not be opened by others.
+ * Options, which the database is used with, are passed as flags: disabled
+ * indexes stay empty, block size and segments must match. Codecs do not
+ * matter, compressed trees are only read.
+ */
+int main(int argc, char **argv) {
+  if (argc < 2 || argv[1][0] == '-') {
+    std::cerr << "usage: " << argv[0] << USAGE;
+    return 1;
+  }
+
+  try {
+    ametsuchi::Ametsuchi::Options options;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 2; i < argc; i++) {
+      std::string flag = argv[i];
+      if (i + 1 == argc) {
+        throw std::invalid_argument(flag + ": value is missing");
+      }
+      auto value = argv[++i];
+      if (flag == "--threads") {
+        threads = parse_size(argv[i - 1], value);
+      } else if (flag == "--disable") {
+        options.disabled_indexes.push_back(parse_index(value));
+      } else if (flag == "--block-size") {
+        options.block_size = parse_size(argv[i - 1], value);
+      } else if (flag == "--map-size") {
+        options.map_size = parse_size(argv[i - 1], value);
+      } else if (flag == "--hot-blocks") {
+        options.hot_blocks = parse_size(argv[i - 1], value);
+      } else if (flag == "--segment-blocks") {
+        options.segment_blocks = parse_size(argv[i - 1], value);
+      } else if (flag == "--run-size") {
+        options.bulk_run_size = parse_size(argv[i - 1], value);
+      } else {
+        throw std::invalid_argument(flag + ": unknown option");
+      }
+    }
+
+    ametsuchi::Ametsuchi db(argv[1], options);
+
+    auto start = std::chrono::steady_clock::now();
+    db.rebuild_indexes(threads);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    std::cout << "indexes rebuilt by " << threads << " threads in "
+              << elapsed.count() << " ms" << std::endl;
+  } catch (const std::invalid_argument &e) {
+    std::cerr << e.what() << "\nusage: " << argv[0] << USAGE;
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  } catch (ametsuchi::exception::InvalidTransaction reason) {
+    std::cerr << "invalid transaction " << static_cast<int>(reason)
+              << std::endl;
+    return 1;
+  } catch (ametsuchi::exception::InternalError reason) {
+    std::cerr << "internal error " << static_cast<int>(reason) << std::endl;
+    return 1;
+  } catch (...) {
+    std::cerr << "unknown error" << std::endl;
+    return 1;
+  }
+  return 0;
+}